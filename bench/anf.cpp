@@ -0,0 +1,49 @@
+#include "anf.h"
+#include "bench.h"
+#include "convert.h"
+#include <benchmark/benchmark.h>
+#include <cstdio>
+
+namespace lambcalc {
+namespace bench {
+
+// Footprint of converting a program to closure converted ANF. The counters
+// don't depend on timing, so a change in layout shows up as a change in
+// node_bytes and heap_allocs.
+static void BM_ConvertFootprint(benchmark::State &state) {
+  auto exp = program(state.range(0));
+  anf::NodeArena arena;
+  size_t nodeBytes = 0, allocations = 0;
+  for (auto _ : state) {
+    anf::NodeArena::Scope scope(arena);
+    size_t before = heapAllocations;
+    auto anf = anf::convertDefunc(*exp, anf::Scoping::Fused);
+    auto converted = convert::closureConvert(std::move(anf));
+    benchmark::DoNotOptimize(converted.get());
+    nodeBytes = arena.allocator().bytesUsed();
+    allocations = heapAllocations - before;
+    converted.reset();
+    arena.reset();
+  }
+  state.counters["node_bytes"] = nodeBytes;
+  state.counters["nodes"] = nodeBytes / anf::NodeArena::nodeSize();
+  state.counters["heap_allocs"] = allocations;
+}
+BENCHMARK(BM_ConvertFootprint)->RangeMultiplier(4)->Range(64, 1024);
+
+void printNodeSizes() {
+  std::printf("sizeof(anf::Value)    = %zu\n", sizeof(anf::Value));
+  std::printf("sizeof(anf::Exp)      = %zu\n", sizeof(anf::Exp));
+  std::printf("sizeof(anf::HaltExp)  = %zu\n", sizeof(anf::HaltExp));
+  std::printf("sizeof(anf::FunExp)   = %zu\n", sizeof(anf::FunExp));
+  std::printf("sizeof(anf::JoinExp)  = %zu\n", sizeof(anf::JoinExp));
+  std::printf("sizeof(anf::JumpExp)  = %zu\n", sizeof(anf::JumpExp));
+  std::printf("sizeof(anf::AppExp)   = %zu\n", sizeof(anf::AppExp));
+  std::printf("sizeof(anf::BopExp)   = %zu\n", sizeof(anf::BopExp));
+  std::printf("sizeof(anf::IfExp)    = %zu\n", sizeof(anf::IfExp));
+  std::printf("sizeof(anf::TupleExp) = %zu\n", sizeof(anf::TupleExp));
+  std::printf("sizeof(anf::ProjExp)  = %zu\n", sizeof(anf::ProjExp));
+}
+
+} // namespace bench
+} // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "anf.h"
+#include "ast.h"
+#include "hoist.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace lambcalc {
+namespace bench {
+
+// Number of heap allocations made by the benchmarks so far.
+extern size_t heapAllocations;
+
+// Builds (fn f => f 0) (fn x => x + 0) + ... + (fn f => f n) (fn x => x + n),
+// which has n closures and applications.
+std::unique_ptr<ast::Exp<>> program(int n);
+
+void printNodeSizes();
+
+// The passes that use StaticWorklistVisitor, written with the dynamic
+// WorklistVisitor instead, so that benchmarks can compare the two.
+namespace dynamic {
+void rename(ast::Exp<> &exp);
+std::unique_ptr<anf::Exp> closureConvert(std::unique_ptr<anf::Exp> &&exp);
+std::vector<anf::Function> hoist(std::unique_ptr<anf::Exp> &&exp);
+} // namespace dynamic
+
+} // namespace bench
+} // namespace lambcalc
+
+#endif
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include "bench.h"
+#include "convert.h"
+#include "rename.h"
+#include "utils.h"
+#include "visitor.h"
+#include <algorithm>
+#include <optional>
+#include <stack>
+#include <vector>
+
+// The passes that were ported to StaticWorklistVisitor, as they were written
+// with WorklistVisitor: virtual addWorklist hooks, a std::stack worklist and
+// an FnTask closure for every continuation.
+
+namespace lambcalc {
+namespace bench {
+namespace dynamic {
+
+namespace {
+
+template <template <class> class Ptr>
+using AlphaRenamePipeline =
+    ast::WorklistVisitor<DefaultVisitor,
+                         WorklistTask<ast::Exp<Ptr>, Ptr>, std::stack,
+                         Ptr>;
+template <template <class> class Ptr>
+class AlphaRenameVisitor : public AlphaRenamePipeline<Ptr> {
+  int counter_;
+  // Current renaming of every symbol, indexed by symbol slot.
+  std::vector<std::optional<Symbol>> rename_;
+
+  Symbol fresh(Symbol name) { return Symbol::fresh(name, counter_++); }
+  std::optional<Symbol> &renamed(Symbol name) {
+    if (name.slot() >= rename_.size()) {
+      rename_.resize(std::max(name.slot() + 1, rename_.size() * 2));
+    }
+    return rename_[name.slot()];
+  }
+
+public:
+  AlphaRenameVisitor() : counter_(0) {}
+  using AlphaRenamePipeline<Ptr>::operator();
+  using AlphaRenamePipeline<Ptr>::getWorklist;
+  void operator()(ast::LamExp<Ptr> &exp) {
+    Symbol param = exp.param;
+    std::optional<Symbol> oldRenamed = renamed(param);
+    exp.param = fresh(param);
+    renamed(param) = exp.param;
+    getWorklist().emplace(std::in_place_index<1>, [&, param, oldRenamed]() {
+      renamed(param) = oldRenamed;
+    });
+    AlphaRenamePipeline<Ptr>::operator()(exp);
+  }
+  void operator()(ast::VarExp &exp) {
+    if (auto name = renamed(exp.name)) {
+      exp.name = *name;
+    } else {
+      throw ast::NotInScopeException(exp.name);
+    }
+  }
+};
+
+const Symbol closurePrefix("closure");
+const Symbol projPrefix("proj");
+
+using ClosureConvertPipeline =
+    anf::WorklistVisitor<DefaultVisitor, WorklistTask<anf::Exp>,
+                         std::stack>;
+class ClosureConvertVisitor : public ClosureConvertPipeline {
+  int counter_;
+  std::unique_ptr<anf::Exp> *parentLink_;
+  const convert::FunctionFreeVars &functionFreeVars_;
+  anf::Var fresh(Symbol prefix) { return Symbol::fresh(prefix, counter_++); }
+
+public:
+  using ClosureConvertPipeline::operator();
+  explicit ClosureConvertVisitor(
+      const convert::FunctionFreeVars &functionFreeVars)
+      : counter_(0), parentLink_(nullptr),
+        functionFreeVars_(functionFreeVars) {}
+  void setParent(std::unique_ptr<anf::Exp> *parentLink) {
+    parentLink_ = parentLink;
+  }
+  void operator()(anf::FunExp &exp) {
+    const auto &freeVariables = functionFreeVars_.at(&exp);
+    auto closureParam = fresh(closurePrefix);
+    exp.params.insert(exp.params.begin(), closureParam);
+    auto body = std::move(exp.body);
+    int i = 1;
+    for (auto var : freeVariables) {
+      body = anf::make(anf::ProjExp{var, closureParam, i++, std::move(body)});
+    }
+    exp.body = std::move(body);
+
+    anf::Values vars;
+    vars.push_back(anf::GlobValue{exp.name});
+    for (auto var : freeVariables) {
+      vars.push_back(anf::VarValue{var});
+    }
+    exp.rest = anf::make(
+        anf::TupleExp{exp.name, std::move(vars), std::move(exp.rest)});
+    ClosureConvertPipeline::operator()(exp);
+  }
+  void operator()(anf::AppExp &exp) {
+    auto projName = fresh(projPrefix);
+    auto paramValues = std::move(exp.paramValues);
+    paramValues.insert(paramValues.begin(), anf::VarValue{exp.funName});
+
+    auto parentLink = parentLink_;
+    getWorklist().emplace(
+        std::in_place_index<1>,
+        [&exp, projName, paramValues = std::move(paramValues),
+         parentLink]() mutable {
+          auto app = anf::make(anf::AppExp{std::move(exp.name), projName,
+                                           std::move(paramValues),
+                                           std::move(exp.rest)});
+          *parentLink = anf::make(
+              anf::ProjExp{projName, exp.funName, 0, std::move(app)});
+        });
+    addWorklist(&exp.rest);
+  }
+};
+
+const Symbol entryPrefix("entry");
+const Symbol thenPrefix("then");
+const Symbol elsePrefix("else");
+
+using HoistPipeline =
+    anf::WorklistVisitor<DefaultVisitor, WorklistTask<anf::Exp>,
+                         std::stack>;
+class HoistVisitor : public HoistPipeline {
+  int counter_;
+  std::vector<anf::Join> currentJoins_;
+  std::vector<anf::Function> collected_;
+  std::unique_ptr<anf::Exp> *parentLink_;
+
+  anf::Var fresh(Symbol prefix) { return Symbol::fresh(prefix, counter_++); }
+
+public:
+  using HoistPipeline::operator();
+  HoistVisitor() : counter_(0), parentLink_(nullptr) {}
+  void setParentLink(std::unique_ptr<anf::Exp> *parentLink) {
+    parentLink_ = parentLink;
+  }
+  std::vector<anf::Function> moveOutCollectedFunctions() {
+    return std::move(collected_);
+  }
+  void operator()(anf::FunExp &exp) {
+    std::vector<anf::Join> savedJoins;
+    std::swap(currentJoins_, savedJoins);
+    auto savedParentLink = parentLink_;
+    getWorklist().emplace(std::in_place_index<1>, [savedParentLink, &exp]() {
+      if (savedParentLink)
+        *savedParentLink = std::move(exp.rest);
+    });
+    addWorklist(&exp.rest);
+    getWorklist().emplace(
+        std::in_place_index<1>,
+        [&, savedJoins = std::move(savedJoins)]() mutable {
+          anf::Join entryBlock{fresh(entryPrefix), std::nullopt,
+                               std::move(exp.body)};
+          collected_.emplace_back(std::move(exp.name), std::move(exp.params),
+                                  std::move(entryBlock),
+                                  std::move(currentJoins_));
+          currentJoins_ = std::move(savedJoins);
+        });
+    addWorklist(&exp.body);
+  }
+  void operator()(anf::JoinExp &exp) {
+    auto savedParentLink = parentLink_;
+    getWorklist().emplace(std::in_place_index<1>, [savedParentLink, &exp]() {
+      if (savedParentLink)
+        *savedParentLink = std::move(exp.rest);
+    });
+    addWorklist(&exp.rest);
+    getWorklist().emplace(std::in_place_index<1>, [&]() {
+      currentJoins_.emplace_back(std::move(exp.name), std::move(exp.slot),
+                                 std::move(exp.body));
+    });
+    addWorklist(&exp.body);
+  }
+  void operator()(anf::IfExp &exp) {
+    getWorklist().emplace(std::in_place_index<1>, [&]() {
+      auto thenBlockName = fresh(thenPrefix);
+      auto elseBlockName = fresh(elsePrefix);
+      currentJoins_.emplace_back(thenBlockName, std::nullopt,
+                                 std::move(exp.thenBranch));
+      currentJoins_.emplace_back(elseBlockName, std::nullopt,
+                                 std::move(exp.elseBranch));
+      exp.thenBranch = anf::make(anf::JumpExp{thenBlockName, std::nullopt});
+      exp.elseBranch = anf::make(anf::JumpExp{elseBlockName, std::nullopt});
+    });
+    addWorklist(&exp.elseBranch);
+    addWorklist(&exp.thenBranch);
+  }
+};
+
+} // namespace
+
+void rename(ast::Exp<> &exp) {
+  AlphaRenameVisitor<std::unique_ptr> visitor;
+  auto &worklist = visitor.getWorklist();
+  std::visit(visitor, exp);
+  while (!worklist.empty()) {
+    auto task = std::move(worklist.top());
+    worklist.pop();
+    std::visit(overloaded{[&](NodeTask<ast::Exp<>> &n) {
+                            ast::Exp<> &exp = std::get<1>(n);
+                            std::visit(visitor, exp);
+                          },
+                          [](FnTask &f) { std::move(f)(); }},
+               task);
+  }
+}
+
+std::unique_ptr<anf::Exp> closureConvert(std::unique_ptr<anf::Exp> &&start) {
+  auto root = std::move(start);
+  auto freeVariables = convert::functionFreeVars(*root);
+  ClosureConvertVisitor visitor(freeVariables);
+  auto &worklist = visitor.getWorklist();
+  worklist.emplace(&root);
+  while (!worklist.empty()) {
+    auto task = std::move(worklist.top());
+    worklist.pop();
+    std::visit(overloaded{[&](const NodeTask<anf::Exp> &n) {
+                            auto [parent, exp] = n;
+                            visitor.setParent(parent);
+                            std::visit(visitor, static_cast<anf::Exp &>(exp));
+                          },
+                          [](FnTask &f) { std::move(f)(); }},
+               task);
+  }
+  return root;
+}
+
+std::vector<anf::Function> hoist(std::unique_ptr<anf::Exp> &&start) {
+  HoistVisitor visitor;
+  auto root = anf::make(anf::FunExp{"main", {}, std::move(start),
+                                    anf::make(anf::HaltExp{anf::IntValue{0}})});
+  auto &worklist = visitor.getWorklist();
+  worklist.emplace(&root);
+  while (!worklist.empty()) {
+    auto task = std::move(worklist.top());
+    worklist.pop();
+    std::visit(overloaded{[&](const NodeTask<anf::Exp> &n) {
+                            auto [parent, exp] = n;
+                            visitor.setParentLink(parent);
+                            std::visit(visitor, static_cast<anf::Exp &>(exp));
+                          },
+                          [](FnTask &f) { std::move(f)(); }},
+               task);
+  }
+  return visitor.moveOutCollectedFunctions();
+}
+
+} // namespace dynamic
+} // namespace bench
+} // namespace lambcalc
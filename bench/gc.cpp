@@ -0,0 +1,46 @@
+#include "runtime.h"
+#include <benchmark/benchmark.h>
+
+namespace lambcalc {
+namespace bench {
+
+// Allocates 3 field objects that form a list the way lowered code does,
+// dropping the list every live allocations. The first argument is the initial
+// heap size, and the second is how many objects are live at most, so the
+// counters show how the collector trades heap growth for pause times.
+static void BM_GcStress(benchmark::State &state) {
+  runtime::configure({.heapSize = static_cast<size_t>(state.range(0))});
+  runtime::reset();
+  int64_t live = state.range(1);
+  struct {
+    runtime::Frame frame;
+    void *list;
+  } stack{{runtime::lambcalc_heap()->frames, 1}, runtime::tagged(0)};
+  runtime::lambcalc_heap()->frames = &stack.frame;
+  int64_t length = 0;
+  for (auto _ : state) {
+    void **object = runtime::allocate(3);
+    object[0] = nullptr;
+    object[1] = runtime::tagged(length);
+    object[2] = stack.list;
+    stack.list = object;
+    if (++length == live) {
+      stack.list = runtime::tagged(0);
+      length = 0;
+    }
+  }
+  runtime::lambcalc_heap()->frames = stack.frame.prev;
+  auto stats = runtime::stats();
+  state.SetItemsProcessed(state.iterations());
+  state.counters["collections"] = stats.collections;
+  state.counters["max_pause_us"] =
+      std::chrono::duration<double, std::micro>(stats.maxPause).count();
+  state.counters["heap_bytes"] = stats.heapSize;
+  runtime::configure({});
+  runtime::reset();
+}
+BENCHMARK(BM_GcStress)
+    ->ArgsProduct({{1 << 16, 1 << 20}, {1, 1 << 10, 1 << 16}});
+
+} // namespace bench
+} // namespace lambcalc
\ No newline at end of file
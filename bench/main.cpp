@@ -0,0 +1,48 @@
+#include "bench.h"
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <new>
+
+namespace lambcalc {
+namespace bench {
+
+size_t heapAllocations = 0;
+
+std::unique_ptr<ast::Exp<>> program(int n) {
+  using namespace ast;
+  auto exp = make(IntExp{0});
+  for (int i = 0; i < n; ++i) {
+    auto apply = make(LamExp{
+        "f", make(AppExp{make(VarExp{"f"}), make(IntExp{i})})});
+    auto add = make(LamExp{
+        "x", make(BopExp{Bop::Plus, make(VarExp{"x"}), make(IntExp{i})})});
+    exp = make(BopExp{Bop::Plus, make(AppExp{std::move(apply), std::move(add)}),
+                      std::move(exp)});
+  }
+  return exp;
+}
+
+} // namespace bench
+} // namespace lambcalc
+
+void *operator new(size_t size) {
+  ++lambcalc::bench::heapAllocations;
+  if (void *ptr = std::malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+int main(int argc, char **argv) {
+  lambcalc::bench::printNodeSizes();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "anf.h"
+#include "bench.h"
+#include "convert.h"
+#include "hoist.h"
+#include "lower.h"
+#include "rename.h"
+#include <benchmark/benchmark.h>
+
+namespace lambcalc {
+namespace bench {
+
+// Times a pass over the output of setup, reporting the heap allocations the
+// pass makes (including the nodes it creates) as allocs.
+template <typename Setup, typename Pass>
+static void runPass(benchmark::State &state, Setup setup, Pass pass) {
+  size_t allocations = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto input = setup();
+    size_t before = heapAllocations;
+    state.ResumeTiming();
+    auto output = pass(std::move(input));
+    benchmark::DoNotOptimize(output);
+    state.PauseTiming();
+    allocations = heapAllocations - before;
+    { auto destroyed = std::move(output); }
+    state.ResumeTiming();
+  }
+  state.counters["allocs"] = allocations;
+}
+
+static void BM_Rename(benchmark::State &state) {
+  runPass(
+      state, [&] { return program(state.range(0)); },
+      [](std::unique_ptr<ast::Exp<>> exp) {
+        ast::rename(*exp);
+        return exp;
+      });
+}
+BENCHMARK(BM_Rename)->Arg(1 << 14);
+
+static void BM_RenameDynamic(benchmark::State &state) {
+  runPass(
+      state, [&] { return program(state.range(0)); },
+      [](std::unique_ptr<ast::Exp<>> exp) {
+        dynamic::rename(*exp);
+        return exp;
+      });
+}
+BENCHMARK(BM_RenameDynamic)->Arg(1 << 14);
+
+static void BM_ClosureConvert(benchmark::State &state) {
+  auto exp = program(state.range(0));
+  runPass(
+      state,
+      [&] {
+        anf::resetCounter();
+        return anf::convertDefunc(*exp, anf::Scoping::Fused);
+      },
+      [](std::unique_ptr<anf::Exp> anf) {
+        return convert::closureConvert(std::move(anf));
+      });
+}
+BENCHMARK(BM_ClosureConvert)->Arg(1 << 14);
+
+static void BM_ClosureConvertDynamic(benchmark::State &state) {
+  auto exp = program(state.range(0));
+  runPass(
+      state,
+      [&] {
+        anf::resetCounter();
+        return anf::convertDefunc(*exp, anf::Scoping::Fused);
+      },
+      [](std::unique_ptr<anf::Exp> anf) {
+        return dynamic::closureConvert(std::move(anf));
+      });
+}
+BENCHMARK(BM_ClosureConvertDynamic)->Arg(1 << 14);
+
+static void BM_Hoist(benchmark::State &state) {
+  auto exp = program(state.range(0));
+  runPass(
+      state,
+      [&] {
+        anf::resetCounter();
+        return convert::closureConvert(
+            anf::convertDefunc(*exp, anf::Scoping::Fused));
+      },
+      [](std::unique_ptr<anf::Exp> converted) {
+        return anf::hoist(std::move(converted));
+      });
+}
+BENCHMARK(BM_Hoist)->Arg(1 << 14);
+
+static void BM_HoistDynamic(benchmark::State &state) {
+  auto exp = program(state.range(0));
+  runPass(
+      state,
+      [&] {
+        anf::resetCounter();
+        return convert::closureConvert(
+            anf::convertDefunc(*exp, anf::Scoping::Fused));
+      },
+      [](std::unique_ptr<anf::Exp> converted) {
+        return dynamic::hoist(std::move(converted));
+      });
+}
+BENCHMARK(BM_HoistDynamic)->Arg(1 << 14);
+
+// Lowers and optimizes at -O<level>, reusing the session like the driver.
+static void BM_Lower(benchmark::State &state) {
+  auto exp = program(state.range(0));
+  lower::Session session(llvm::DataLayout(""),
+                         static_cast<lower::OptLevel>(state.range(1)));
+  runPass(
+      state,
+      [&] {
+        anf::resetCounter();
+        return anf::hoist(convert::closureConvert(
+            anf::convertDefunc(*exp, anf::Scoping::Fused)));
+      },
+      [&](std::vector<anf::Function> fns) {
+        return session.lower(std::move(fns));
+      });
+}
+BENCHMARK(BM_Lower)->ArgsProduct({{1 << 10}, {0, 1, 2, 3}});
+
+} // namespace bench
+} // namespace lambcalc
\ No newline at end of file
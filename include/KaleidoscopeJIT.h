@@ -36,6 +36,7 @@ private:
   std::unique_ptr<ExecutionSession> ES;
 
   DataLayout DL;
+  JITTargetMachineBuilder TMB;
   MangleAndInterner Mangle;
 
   RTDyldObjectLinkingLayer ObjectLayer;
@@ -46,7 +47,7 @@ private:
 public:
   KaleidoscopeJIT(std::unique_ptr<ExecutionSession> ExecSession,
                   JITTargetMachineBuilder JTMB, DataLayout DL)
-      : ES(std::move(ExecSession)), DL(std::move(DL)),
+      : ES(std::move(ExecSession)), DL(std::move(DL)), TMB(JTMB),
         Mangle(*this->ES, this->DL),
         ObjectLayer(*this->ES,
                     []() { return std::make_unique<SectionMemoryManager>(); }),
@@ -67,26 +68,34 @@ public:
       ES->reportError(std::move(Err));
   }
 
-  static Expected<std::unique_ptr<KaleidoscopeJIT>> Create() {
+  // Compiles for the host CPU and its features at the given level.
+  static Expected<std::unique_ptr<KaleidoscopeJIT>>
+  Create(CodeGenOptLevel Level = CodeGenOptLevel::Default) {
     auto EPC = SelfExecutorProcessControl::Create();
     if (!EPC)
       return EPC.takeError();
 
     auto ES = std::make_unique<ExecutionSession>(std::move(*EPC));
 
-    JITTargetMachineBuilder JTMB(
-        ES->getExecutorProcessControl().getTargetTriple());
+    auto JTMB = JITTargetMachineBuilder::detectHost();
+    if (!JTMB)
+      return JTMB.takeError();
+    JTMB->setCodeGenOptLevel(Level);
 
-    auto DL = JTMB.getDefaultDataLayoutForTarget();
+    auto DL = JTMB->getDefaultDataLayoutForTarget();
     if (!DL)
       return DL.takeError();
 
-    return std::make_unique<KaleidoscopeJIT>(std::move(ES), std::move(JTMB),
+    return std::make_unique<KaleidoscopeJIT>(std::move(ES), std::move(*JTMB),
                                              std::move(*DL));
   }
 
   const DataLayout &getDataLayout() const { return this->DL; }
 
+  const JITTargetMachineBuilder &getTargetMachineBuilder() const {
+    return TMB;
+  }
+
   JITDylib &getMainJITDylib() { return MainJD; }
 
   Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
@@ -0,0 +1,183 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "anf.h"
+#include "ast.h"
+#include "utils.h"
+#include <concepts>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace lambcalc {
+
+template <typename A, typename Node>
+concept HasEnter = requires(A &a, const Node &node) { a.enter(node); };
+template <typename A, typename Node>
+concept HasLeave = requires(A &a, const Node &node) { a.leave(node); };
+template <typename A, typename Node>
+concept HasEnterBody = requires(A &a, const Node &node) { a.enterBody(node); };
+template <typename A, typename Node>
+concept HasLeaveBody = requires(A &a, const Node &node) { a.leaveBody(node); };
+
+enum class AnalyzeStep { Enter, LeaveBody, Leave };
+
+namespace detail {
+template <typename A, typename Node> void enter(A &a, const Node &node) {
+  if constexpr (HasEnter<A, Node>) {
+    a.enter(node);
+  }
+}
+template <typename A, typename Node> void leave(A &a, const Node &node) {
+  if constexpr (HasLeave<A, Node>) {
+    a.leave(node);
+  }
+}
+template <typename A, typename Node> void enterBody(A &a, const Node &node) {
+  if constexpr (HasEnterBody<A, Node>) {
+    a.enterBody(node);
+  }
+}
+template <typename A, typename Node> void leaveBody(A &a, const Node &node) {
+  if constexpr (HasLeaveBody<A, Node>) {
+    a.leaveBody(node);
+  }
+}
+} // namespace detail
+
+namespace anf {
+
+/**
+ * Runs several read-only analyses in a single traversal of a tree.
+ *
+ * An analysis is any object with hooks for the node kinds it cares about,
+ * which are called in the order the analyses are given:
+ *
+ *  - enter(node) before the children of node,
+ *  - enterBody(node) and leaveBody(node) around the body of a FunExp or
+ *    JoinExp, which is visited before its rest,
+ *  - leave(node) after all of the children of node.
+ *
+ * Children are visited in order, so the then branch of an if is visited
+ * before the else branch. Hooks are resolved at compile time, and a node
+ * only gets a leave task if some analysis has a leave hook for its kind.
+ */
+template <typename... Analyses>
+void analyze(const Exp &root, Analyses &...analyses) {
+  ChunkedStack<std::pair<const Exp *, AnalyzeStep>> worklist;
+  worklist.emplace(&root, AnalyzeStep::Enter);
+  while (!worklist.empty()) {
+    auto [exp, step] = worklist.top();
+    worklist.pop();
+    std::visit(
+        [&]<typename Node>(const Node &node) {
+          if (step == AnalyzeStep::Leave) {
+            (detail::leave(analyses, node), ...);
+            return;
+          }
+          if (step == AnalyzeStep::LeaveBody) {
+            (detail::leaveBody(analyses, node), ...);
+            return;
+          }
+          (detail::enter(analyses, node), ...);
+          if constexpr ((HasLeave<Analyses, Node> || ...)) {
+            worklist.emplace(exp, AnalyzeStep::Leave);
+          }
+          if constexpr (std::same_as<Node, FunExp> ||
+                        std::same_as<Node, JoinExp>) {
+            worklist.emplace(node.rest.get(), AnalyzeStep::Enter);
+            if constexpr ((HasLeaveBody<Analyses, Node> || ...)) {
+              worklist.emplace(exp, AnalyzeStep::LeaveBody);
+            }
+            worklist.emplace(node.body.get(), AnalyzeStep::Enter);
+            (detail::enterBody(analyses, node), ...);
+          } else if constexpr (std::same_as<Node, IfExp>) {
+            worklist.emplace(node.elseBranch.get(), AnalyzeStep::Enter);
+            worklist.emplace(node.thenBranch.get(), AnalyzeStep::Enter);
+          } else if constexpr (requires { node.rest; }) {
+            worklist.emplace(node.rest.get(), AnalyzeStep::Enter);
+          }
+        },
+        *exp);
+  }
+}
+
+/**
+ * Counts the nodes of a tree, for use with analyze.
+ */
+struct Statistics {
+  size_t nodes = 0;
+  size_t functions = 0;
+  size_t joins = 0;
+  size_t applications = 0;
+  // Deepest nesting of function bodies.
+  size_t maxFunctionDepth = 0;
+
+  void enter(const auto &node);
+  void enterBody(const FunExp &) {
+    maxFunctionDepth = std::max(maxFunctionDepth, ++functionDepth_);
+  }
+  void leaveBody(const FunExp &) { --functionDepth_; }
+  friend std::ostream &operator<<(std::ostream &os, const Statistics &stats);
+
+private:
+  size_t functionDepth_ = 0;
+};
+
+void Statistics::enter(const auto &node) {
+  using Node = std::decay_t<decltype(node)>;
+  ++nodes;
+  functions += std::same_as<Node, FunExp>;
+  joins += std::same_as<Node, JoinExp>;
+  applications += std::same_as<Node, AppExp>;
+}
+
+} // namespace anf
+
+namespace ast {
+
+/**
+ * Runs several read-only analyses in a single traversal of a tree, like
+ * anf::analyze. Children are visited from left to right, and the only hooks
+ * are enter and leave.
+ */
+template <template <class> class Ptr, typename... Analyses>
+void analyze(const Exp<Ptr> &root, Analyses &...analyses) {
+  ChunkedStack<std::pair<const Exp<Ptr> *, AnalyzeStep>> worklist;
+  worklist.emplace(&root, AnalyzeStep::Enter);
+  while (!worklist.empty()) {
+    auto [exp, step] = worklist.top();
+    worklist.pop();
+    std::visit(
+        [&]<typename Node>(const Node &node) {
+          if (step == AnalyzeStep::Leave) {
+            (detail::leave(analyses, node), ...);
+            return;
+          }
+          (detail::enter(analyses, node), ...);
+          if constexpr ((HasLeave<Analyses, Node> || ...)) {
+            worklist.emplace(exp, AnalyzeStep::Leave);
+          }
+          if constexpr (std::same_as<Node, LamExp<Ptr>>) {
+            worklist.emplace(&*node.body, AnalyzeStep::Enter);
+          } else if constexpr (std::same_as<Node, AppExp<Ptr>>) {
+            worklist.emplace(&*node.arg, AnalyzeStep::Enter);
+            worklist.emplace(&*node.fn, AnalyzeStep::Enter);
+          } else if constexpr (std::same_as<Node, BopExp<Ptr>>) {
+            worklist.emplace(&*node.arg2, AnalyzeStep::Enter);
+            worklist.emplace(&*node.arg1, AnalyzeStep::Enter);
+          } else if constexpr (std::same_as<Node, IfExp<Ptr>>) {
+            worklist.emplace(&*node.els, AnalyzeStep::Enter);
+            worklist.emplace(&*node.then, AnalyzeStep::Enter);
+            worklist.emplace(&*node.cond, AnalyzeStep::Enter);
+          }
+        },
+        *exp);
+  }
+}
+
+} // namespace ast
+} // namespace lambcalc
+
+#endif
\ No newline at end of file
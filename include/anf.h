@@ -1,22 +1,42 @@
 #ifndef ANF_H
 #define ANF_H
 
+#include "arena.h"
 #include "ast.h"
+#include "diagnostic.h"
+#include "utils.h"
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <new>
 #include <optional>
 #include <string>
 #include <variant>
 #include <vector>
 
 namespace lambcalc {
+class ThreadPool;
 namespace anf {
 
 struct Value;
 struct Exp;
 
+// Allocates the lists of nodes from the current NodeArena like the nodes
+// themselves, so that releasing a tree to the arena doesn't leak them.
+template <typename T> struct NodeAllocator {
+  using value_type = T;
+
+  NodeAllocator() = default;
+  template <typename U> NodeAllocator(const NodeAllocator<U> &) {}
+
+  T *allocate(size_t n);
+  void deallocate(T *ptr, size_t n);
+  friend bool operator==(NodeAllocator, NodeAllocator) { return true; }
+};
+
 using Cont = std::function<std::unique_ptr<Exp>(Value)>;
-using Var = std::string;
+using Var = Symbol;
 
 struct IntValue {
   int value;
@@ -35,13 +55,18 @@ struct Value : public std::variant<IntValue, VarValue, GlobValue> {
   friend std::ostream &operator<<(std::ostream &os, const Value &value);
 };
 
+// Functions have one parameter, plus the closure after closure conversion,
+// and applications have as many arguments, so they are stored inline.
+using Vars = SmallVector<Var, 2, NodeAllocator<Var>>;
+using Values = SmallVector<Value, 2, NodeAllocator<Value>>;
+
 struct HaltExp {
   Value value;
 };
 
 struct FunExp {
   Var name;
-  std::vector<Var> params;
+  Vars params;
   std::unique_ptr<Exp> body;
   std::unique_ptr<Exp> rest;
 };
@@ -61,7 +86,7 @@ struct JumpExp {
 struct AppExp {
   Var name;
   Var funName;
-  std::vector<Value> paramValues;
+  Values paramValues;
   std::unique_ptr<Exp> rest;
 };
 
@@ -81,7 +106,7 @@ struct IfExp {
 
 struct TupleExp {
   Var name;
-  std::vector<Value> values;
+  Values values;
   std::unique_ptr<Exp> rest;
 };
 
@@ -100,13 +125,121 @@ struct Exp : public std::variant<HaltExp, FunExp, JoinExp, JumpExp, AppExp,
   // Need to redefine the move constructor after defining the destructor :(
   Exp(Exp &&) = default;
   ~Exp();
+
+  // Nodes are allocated from the current NodeArena if there is one. Whether
+  // a node is in an arena is told by its address, so delete frees it
+  // correctly whichever scope is active.
+  static void *operator new(size_t size);
+  static void operator delete(void *ptr, size_t size);
+};
+
+/**
+ * Arena for the nodes of a whole compilation.
+ *
+ * While a NodeArena::Scope is active, every anf::Exp created on the thread is
+ * allocated from the arena, along with the lists of its nodes that don't fit
+ * inline. Destroying a node in an arena neither frees its memory nor visits
+ * its subtrees: the whole tree is released all at once by reset(). Nodes
+ * allocated in a scope may be deleted after it ends, even on another thread,
+ * but must be deleted before the arena is reset, and their subtrees and lists
+ * must be in the arena too.
+ *
+ * Nodes and lists on the heap are 16 byte aligned, while the arena hands out
+ * memory 8 bytes past a multiple of 16, so where something was allocated is
+ * told by a bit of its address.
+ */
+class NodeArena {
+  arena::ChunkedAllocator allocator_;
+
+  static inline thread_local NodeArena *current_ = nullptr;
+
+public:
+  // Alignment of the nodes and lists that are allocated on the heap.
+  static constexpr std::align_val_t heapAlign{16};
+
+  NodeArena() = default;
+  explicit NodeArena(arena::ChunkedAllocator::Options options)
+      : allocator_(options) {}
+  NodeArena(const NodeArena &) = delete;
+  NodeArena &operator=(const NodeArena &) = delete;
+
+  class Scope {
+    NodeArena *previous_;
+
+  public:
+    explicit Scope(NodeArena &arena) : previous_(current_) {
+      current_ = &arena;
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() { current_ = previous_; }
+  };
+
+  static NodeArena *current() { return current_; }
+  // Whether ptr was allocated by any arena rather than on the heap.
+  static bool owns(const void *ptr) {
+    return (reinterpret_cast<uintptr_t>(ptr) & 8) != 0;
+  }
+  // Bytes the arena takes for every node.
+  static size_t nodeSize();
+  void *allocate(size_t size);
+  void reset() { allocator_.reset(); }
+  const arena::ChunkedAllocator &allocator() const { return allocator_; }
 };
 
+template <typename T> T *NodeAllocator<T>::allocate(size_t n) {
+  if (NodeArena *arena = NodeArena::current()) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T)));
+  }
+  return static_cast<T *>(::operator new(n * sizeof(T), NodeArena::heapAlign));
+}
+
+template <typename T> void NodeAllocator<T>::deallocate(T *ptr, size_t n) {
+  if (!NodeArena::owns(ptr)) {
+    ::operator delete(ptr, n * sizeof(T), NodeArena::heapAlign);
+  }
+}
+
 void resetCounter();
 std::unique_ptr<Exp> make(Exp &&exp);
 std::unique_ptr<Exp> convert(ast::Exp<> &exp);
+// How convertDefunc names the variables of the converted tree.
+enum class Scoping {
+  // Variables keep their names, which must already be unique (see rename),
+  // or the conversion fails. Hash-consed trees share closed lambdas, so
+  // their binders are never unique and they need Indexed or Fused.
+  Named,
+  // Variables are looked up by their de Bruijn index (see resolve) and every
+  // lambda parameter gets a fresh name.
+  Indexed,
+  // Renames variables like rename while converting, so the tree doesn't need
+  // a separate pass first. Free variables are errors.
+  Fused,
+};
+
+// Throws ast::NotInScopeException for free variables and std::runtime_error
+// for applications of values that aren't variables.
+template <template <class> class Ptr>
+std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root,
+                                   Scoping scoping = Scoping::Named);
+// Like convertDefunc, but returns the errors as diagnostics without spans,
+// since the tree doesn't keep the positions of its nodes.
+template <template <class> class Ptr>
+Expected<std::unique_ptr<Exp>>
+tryConvertDefunc(ast::Exp<Ptr> &root, Scoping scoping = Scoping::Named);
+/**
+ * Like convertDefunc, but converts large lambda bodies and if branches in
+ * tasks on pool. The fresh variables are numbered like in the sequential
+ * conversion, so the result is the same. Only for trees of std::unique_ptr or
+ * raw_ptr, and never inside a NodeArena scope, since the tasks allocate their
+ * nodes on the threads of the pool.
+ */
+template <template <class> class Ptr>
+std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root, Scoping scoping,
+                                   ThreadPool &pool);
 template <template <class> class Ptr>
-std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root);
+Expected<std::unique_ptr<Exp>>
+tryConvertDefunc(ast::Exp<Ptr> &root, Scoping scoping, ThreadPool &pool);
 
 } // namespace anf
 } // namespace lambcalc
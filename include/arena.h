@@ -1,9 +1,13 @@
 #ifndef ARENA_H
 #define ARENA_H
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <new>
+#include <string>
+#include <vector>
 
 namespace lambcalc {
 namespace arena {
@@ -35,17 +39,107 @@ public:
   void reset() { begin_ = orig_; }
 };
 
-template <typename T> class TypedAllocator {
-  Allocator &allocator_;
+class BudgetExceeded : public std::bad_alloc {
+  std::string reason_;
+
+public:
+  explicit BudgetExceeded(size_t budget)
+      : reason_("Arena exceeded its budget of " + std::to_string(budget) +
+                " bytes") {}
+  virtual const char *what() const throw() { return reason_.c_str(); }
+};
+
+/**
+ * Bump allocator that grows by mmap'd blocks instead of failing when a block
+ * is full.
+ *
+ * Blocks are kept mapped across resets so they can be reused, but the pages
+ * of blocks past the first retainedBlocks are given back to the OS with
+ * MADV_DONTNEED, so a spike in one compilation doesn't stay resident. The
+ * bytes allocated between resets are limited by budget, and allocating past
+ * it throws BudgetExceeded.
+ */
+class ChunkedAllocator {
+public:
+  struct Options {
+    size_t blockSize = 1 << 20;
+    size_t budget = std::numeric_limits<size_t>::max();
+    size_t retainedBlocks = 1;
+    // Asks for transparent huge pages for the blocks, which rounds the block
+    // size up to a multiple of 2 MiB.
+    bool hugePages = false;
+  };
+
+private:
+  struct Block {
+    char *begin;
+    size_t size;
+  };
+
+  Options options_;
+  std::vector<Block> blocks_;
+  // Index of the block after the one being allocated from.
+  size_t nextBlock_;
+  char *blockBegin_;
+  char *begin_;
+  char *end_;
+  // Bytes allocated from the blocks before the current one.
+  size_t usedBefore_;
+  size_t highWaterMark_;
+
+  void *allocateSlow(size_t size, size_t align);
+  void enterBlock(size_t index);
+
+public:
+  ChunkedAllocator();
+  explicit ChunkedAllocator(Options options);
+  ChunkedAllocator(const ChunkedAllocator &) = delete;
+  ChunkedAllocator &operator=(const ChunkedAllocator &) = delete;
+  ~ChunkedAllocator();
+
+  template <typename T> T *allocate(ptrdiff_t count = 1) {
+    if (count < 0 || static_cast<size_t>(count) > SIZE_MAX / 2 / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    size_t size = sizeof(T) * count;
+    size_t pad = -reinterpret_cast<uintptr_t>(begin_) & (alignof(T) - 1);
+    void *ptr;
+    if (begin_ != nullptr &&
+        size + pad <= static_cast<size_t>(end_ - begin_)) {
+      ptr = begin_ + pad;
+      begin_ += pad + size;
+    } else {
+      ptr = allocateSlow(size, alignof(T));
+    }
+    return new (ptr) T[count]{};
+  }
+
+  void reset();
+
+  // Bytes allocated since the last reset.
+  size_t bytesUsed() const { return usedBefore_ + (begin_ - blockBegin_); }
+  // Most bytes allocated between two resets.
+  size_t highWaterMark() const {
+    return std::max(highWaterMark_, bytesUsed());
+  }
+  size_t bytesMapped() const;
+  size_t blockCount() const { return blocks_.size(); }
+};
+
+template <typename T, typename A = Allocator> class TypedAllocator {
+  A &allocator_;
 
 public:
   using value_type = T;
-  explicit TypedAllocator(Allocator &allocator) : allocator_(allocator) {}
+  explicit TypedAllocator(A &allocator) : allocator_(allocator) {}
   template <typename U>
-  explicit constexpr TypedAllocator(const TypedAllocator<U> &other) noexcept {
+  explicit constexpr TypedAllocator(
+      const TypedAllocator<U, A> &other) noexcept {
     allocator_ = other.allocator_;
   }
-  T *allocate(ptrdiff_t n = 1) { return allocator_.allocate<T>(n); }
+  T *allocate(ptrdiff_t n = 1) {
+    return allocator_.template allocate<T>(n);
+  }
   void deallocate(T *, ptrdiff_t) noexcept {}
   friend bool operator==(const TypedAllocator &a, const TypedAllocator &b) {
     return &a.allocator_ == &b.allocator_;
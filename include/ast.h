@@ -1,6 +1,7 @@
 #ifndef AST_H
 #define AST_H
 
+#include "symbol.h"
 #include <functional>
 #include <memory>
 #include <string>
@@ -20,11 +21,13 @@ struct IntExp {
 };
 
 struct VarExp {
-  std::string name;
+  Symbol name;
+  // De Bruijn index of the binder, set by resolve(), or -1 if unresolved.
+  int index = -1;
 };
 
 template <template <class> class Ptr> struct LamExp {
-  std::string param;
+  Symbol param;
   Ptr<Exp<Ptr>> body;
 };
 
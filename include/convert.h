@@ -2,13 +2,68 @@
 #define CONVERT_H
 
 #include "anf.h"
-#include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace lambcalc {
 namespace convert {
 
-std::set<anf::Var> freeVars(anf::Exp &exp);
+// Free variables of exp in order of their spelling.
+std::vector<anf::Var> freeVars(anf::Exp &exp);
+
+using FunctionFreeVars =
+    std::unordered_map<const anf::FunExp *, std::vector<anf::Var>>;
+
+/**
+ * Analysis for anf::analyze that finds the free variables of the body of
+ * every function that aren't its parameters, in order of their spelling.
+ * Names must be unique.
+ */
+class FunctionFreeVarsAnalysis {
+  struct OpenFun {
+    const anf::FunExp *fun;
+    std::vector<anf::Var> freeVars;
+  };
+  // Functions whose bodies are being visited, innermost last.
+  std::vector<OpenFun> open_;
+  // Number of open functions when every symbol was bound, indexed by symbol
+  // slot, so a symbol is free in the open functions from its level on. Symbols
+  // that aren't bound are free in every function.
+  std::vector<uint32_t> levels_;
+  // Number of open functions that already have the symbol as a free
+  // variable, indexed by symbol slot. Every variable is added to a function
+  // at most once.
+  std::vector<uint32_t> recorded_;
+  FunctionFreeVars result_;
+
+  void reserve(Symbol name);
+  void bind(Symbol name);
+  void use(Symbol name);
+  void use(const anf::Value &value);
+
+public:
+  void enter(const anf::HaltExp &exp);
+  void enter(const anf::FunExp &exp);
+  void enterBody(const anf::FunExp &exp);
+  void leaveBody(const anf::FunExp &exp);
+  void enter(const anf::JoinExp &exp);
+  void enter(const anf::JumpExp &exp);
+  void enter(const anf::AppExp &exp);
+  void enter(const anf::BopExp &exp);
+  void enter(const anf::IfExp &exp);
+  void enter(const anf::TupleExp &exp);
+  void enter(const anf::ProjExp &exp);
+  FunctionFreeVars &result() { return result_; }
+};
+
+// Runs FunctionFreeVarsAnalysis by itself. Unlike calling freeVars on every
+// function, this takes a single pass over exp.
+FunctionFreeVars functionFreeVars(const anf::Exp &exp);
 std::unique_ptr<anf::Exp> closureConvert(std::unique_ptr<anf::Exp> &&start);
+// Closure converts with the free variables already computed for start, for
+// example in the same traversal as other analyses.
+std::unique_ptr<anf::Exp> closureConvert(std::unique_ptr<anf::Exp> &&start,
+                                         const FunctionFreeVars &freeVars);
 
 } // namespace convert
 } // namespace lambcalc
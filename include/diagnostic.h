@@ -0,0 +1,44 @@
+#ifndef DIAGNOSTIC_H
+#define DIAGNOSTIC_H
+
+#include <cstddef>
+#include <expected>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace lambcalc {
+
+// Byte offsets [begin, end) of a token in the source.
+struct Span {
+  size_t begin = 0;
+  size_t end = 0;
+};
+
+/**
+ * Error in the input program, such as a syntax error or a variable that
+ * isn't in scope.
+ *
+ * Malformed input is common in batch runs, so these are returned through
+ * Expected instead of being thrown. The span is missing for errors in trees
+ * that no longer know where they came from.
+ */
+struct Diagnostic {
+  std::string message;
+  std::optional<Span> span;
+};
+
+template <typename T> using Expected = std::expected<T, Diagnostic>;
+
+/**
+ * Prints a diagnostic with the line and column of its span and the source
+ * line underneath with the span underlined. Prints byte offsets instead if
+ * the source isn't available.
+ */
+void printDiagnostic(std::ostream &os, const Diagnostic &diagnostic,
+                     std::string_view source = {});
+
+} // namespace lambcalc
+
+#endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+#ifndef HASHCONS_H
+#define HASHCONS_H
+
+#include "arena.h"
+#include "ast.h"
+#include "utils.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <unordered_set>
+#include <vector>
+
+namespace lambcalc {
+namespace hashcons {
+
+/**
+ * Parser allocator policy that shares structurally identical closed subtrees.
+ *
+ * Nodes are allocated from an arena and passed to intern() once constructed
+ * (Parser does this whenever its allocator has an intern method). If the node
+ * has no free variables and an identical node was already interned, the new
+ * node is freed and the existing one is returned. Open subtrees are never
+ * shared because passes like rename rewrite variables depending on their
+ * binders, while a closed subtree is rewritten the same way wherever it
+ * occurs. Passes that rewrite nodes in place still have to visit a shared
+ * subtree only once.
+ *
+ * Every node built through the allocator is preceded by a header with its
+ * structural hash and free variables, so equal subtrees have equal hashes and
+ * interned nodes can be compared by address. A single free variable is kept
+ * in the header and more are kept in the arena, shared with a child when the
+ * child has the same ones. The headers describe the tree as it was parsed, so
+ * call reset() when the underlying arena is reset.
+ */
+class Allocator {
+  using Exp = ast::Exp<raw_ptr>;
+
+  struct Header {
+    size_t hash;
+    // Ids of the free variables of the subtree in increasing order.
+    uint32_t freeCount : 31;
+    // Set by markRenamed.
+    uint32_t renamed : 1;
+    uint32_t freeVar;
+    const uint32_t *freeVars;
+  };
+  struct Node {
+    Header header;
+    alignas(Exp) unsigned char exp[sizeof(Exp)];
+  };
+  struct NodeHash {
+    size_t operator()(const Exp *exp) const { return header(exp).hash; }
+  };
+  struct NodeEqual {
+    bool operator()(const Exp *a, const Exp *b) const;
+  };
+
+  arena::Allocator &allocator_;
+  std::unordered_set<Exp *, NodeHash, NodeEqual> interned_;
+  // Storage of the last node that turned out to be a duplicate, which is
+  // reused by the next allocation.
+  Exp *free_;
+  size_t hits_;
+  std::vector<uint32_t> scratch_;
+
+  static Header &header(const Exp *exp);
+  static std::span<const uint32_t> freeVars(const Header &header);
+  void setFreeVars(Header &header, std::span<const Header *const> parts);
+  void eraseFreeVar(Header &header, const Header &body, uint32_t id);
+  void analyze(Exp &exp);
+
+public:
+  using value_type = Exp;
+  explicit Allocator(arena::Allocator &allocator)
+      : allocator_(allocator), free_(nullptr), hits_(0) {}
+  Allocator(const Allocator &) = delete;
+  Allocator &operator=(const Allocator &) = delete;
+
+  Exp *allocate(ptrdiff_t n = 1);
+  void deallocate(Exp *, ptrdiff_t) noexcept {}
+  Exp *intern(Exp *exp);
+  void reset();
+
+  // Structural hash of a node built through this allocator.
+  size_t hash(const Exp *exp) const { return header(exp).hash; }
+  // Whether a node built through this allocator is the shared copy of its
+  // subtree.
+  bool isInterned(const Exp *exp) const;
+  // Marks a closed node built through this allocator as renamed, returning
+  // whether it already was. Open nodes are never shared, so they are never
+  // marked.
+  bool markRenamed(Exp *exp);
+  // Number of nodes that were replaced by an existing node.
+  size_t hits() const { return hits_; }
+};
+
+/**
+ * Deep structural equality of two trees.
+ */
+bool equal(const ast::Exp<raw_ptr> &a, const ast::Exp<raw_ptr> &b);
+
+} // namespace hashcons
+} // namespace lambcalc
+
+#endif
\ No newline at end of file
@@ -14,7 +14,7 @@ struct Join {
 
 struct Function {
   Var name;
-  std::vector<Var> params;
+  Vars params;
   Join entryBlock;
   std::vector<Join> blocks;
 };
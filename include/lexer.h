@@ -1,7 +1,9 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 
 namespace lambcalc {
 
@@ -22,17 +24,60 @@ enum class Token {
   Semicolon = ';',
 };
 
+// Returns the keyword token for an identifier, or Token::Identifier.
+Token keywordToken(std::string_view identifier);
+// Describes a token kind for diagnostics, for example "'then'".
+std::string tokenName(Token token);
+
 class Lexer {
   std::istream &in_;
   int lastChar_;
   std::string identifier_;
   int numberValue_;
+  // Number of characters read, so lastChar_ is at offset position_ - 1.
+  size_t position_;
+  size_t tokenStart_;
+
+  int get();
 
 public:
-  explicit Lexer(std::istream &in) : in_(in), lastChar_(' '), numberValue_(0) {}
+  explicit Lexer(std::istream &in)
+      : in_(in), lastChar_(' '), numberValue_(0), position_(0),
+        tokenStart_(0) {}
   Token getToken();
   const std::string &getIdentifier() const { return identifier_; }
   int getNumber() const { return numberValue_; }
+  // Byte offsets of the start and the end of the last token.
+  size_t getTokenOffset() const { return tokenStart_; }
+  size_t getTokenEnd() const { return position_ - 1; }
+};
+
+/**
+ * Lexer over a contiguous buffer that must outlive it.
+ *
+ * Identifiers are views into the buffer and numbers are parsed in place, so
+ * lexing doesn't allocate. Use this instead of Lexer when the whole program is
+ * available up front, for example from a SourceBuffer.
+ */
+class BufferLexer {
+  const char *begin_;
+  const char *cur_;
+  const char *end_;
+  const char *tokenStart_;
+  std::string_view identifier_;
+  int numberValue_;
+
+public:
+  explicit BufferLexer(std::string_view buffer)
+      : begin_(buffer.data()), cur_(begin_), end_(begin_ + buffer.size()),
+        tokenStart_(begin_), numberValue_(0) {}
+  Token getToken();
+  std::string_view getIdentifier() const { return identifier_; }
+  int getNumber() const { return numberValue_; }
+  // Byte offsets of the start and the end of the last token returned by
+  // getToken().
+  size_t getTokenOffset() const { return tokenStart_ - begin_; }
+  size_t getTokenEnd() const { return cur_ - begin_; }
 };
 
 } // namespace lambcalc
@@ -2,25 +2,87 @@
 #define LOWER_H
 
 #include "hoist.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Target/TargetMachine.h"
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
 
 namespace lambcalc {
+class ThreadPool;
 namespace lower {
 
-extern std::unique_ptr<llvm::LLVMContext> ctx;
-extern std::unique_ptr<llvm::LoopAnalysisManager> lam;
-extern std::unique_ptr<llvm::FunctionPassManager> fpm;
-extern std::unique_ptr<llvm::FunctionAnalysisManager> fam;
-extern std::unique_ptr<llvm::CGSCCAnalysisManager> cgam;
-extern std::unique_ptr<llvm::ModuleAnalysisManager> mam;
-extern std::unique_ptr<llvm::PassInstrumentationCallbacks> pic;
-extern std::unique_ptr<llvm::StandardInstrumentations> si;
-
-std::unique_ptr<llvm::Module> lower(std::vector<anf::Function> &&fns);
-std::unique_ptr<llvm::Module> lower(std::vector<anf::Function> &&fns,
-                                    const llvm::DataLayout &layout);
+// How much a session optimizes the modules it lowers, like clang's -O flags.
+enum class OptLevel { O0, O1, O2, O3 };
+
+// Code generation level to give the JIT for modules optimized at level.
+llvm::CodeGenOptLevel codeGenOptLevel(OptLevel level);
+
+/**
+ * Lowers hoisted functions to LLVM modules and optimizes them with the
+ * standard PassBuilder pipeline for its level, which includes the inliner.
+ * The context, analysis managers, pass pipeline and builder are created once
+ * and reused for every module the session lowers, instead of being set up
+ * again for every expression.
+ *
+ * A session is used by one thread at a time, but separate sessions can lower
+ * on different threads at once. The modules live in the session's context,
+ * so they are handed to the JIT as ThreadSafeModules that share it.
+ */
+class Session {
+  std::unique_ptr<llvm::TargetMachine> target_;
+  std::optional<llvm::DataLayout> layout_;
+  OptLevel level_;
+  llvm::orc::ThreadSafeContext ctx_;
+  llvm::LoopAnalysisManager lam_;
+  llvm::FunctionAnalysisManager fam_;
+  llvm::CGSCCAnalysisManager cgam_;
+  llvm::ModuleAnalysisManager mam_;
+  llvm::PassInstrumentationCallbacks pic_;
+  llvm::StandardInstrumentations si_;
+  llvm::ModulePassManager mpm_;
+  llvm::IRBuilder<> builder_;
+
+  Session(std::unique_ptr<llvm::TargetMachine> target,
+          std::optional<llvm::DataLayout> layout, OptLevel level);
+
+public:
+  // Lowers without a data layout and doesn't optimize.
+  Session();
+  explicit Session(const llvm::DataLayout &layout,
+                   OptLevel level = OptLevel::O0);
+  // Optimizes for the target that builder describes, e.g. the host with its
+  // CPU features from JITTargetMachineBuilder::detectHost.
+  Session(llvm::orc::JITTargetMachineBuilder builder, OptLevel level);
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+  std::unique_ptr<llvm::Module> lower(std::vector<anf::Function> &&fns);
+  // Declares every function of fns but only defines the ones in defined, so
+  // that modules defining different parts of a program can call each other.
+  std::unique_ptr<llvm::Module> lower(std::span<anf::Function> fns,
+                                      std::span<anf::Function> defined);
+  // Wraps a module lowered by this session for the JIT.
+  llvm::orc::ThreadSafeModule share(std::unique_ptr<llvm::Module> module);
+};
+
+/**
+ * Lowers the functions into a module per session on the threads of pool.
+ * Every module defines a contiguous range of the functions with about the
+ * same number of blocks. The modules declare the functions that the others
+ * define, so they can be added to the same JITDylib.
+ */
+std::vector<llvm::orc::ThreadSafeModule>
+lowerPartitioned(std::vector<anf::Function> &&fns,
+                 std::span<const std::unique_ptr<Session>> sessions,
+                 ThreadPool &pool);
 
 } // namespace lower
 } // namespace lambcalc
@@ -2,7 +2,9 @@
 #define PARSER_H
 
 #include "ast.h"
+#include "diagnostic.h"
 #include "lexer.h"
+#include <array>
 #include <memory>
 #include <optional>
 #include <utility>
@@ -20,49 +22,144 @@ public:
   virtual const char *what() const throw() { return reason_.c_str(); }
 };
 
-template <template <class> class Ptr = std::unique_ptr,
-          typename Allocator = std::allocator<ast::Exp<Ptr>>>
-class Parser {
+/**
+ * Token lookahead and node allocation shared by the parsers.
+ */
+template <template <class> class Ptr, typename Allocator, typename L>
+class ParserBase {
+protected:
   Allocator &allocator_;
-  Lexer &lexer_;
+  L &lexer_;
   Token currentToken_;
   std::optional<Token> peekToken_;
-  std::unordered_map<ast::Bop, std::optional<std::pair<int, int>>> infixBp_;
-
-  Ptr<ast::Exp<Ptr>> parseFn();
-  Ptr<ast::Exp<Ptr>> parseIf();
-  Ptr<ast::Exp<Ptr>> parseParens();
-  Ptr<ast::Exp<Ptr>> parsePrimary();
-  Ptr<ast::Exp<Ptr>> parseBinOp(int minBP);
+  Span currentSpan_;
+  Span peekSpan_;
 
   Ptr<ast::Exp<Ptr>> make(ast::Exp<Ptr> &&exp) {
     ast::Exp<Ptr> *ptr = allocator_.allocate(1);
     std::allocator_traits<Allocator>::construct(allocator_, ptr,
                                                 std::move(exp));
     Ptr<ast::Exp<Ptr>> ptr2(ptr);
+    // Allocators that share identical nodes may return an existing node.
+    if constexpr (requires { allocator_.intern(ptr2); }) {
+      return allocator_.intern(ptr2);
+    }
     return ptr2;
   }
+  Span lexerSpan() { return {lexer_.getTokenOffset(), lexer_.getTokenEnd()}; }
+  // Diagnostic at the current token.
+  std::unexpected<Diagnostic> error(std::string message) {
+    return std::unexpected(Diagnostic{std::move(message), currentSpan_});
+  }
+  std::unexpected<Diagnostic> expectError(std::string_view expected) {
+    return error("Expected " + std::string(expected) + " but found " +
+                 tokenName(currentToken_));
+  }
+  // Throws the error of a failed parse, for the exception based interface.
+  template <typename T> T orThrow(Expected<T> &&result) {
+    if (!result) {
+      throw ParserException(result.error().message,
+                            currentToken_ == Token::Eof);
+    }
+    return std::move(*result);
+  }
 
 public:
-  Parser(
-      Allocator &allocator, Lexer &lexer,
-      std::unordered_map<ast::Bop, std::optional<std::pair<int, int>>> infixBp)
-      : allocator_(allocator), lexer_(lexer), currentToken_(Token::Eof),
-        infixBp_(std::move(infixBp)) {}
+  ParserBase(Allocator &allocator, L &lexer)
+      : allocator_(allocator), lexer_(lexer), currentToken_(Token::Eof) {}
   Token getCurrentToken() { return currentToken_; }
   void nextToken() {
     if (peekToken_) {
       currentToken_ = *peekToken_;
+      currentSpan_ = peekSpan_;
       peekToken_ = std::nullopt;
     } else {
       currentToken_ = lexer_.getToken();
+      currentSpan_ = lexerSpan();
     }
   }
   std::optional<Token> getPeekToken() { return peekToken_; }
   Token peekToken() {
-    return peekToken_ ? *peekToken_ : *(peekToken_ = lexer_.getToken());
+    if (!peekToken_) {
+      peekToken_ = lexer_.getToken();
+      peekSpan_ = lexerSpan();
+    }
+    return *peekToken_;
+  }
+  Span getCurrentSpan() { return currentSpan_; }
+  // Skips the rest of an expression that failed to parse up to the next
+  // semicolon, so that the next expression can be parsed after it.
+  void recover() {
+    while (currentToken_ != Token::Semicolon && currentToken_ != Token::Eof) {
+      nextToken();
+    }
   }
+};
+
+template <template <class> class Ptr = std::unique_ptr,
+          typename Allocator = std::allocator<ast::Exp<Ptr>>,
+          typename L = Lexer>
+class Parser : public ParserBase<Ptr, Allocator, L> {
+  using Base = ParserBase<Ptr, Allocator, L>;
+  using Base::getCurrentToken;
+  using Base::lexer_;
+  using Base::make;
+  using Base::nextToken;
+  using Base::peekToken;
+
+  std::unordered_map<ast::Bop, std::optional<std::pair<int, int>>> infixBp_;
+
+  Expected<Ptr<ast::Exp<Ptr>>> parseFn();
+  Expected<Ptr<ast::Exp<Ptr>>> parseIf();
+  Expected<Ptr<ast::Exp<Ptr>>> parseParens();
+  Expected<Ptr<ast::Exp<Ptr>>> parsePrimary();
+  Expected<Ptr<ast::Exp<Ptr>>> parseBinOp(int minBP);
+
+public:
+  Parser(
+      Allocator &allocator, L &lexer,
+      std::unordered_map<ast::Bop, std::optional<std::pair<int, int>>> infixBp)
+      : Base(allocator, lexer), infixBp_(std::move(infixBp)) {}
+  // Throws ParserException if the expression is malformed.
+  Ptr<ast::Exp<Ptr>> parseExpression();
+  // Returns a diagnostic at the offending token if the expression is
+  // malformed. Call recover() to continue with the next expression.
+  Expected<Ptr<ast::Exp<Ptr>>> tryParseExpression();
+};
+
+struct BindingPower {
+  int lbp = -1;
+  int rbp = -1;
+  constexpr bool infix() const { return lbp >= 0; }
+};
+
+// Binding powers of the binary operators indexed by ast::Bop. Operators
+// without a binding power can't be used infix.
+using InfixBpTable = std::array<BindingPower, 3>;
+
+constexpr InfixBpTable defaultInfixBpTable{{{1, 2}, {1, 2}, {3, 4}}};
+
+/**
+ * Pratt parser that keeps its pending operators, parentheses, functions and
+ * if expressions on a heap-allocated stack instead of recursing, so deeply
+ * nested input can't overflow the C++ stack. Builds the same trees as Parser.
+ *
+ * The binding powers are a template argument so operator lookups are
+ * resolved at compile time.
+ */
+template <template <class> class Ptr = std::unique_ptr,
+          typename Allocator = std::allocator<ast::Exp<Ptr>>,
+          typename L = Lexer, InfixBpTable InfixBp = defaultInfixBpTable>
+class IterativeParser : public ParserBase<Ptr, Allocator, L> {
+  using Base = ParserBase<Ptr, Allocator, L>;
+
+public:
+  IterativeParser(Allocator &allocator, L &lexer) : Base(allocator, lexer) {}
+  // Throws ParserException if the expression is malformed.
   Ptr<ast::Exp<Ptr>> parseExpression();
+  // Returns a diagnostic at the offending token if the expression is
+  // malformed. Call recover() to continue with the next expression.
+  Expected<Ptr<ast::Exp<Ptr>>> tryParseExpression();
 };
 
 } // namespace lambcalc
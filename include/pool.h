@@ -0,0 +1,149 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "ast.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace lambcalc {
+namespace pool {
+
+/**
+ * Contiguous storage for nodes of type T that are referred to by 32-bit
+ * indices instead of pointers.
+ *
+ * Since index_ptr only stores an index, dereferencing it goes through the
+ * pool that is current on the calling thread, set with NodePool::Scope.
+ * Allocating a node may grow the pool, which invalidates references to
+ * existing nodes (but not indices).
+ */
+template <typename T> class NodePool {
+  std::vector<T> nodes_;
+
+  static inline thread_local NodePool *current_ = nullptr;
+
+public:
+  explicit NodePool(size_t capacity = 0) { nodes_.reserve(capacity); }
+  NodePool(const NodePool &) = delete;
+  NodePool &operator=(const NodePool &) = delete;
+
+  static NodePool &current() {
+    assert(current_ != nullptr && "No node pool in scope");
+    return *current_;
+  }
+
+  /**
+   * Makes a pool the current pool until the scope is destroyed.
+   */
+  class Scope {
+    NodePool *previous_;
+
+  public:
+    explicit Scope(NodePool &pool) : previous_(current_) { current_ = &pool; }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() { current_ = previous_; }
+  };
+
+  T &operator[](uint32_t index) { return nodes_[index]; }
+  uint32_t size() const { return nodes_.size(); }
+  std::span<T> nodes() { return nodes_; }
+  void reserve(size_t capacity) { nodes_.reserve(capacity); }
+  void clear() { nodes_.clear(); }
+
+  uint32_t indexOf(const T *node) const {
+    assert(node >= nodes_.data() && node < nodes_.data() + nodes_.size() &&
+           "Node is not in the pool");
+    return node - nodes_.data();
+  }
+
+  // Appends a default constructed node and returns its index.
+  uint32_t allocate() {
+    assert(nodes_.size() < UINT32_MAX && "Node pool is full");
+    nodes_.emplace_back();
+    return nodes_.size() - 1;
+  }
+};
+
+/**
+ * 32-bit index of a node in the current NodePool<T>. Can be used as the Ptr
+ * parameter of ast::Exp so that the tree takes half of the pointer footprint.
+ * Like raw_ptr, it doesn't own the node: the nodes are freed with the pool.
+ */
+template <typename T> class index_ptr {
+  static constexpr uint32_t null = UINT32_MAX;
+  uint32_t index_ = null;
+
+public:
+  index_ptr() = default;
+  index_ptr(std::nullptr_t) {}
+  explicit index_ptr(T *node)
+      : index_(node == nullptr ? null : NodePool<T>::current().indexOf(node)) {
+  }
+  static index_ptr fromIndex(uint32_t index) {
+    index_ptr ptr;
+    ptr.index_ = index;
+    return ptr;
+  }
+
+  uint32_t index() const { return index_; }
+  T *get() const {
+    return index_ == null ? nullptr : &NodePool<T>::current()[index_];
+  }
+  T &operator*() const { return NodePool<T>::current()[index_]; }
+  T *operator->() const { return get(); }
+  explicit operator bool() const { return index_ != null; }
+
+  friend bool operator==(const index_ptr &, const index_ptr &) = default;
+  friend bool operator==(const index_ptr &ptr, std::nullptr_t) {
+    return ptr.index_ == null;
+  }
+};
+
+/**
+ * Allocator for the parsers that allocates nodes from a NodePool.
+ */
+template <typename T> class TypedAllocator {
+  NodePool<T> &pool_;
+
+public:
+  using value_type = T;
+  explicit TypedAllocator(NodePool<T> &pool) : pool_(pool) {}
+  T *allocate(size_t n = 1) {
+    assert(n == 1 && "Nodes can only be allocated one at a time");
+    (void)n;
+    return &pool_[pool_.allocate()];
+  }
+  void deallocate(T *, size_t) noexcept {}
+  // Nodes in the pool are always constructed, so replace them instead.
+  template <typename... Args> void construct(T *node, Args &&...args) {
+    std::destroy_at(node);
+    std::construct_at(node, std::forward<Args>(args)...);
+  }
+  friend bool operator==(const TypedAllocator &a, const TypedAllocator &b) {
+    return &a.pool_ == &b.pool_;
+  }
+};
+
+} // namespace pool
+
+namespace ast {
+
+using PoolExp = Exp<pool::index_ptr>;
+
+/**
+ * Appends a copy of the tree at root in the current pool to dest in preorder,
+ * so that a node's subtrees follow it in order and a left to right traversal
+ * of the tree is a sequential scan of dest. Returns the new root.
+ */
+pool::index_ptr<PoolExp> compact(pool::NodePool<PoolExp> &dest,
+                                  const PoolExp &root);
+
+} // namespace ast
+} // namespace lambcalc
+
+#endif
\ No newline at end of file
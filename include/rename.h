@@ -2,8 +2,12 @@
 #define RENAME_H
 
 #include "ast.h"
+#include "utils.h"
 
 namespace lambcalc {
+namespace hashcons {
+class Allocator;
+} // namespace hashcons
 namespace ast {
 
 class NotInScopeException : public std::exception {
@@ -11,14 +15,46 @@ class NotInScopeException : public std::exception {
   std::string reason_;
 
 public:
-  explicit NotInScopeException(const std::string &var)
-      : var_(var), reason_(var + " is not in scope") {}
+  explicit NotInScopeException(Symbol var)
+      : var_(var.str()), reason_(var_ + " is not in scope") {}
   const std::string &var() { return var_; }
   virtual const char *what() const throw() { return reason_.c_str(); }
 };
 
+/**
+ * Gives every binder a fresh name and renames its variables to match.
+ * Throws NotInScopeException for free variables.
+ */
 template <template <class> class Ptr> void rename(ast::Exp<Ptr> &exp);
 
+/**
+ * Like rename, for a tree built through shared. A subtree that is shared by
+ * several parents is renamed the first time it is reached, by this or an
+ * earlier call, and left alone after. Its binders keep the same names at
+ * every parent, so the result is free of shadowing but its names aren't
+ * unique, and anf::convertDefunc needs Scoping::Fused or Scoping::Indexed
+ * for it.
+ */
+void rename(ast::Exp<raw_ptr> &exp, hashcons::Allocator &shared);
+
+/**
+ * Sets the de Bruijn index of every variable, which is the number of binders
+ * between the variable and its own binder, so 0 refers to the innermost
+ * enclosing lambda. Throws NotInScopeException for free variables.
+ *
+ * Unlike rename this leaves the names as they are. Indices don't depend on
+ * the context of a closed subtree, so trees with shared subtrees can be
+ * resolved too.
+ */
+template <template <class> class Ptr> void resolve(ast::Exp<Ptr> &exp);
+
+/**
+ * Whether two trees are equal up to the names of their binders. Variables are
+ * compared by index, or by name if they weren't resolved.
+ */
+template <template <class> class Ptr>
+bool alphaEquivalent(const ast::Exp<Ptr> &a, const ast::Exp<Ptr> &b);
+
 } // namespace ast
 } // namespace lambcalc
 
@@ -0,0 +1,98 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace lambcalc {
+namespace runtime {
+
+/**
+ * Garbage collected heap that generated code allocates objects from.
+ *
+ * Every thread has its own heap. Lowered code bumps next up to end inline and
+ * only calls lambcalc_alloc_slow when the space is full, which collects it by
+ * copying the objects that are still reachable into another space.
+ *
+ * An object is a header word followed by its fields, and is pointed to at its
+ * first field. The header holds the number of fields as a tagged integer.
+ * Fields and roots are either tagged integers, which have the low bit set, or
+ * pointers, and only pointers into the heap are followed. The first field of
+ * every object is the code pointer of a closure, which is never followed.
+ *
+ * Functions that can reach a collection push a Frame onto frames, followed by
+ * count roots that hold their live values. The collector updates the roots in
+ * place when it moves their objects.
+ */
+struct Frame {
+  Frame *prev;
+  uint64_t count;
+};
+
+struct Heap {
+  char *next;
+  char *end;
+  Frame *frames;
+};
+
+struct Options {
+  // Bytes of a space to start with. Two spaces are mapped while collecting.
+  size_t heapSize = 1 << 20;
+  // Bytes a space may grow to before the program runs out of memory.
+  size_t maxHeapSize = size_t(1) << 32;
+  // Collections that take longer grow the heap, so they happen less often.
+  std::chrono::microseconds pauseTarget{1000};
+};
+
+struct Stats {
+  size_t collections = 0;
+  size_t bytesCopied = 0;
+  // Bytes of the space that is allocated from.
+  size_t heapSize = 0;
+  std::chrono::nanoseconds maxPause{0};
+  std::chrono::nanoseconds totalPause{0};
+};
+
+// Returns the heap of the calling thread.
+extern "C" Heap *lambcalc_heap();
+// Makes room for size bytes in the heap of the calling thread, collecting it
+// if it is full, and allocates them. Aborts when there is no memory left.
+extern "C" void *lambcalc_alloc_slow(uint64_t size) noexcept;
+
+// Sets the options of the calling thread's heap. The heap size is rounded up
+// to whole pages and takes effect at the next reset.
+void configure(const Options &options);
+// Collects the heap of the calling thread.
+void collect();
+// Frees everything the calling thread allocated and clears its stats. Spaces
+// that aren't the configured heap size are unmapped.
+void reset();
+Stats stats();
+// Bytes mapped for the heap of the calling thread.
+size_t bytesMapped();
+
+inline void *tagged(int64_t value) {
+  return reinterpret_cast<void *>(static_cast<uint64_t>(value) << 1 | 1);
+}
+
+// Allocates an object with the given number of fields the same way that
+// lowered code does. The fields are left uninitialized.
+inline void **allocate(size_t fields) {
+  Heap *heap = lambcalc_heap();
+  size_t size = (fields + 1) * sizeof(void *);
+  char *object;
+  if (static_cast<size_t>(heap->end - heap->next) >= size) {
+    object = heap->next;
+    heap->next += size;
+  } else {
+    object = static_cast<char *>(lambcalc_alloc_slow(size));
+  }
+  *reinterpret_cast<uint64_t *>(object) = fields << 1 | 1;
+  return reinterpret_cast<void **>(object) + 1;
+}
+
+} // namespace runtime
+} // namespace lambcalc
+
+#endif
\ No newline at end of file
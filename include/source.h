@@ -0,0 +1,42 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace lambcalc {
+
+/**
+ * Owns the contents of a source program as one contiguous buffer.
+ *
+ * Files are memory-mapped read only, so BufferLexer can lex them without
+ * copying them into memory first.
+ */
+class SourceBuffer {
+  const char *data_;
+  size_t size_;
+  bool mapped_;
+  std::string contents_;
+
+public:
+  explicit SourceBuffer(std::string contents)
+      : data_(nullptr), size_(0), mapped_(false),
+        contents_(std::move(contents)) {
+    data_ = contents_.data();
+    size_ = contents_.size();
+  }
+  SourceBuffer(SourceBuffer &&other) noexcept;
+  SourceBuffer &operator=(SourceBuffer &&other) noexcept;
+  SourceBuffer(const SourceBuffer &) = delete;
+  SourceBuffer &operator=(const SourceBuffer &) = delete;
+  ~SourceBuffer();
+
+  // Throws std::system_error if the file can't be opened or mapped.
+  static SourceBuffer fromFile(const std::string &path);
+  std::string_view view() const { return {data_, size_}; }
+};
+
+} // namespace lambcalc
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lambcalc {
+
+/**
+ * Interned identifier.
+ *
+ * A symbol is a dense 32-bit id into a process wide table whose spellings are
+ * stored in an arena, so symbols are copied, hashed and compared for equality
+ * as integers. Every spelling has exactly one id, so converting a symbol to
+ * its spelling and back gives the same symbol. The table can be used from
+ * several threads at once.
+ *
+ * Fresh symbols made by the passes are the exception: they have ids in a
+ * reserved range that are numbered per compilation, are never equal to an
+ * interned symbol, and are only spelled when their spelling is asked for.
+ *
+ * Symbols are ordered by spelling so that ordered containers of symbols stay
+ * in the same order as they would with strings.
+ */
+class Symbol {
+  static constexpr uint32_t FreshBit = uint32_t(1) << 31;
+
+  uint32_t id_;
+
+public:
+  // The empty symbol.
+  Symbol();
+  Symbol(std::string_view spelling);
+  Symbol(const char *spelling) : Symbol(std::string_view(spelling)) {}
+  Symbol(const std::string &spelling) : Symbol(std::string_view(spelling)) {}
+
+  // Returns a new symbol, distinct from every other one, spelled prefix
+  // followed by counter. Doesn't lock, so passes on several threads can make
+  // fresh symbols at once.
+  static Symbol fresh(Symbol prefix, uint32_t counter);
+  // Forgets the fresh symbols made so far, so that the next compilation
+  // numbers them from zero again. No fresh symbol made before may be used
+  // after, and no other thread may be making fresh symbols.
+  static void resetFresh();
+  // Number of interned symbols. Their ids are smaller than this.
+  static size_t count();
+
+  uint32_t id() const { return id_; }
+  bool isFresh() const { return id_ & FreshBit; }
+  // Small index for tables indexed by symbol. Interned symbols and the fresh
+  // symbols of the current compilation take turns, so a table only needs to
+  // be as large as the program being compiled.
+  size_t slot() const {
+    return isFresh() ? size_t(id_ & ~FreshBit) * 2 + 1 : size_t(id_) * 2;
+  }
+  std::string_view str() const;
+
+  friend bool operator==(Symbol a, Symbol b) { return a.id_ == b.id_; }
+  friend std::strong_ordering operator<=>(Symbol a, Symbol b) {
+    if (a.id_ == b.id_) {
+      return std::strong_ordering::equal;
+    }
+    // A fresh symbol can be spelled like an interned one.
+    auto order = a.str() <=> b.str();
+    return order != 0 ? order : a.id_ <=> b.id_;
+  }
+  friend std::ostream &operator<<(std::ostream &os, Symbol symbol) {
+    return os << symbol.str();
+  }
+};
+
+/**
+ * Set of symbols stored as a bitset indexed by symbol slot.
+ *
+ * Clearing the set only touches the symbols that were inserted, so one set
+ * can be reused for many small queries without paying for the size of the
+ * symbol table each time.
+ */
+class SymbolSet {
+  std::vector<uint64_t> bits_;
+  // Symbols that were inserted since the last clear, possibly repeated or
+  // erased since.
+  std::vector<Symbol> inserted_;
+
+public:
+  bool contains(Symbol symbol) const {
+    size_t word = symbol.slot() / 64;
+    return word < bits_.size() && (bits_[word] >> (symbol.slot() % 64) & 1);
+  }
+  void insert(Symbol symbol) {
+    size_t word = symbol.slot() / 64;
+    if (word >= bits_.size()) {
+      bits_.resize(std::max(word + 1, bits_.size() * 2));
+    }
+    if (!contains(symbol)) {
+      bits_[word] |= uint64_t(1) << (symbol.slot() % 64);
+      inserted_.push_back(symbol);
+    }
+  }
+  void erase(Symbol symbol) {
+    if (contains(symbol)) {
+      bits_[symbol.slot() / 64] &= ~(uint64_t(1) << (symbol.slot() % 64));
+    }
+  }
+  // Moves the symbols out of the set in order of their spelling, leaving
+  // the set empty.
+  std::vector<Symbol> take();
+};
+
+} // namespace lambcalc
+
+template <> struct std::hash<lambcalc::Symbol> {
+  size_t operator()(lambcalc::Symbol symbol) const noexcept {
+    return symbol.id();
+  }
+};
+
+#endif
\ No newline at end of file
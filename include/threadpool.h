@@ -0,0 +1,90 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lambcalc {
+
+/**
+ * Fixed set of worker threads that run tasks with work stealing.
+ *
+ * Every worker has its own deque of tasks. A task spawned by a worker goes to
+ * the back of that worker's deque, and workers take their own tasks from the
+ * back, so each one works depth first on what it spawned. Idle workers steal
+ * from the front of the other deques instead, where the oldest and usually
+ * largest tasks are.
+ */
+class ThreadPool {
+public:
+  using Task = std::move_only_function<void()>;
+
+  explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  // Runs the tasks that are still queued before joining the workers.
+  ~ThreadPool();
+
+  size_t size() const { return threads_.size(); }
+  void spawn(Task task);
+  // Runs a queued task on the calling thread. Returns false if there was none.
+  bool runOne();
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::jthread> threads_;
+  // Number of tasks in all of the deques.
+  std::atomic<size_t> queued_ = 0;
+  // Deque that the next task spawned from outside of the pool goes to.
+  std::atomic<size_t> next_ = 0;
+  std::mutex sleepMutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+
+  void work(size_t index);
+  bool pop(Worker &worker, bool back, Task &task);
+};
+
+/**
+ * Tasks spawned on a pool that are waited for together. The first exception
+ * thrown by a task is rethrown by wait.
+ */
+class TaskGroup {
+  ThreadPool &pool_;
+  std::atomic<size_t> pending_ = 0;
+  std::mutex mutex_;
+  std::exception_ptr exception_;
+  // Counts the tasks queued or finished so far. wait sleeps on changed_ until
+  // it moves, after it has found nothing to run.
+  size_t progress_ = 0;
+  std::condition_variable changed_;
+
+public:
+  explicit TaskGroup(ThreadPool &pool) : pool_(pool) {}
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+  ~TaskGroup();
+
+  ThreadPool &pool() { return pool_; }
+  // Tasks may spawn more tasks into the same group.
+  void spawn(ThreadPool::Task task);
+  // Helps running queued tasks until every task of the group is done, and
+  // blocks while there are none to run.
+  void wait();
+};
+
+} // namespace lambcalc
+
+#endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+#include "lexer.h"
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace lambcalc {
+
+/**
+ * Struct-of-arrays token stream produced by tokenize().
+ *
+ * Token i has kind kinds()[i] and spans the source bytes
+ * [starts()[i], starts()[i] + lengths()[i]). values()[i] holds the value of
+ * number literals and is zero for every other kind. The stream always ends
+ * with a Token::Eof entry at the end of the source.
+ */
+class TokenArray {
+  size_t size_;
+  std::unique_ptr<Token[]> kinds_;
+  std::unique_ptr<uint32_t[]> starts_;
+  std::unique_ptr<uint32_t[]> lengths_;
+  std::unique_ptr<int[]> values_;
+
+public:
+  // Every token covers at least one byte, so a source of n bytes has at most
+  // n + 1 tokens. The arrays are left uninitialized so that only the pages
+  // that are written to get touched.
+  explicit TokenArray(size_t capacity)
+      : size_(0), kinds_(std::make_unique_for_overwrite<Token[]>(capacity)),
+        starts_(std::make_unique_for_overwrite<uint32_t[]>(capacity)),
+        lengths_(std::make_unique_for_overwrite<uint32_t[]>(capacity)),
+        values_(std::make_unique_for_overwrite<int[]>(capacity)) {}
+
+  size_t size() const { return size_; }
+  std::span<const Token> kinds() const { return {kinds_.get(), size_}; }
+  std::span<const uint32_t> starts() const { return {starts_.get(), size_}; }
+  std::span<const uint32_t> lengths() const { return {lengths_.get(), size_}; }
+  std::span<const int> values() const { return {values_.get(), size_}; }
+
+  void push(Token kind, uint32_t start, uint32_t length, int value = 0) {
+    kinds_[size_] = kind;
+    starts_[size_] = start;
+    lengths_[size_] = length;
+    values_[size_] = value;
+    ++size_;
+  }
+};
+
+// Instruction sets that tokenize can classify bytes with, fastest first.
+enum class Classifier { Avx2, Sse2, Scalar };
+
+// Whether this build and the CPU it runs on can use classifier.
+bool supports(Classifier classifier);
+
+/**
+ * Tokenizes a whole source buffer in one pass.
+ *
+ * Bytes are classified as whitespace, identifier or digit characters 64 at a
+ * time, and token boundaries are found by scanning those bitmasks. The
+ * fastest classifier that the CPU supports is picked at run time, so AVX2 is
+ * used where it is available even though the build targets baseline x86-64.
+ * Produces the same tokens as BufferLexer. Sources must be smaller than 4 GiB.
+ */
+TokenArray tokenize(std::string_view source);
+// Tokenizes with a given classifier, which must be supported.
+TokenArray tokenize(std::string_view source, Classifier classifier);
+
+/**
+ * Lexer interface over a TokenArray so that Parser can consume a pretokenized
+ * stream. Both the source and the tokens must outlive it.
+ */
+class TokenArrayLexer {
+  std::string_view source_;
+  const TokenArray &tokens_;
+  size_t next_;
+  size_t current_;
+
+public:
+  TokenArrayLexer(std::string_view source, const TokenArray &tokens)
+      : source_(source), tokens_(tokens), next_(0), current_(0) {}
+  Token getToken() {
+    current_ = next_;
+    if (next_ + 1 < tokens_.size()) {
+      ++next_;
+    }
+    return tokens_.kinds()[current_];
+  }
+  std::string_view getIdentifier() const {
+    return source_.substr(tokens_.starts()[current_],
+                          tokens_.lengths()[current_]);
+  }
+  int getNumber() const { return tokens_.values()[current_]; }
+  size_t getTokenOffset() const { return tokens_.starts()[current_]; }
+  size_t getTokenEnd() const {
+    return tokens_.starts()[current_] + tokens_.lengths()[current_];
+  }
+};
+
+} // namespace lambcalc
+
+#endif
\ No newline at end of file
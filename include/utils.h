@@ -2,7 +2,12 @@
 #define UTILS_H
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
 #include <vector>
 
 template <typename T> using raw_ptr = T *;
@@ -19,6 +24,225 @@ template <size_t N> struct StringLiteral {
   char value[N];
 };
 
+/**
+ * Vector that stores up to N elements inline before it allocates.
+ *
+ * Meant for the short lists inside IR nodes, like the parameters of a
+ * function, which almost always fit inline. The heap pointer shares storage
+ * with the inline elements, so a SmallVector<T, N> is only 8 bytes larger
+ * than its inline elements. Only supports what the IR needs. Alloc must be
+ * stateless, since buffers are moved between vectors without comparing their
+ * allocators.
+ */
+template <typename T, size_t N, typename Alloc = std::allocator<T>>
+class SmallVector {
+  static_assert(N > 0, "use std::vector for vectors without inline storage");
+  static_assert(std::allocator_traits<Alloc>::is_always_equal::value);
+
+  // The elements are inline as long as the capacity is N.
+  union {
+    T *heap_;
+    alignas(T) std::byte inline_[N * sizeof(T)];
+  };
+  uint32_t size_;
+  uint32_t capacity_;
+  [[no_unique_address]] Alloc alloc_;
+
+  bool isInline() const { return capacity_ == N; }
+  void release() {
+    if (!isInline()) {
+      alloc_.deallocate(heap_, capacity_);
+    }
+  }
+  void grow(size_t minCapacity) {
+    size_t capacity = std::max(minCapacity, 2 * size_t(capacity_));
+    T *data = alloc_.allocate(capacity);
+    std::uninitialized_move(begin(), end(), data);
+    std::destroy(begin(), end());
+    release();
+    heap_ = data;
+    capacity_ = capacity;
+  }
+
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  SmallVector() : size_(0), capacity_(N) {}
+  SmallVector(std::initializer_list<T> init) : SmallVector() {
+    append(init.begin(), init.end());
+  }
+  template <std::input_iterator It>
+  SmallVector(It first, It last) : SmallVector() {
+    append(first, last);
+  }
+  SmallVector(const SmallVector &other) : SmallVector() {
+    append(other.begin(), other.end());
+  }
+  SmallVector(SmallVector &&other) noexcept : SmallVector() {
+    *this = std::move(other);
+  }
+  ~SmallVector() {
+    clear();
+    release();
+  }
+
+  SmallVector &operator=(const SmallVector &other) {
+    if (this != &other) {
+      clear();
+      append(other.begin(), other.end());
+    }
+    return *this;
+  }
+  SmallVector &operator=(SmallVector &&other) noexcept {
+    if (this == &other) {
+      return *this;
+    }
+    clear();
+    if (other.isInline()) {
+      // Inline elements can't be stolen, but they fit in our inline storage.
+      std::uninitialized_move(other.begin(), other.end(), data());
+      size_ = other.size_;
+      other.clear();
+    } else {
+      release();
+      heap_ = other.heap_;
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      other.size_ = 0;
+      other.capacity_ = N;
+    }
+    return *this;
+  }
+
+  T *data() { return isInline() ? reinterpret_cast<T *>(inline_) : heap_; }
+  const T *data() const {
+    return isInline() ? reinterpret_cast<const T *>(inline_) : heap_;
+  }
+  iterator begin() { return data(); }
+  iterator end() { return data() + size_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+  T &operator[](size_t i) { return data()[i]; }
+  const T &operator[](size_t i) const { return data()[i]; }
+  T &front() { return data()[0]; }
+  T &back() { return data()[size_ - 1]; }
+  const T &front() const { return data()[0]; }
+  const T &back() const { return data()[size_ - 1]; }
+
+  void reserve(size_t capacity) {
+    if (capacity > capacity_) {
+      grow(capacity);
+    }
+  }
+  template <class... Args> T &emplace_back(Args &&...args) {
+    if (size_ == capacity_) {
+      // The arguments might refer to an element, so construct the new element
+      // before the elements are moved.
+      T element(std::forward<Args>(args)...);
+      grow(size_ + 1);
+      std::construct_at(data() + size_, std::move(element));
+    } else {
+      std::construct_at(data() + size_, std::forward<Args>(args)...);
+    }
+    return data()[size_++];
+  }
+  void push_back(T element) { emplace_back(std::move(element)); }
+  template <std::input_iterator It> void append(It first, It last) {
+    if constexpr (std::forward_iterator<It>) {
+      reserve(size_ + std::distance(first, last));
+    }
+    for (; first != last; ++first) {
+      emplace_back(*first);
+    }
+  }
+  iterator insert(const_iterator pos, T element) {
+    size_t index = pos - begin();
+    emplace_back(std::move(element));
+    std::rotate(begin() + index, end() - 1, end());
+    return begin() + index;
+  }
+  void pop_back() { std::destroy_at(data() + --size_); }
+  void clear() {
+    std::destroy(begin(), end());
+    size_ = 0;
+  }
+
+  friend bool operator==(const SmallVector &a, const SmallVector &b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end());
+  }
+};
+
+namespace detail {
+// Chunks of ChunkedStacks that were destroyed on this thread, which the next
+// stacks reuse.
+inline thread_local std::vector<std::unique_ptr<std::byte[]>> freeChunks;
+} // namespace detail
+
+/**
+ * Stack that stores its elements in fixed size chunks.
+ *
+ * Growing never moves elements, and popped chunks are kept for the next push.
+ * Chunks of destroyed stacks are cached per thread, so a pass that creates a
+ * worklist per run stops allocating after the first few runs.
+ */
+template <typename T> class ChunkedStack {
+  static constexpr size_t ChunkBytes = 16 * 1024;
+  static constexpr size_t MaxFreeChunks = 64;
+  static constexpr size_t ChunkSize = ChunkBytes / sizeof(T);
+  static_assert(ChunkSize > 0, "element too large for ChunkedStack");
+  static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+  std::vector<std::unique_ptr<std::byte[]>> chunks_;
+  size_t size_;
+
+  T *slot(size_t i) {
+    return reinterpret_cast<T *>(chunks_[i / ChunkSize].get()) + i % ChunkSize;
+  }
+
+public:
+  using value_type = T;
+
+  ChunkedStack() : size_(0) {}
+  ChunkedStack(const ChunkedStack &) = delete;
+  ChunkedStack &operator=(const ChunkedStack &) = delete;
+  ~ChunkedStack() {
+    while (!empty()) {
+      pop();
+    }
+    for (auto &chunk : chunks_) {
+      if (detail::freeChunks.size() < MaxFreeChunks) {
+        detail::freeChunks.push_back(std::move(chunk));
+      }
+    }
+  }
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  T &top() { return *slot(size_ - 1); }
+  template <class... Args> T &emplace(Args &&...args) {
+    if (size_ == chunks_.size() * ChunkSize) {
+      if (detail::freeChunks.empty()) {
+        chunks_.push_back(
+            std::make_unique_for_overwrite<std::byte[]>(ChunkBytes));
+      } else {
+        chunks_.push_back(std::move(detail::freeChunks.back()));
+        detail::freeChunks.pop_back();
+      }
+    }
+    T *element = std::construct_at(slot(size_), std::forward<Args>(args)...);
+    ++size_;
+    return *element;
+  }
+  void push(T element) { emplace(std::move(element)); }
+  void pop() { std::destroy_at(slot(--size_)); }
+};
+
 template <typename... Ts> struct overloaded : Ts... {
   using Ts::operator()...;
 };
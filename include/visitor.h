@@ -2,6 +2,8 @@
 #define VISITOR_H
 
 #include "anf.h"
+#include "utils.h"
+#include <algorithm>
 #include <variant>
 
 namespace lambcalc {
@@ -33,13 +35,55 @@ struct WorklistTask : std::variant<NodeTask<Exp, Ptr>, FnTask> {
       : WorklistTask(std::in_place_index<0>, parentLink, **parentLink) {}
 };
 
-template <typename Exp, template <class> class Ptr = std::unique_ptr>
-struct DestructorTask {
-  Ptr<Exp> exp;
-  explicit DestructorTask(Ptr<Exp> *parentLink)
-      : exp(parentLink == nullptr ? nullptr : std::move(*parentLink)) {}
+/**
+ * Worklist task that is either a node or one of a fixed set of continuation
+ * records. Unlike an FnTask, a continuation is stored inline in the worklist,
+ * so pushing one doesn't allocate.
+ */
+template <typename Exp, template <class> class Ptr, typename... Conts>
+struct TypedTask : std::variant<NodeTask<Exp, Ptr>, Conts...> {
+  using std::variant<NodeTask<Exp, Ptr>, Conts...>::variant;
+  explicit TypedTask(Ptr<Exp> *parentLink)
+      : TypedTask(std::in_place_index<0>, parentLink, **parentLink) {}
 };
 
+/**
+ * Frees a tree without recursion and in constant extra space.
+ *
+ * links(node) returns pointers to the child links of a node, where the first
+ * one is the thread link and the rest are null past the node's children. A
+ * leaf has a null thread link.
+ *
+ * The pending nodes form a list through their thread links, starting at
+ * head. While head has another child, the child is rotated in front of
+ * head: head takes over the child's thread link and the child's thread link
+ * points to head. Every rotation grows the list by a node that never leaves
+ * it until it's freed, so there are fewer rotations than nodes. Once head
+ * only has a thread link it's freed without any children left to destroy.
+ */
+template <typename Exp, typename Links>
+void destroyTree(std::unique_ptr<Exp> head, Links links) {
+  while (head) {
+    auto headLinks = links(*head);
+    auto child = std::ranges::find_if(
+        headLinks.begin() + 1, headLinks.end(),
+        [](std::unique_ptr<Exp> *link) { return link && *link; });
+    if (child == headLinks.end()) {
+      auto *thread = headLinks[0];
+      head = thread ? std::move(*thread) : nullptr;
+      continue;
+    }
+    auto node = std::move(**child);
+    auto *thread = links(*node)[0];
+    if (thread == nullptr) {
+      continue;
+    }
+    **child = std::move(*thread);
+    *thread = std::move(head);
+    head = std::move(node);
+  }
+}
+
 template <typename T, typename Task>
 concept Worklist = requires(T worklist, Task task) { worklist.push(task); };
 
@@ -76,7 +120,7 @@ public:
   virtual void addWorklist(Ptr<Exp<Ptr>> *parentLink) {
     worklist.push(T(parentLink));
   }
-  virtual void addWorklist(const std::string &, Ptr<Exp<Ptr>> *parentLink) {
+  virtual void addWorklist(Symbol, Ptr<Exp<Ptr>> *parentLink) {
     addWorklist(parentLink);
   }
 
@@ -109,6 +153,75 @@ public:
   }
 };
 
+/**
+ * WorklistVisitor without virtual functions.
+ *
+ * Derived is the final visitor (CRTP), and the addWorklist hooks and node
+ * visits are dispatched to it statically. run() drains the worklist, visiting
+ * nodes with visitTask and passing continuation records to Derived::resume.
+ */
+template <typename Derived, typename Visitor, typename T,
+          template <class> class W,
+          template <class> class Ptr = std::unique_ptr>
+  requires(Worklist<W<T>, T> && Task<T, Ptr>)
+class StaticWorklistVisitor : public Visitor {
+  W<T> worklist;
+
+  Derived &derived() { return static_cast<Derived &>(*this); }
+
+public:
+  template <class... Args>
+  StaticWorklistVisitor(Args... args) : Visitor(args...) {}
+  W<T> &getWorklist() { return worklist; }
+  void addWorklist(Ptr<Exp<Ptr>> *parentLink) { worklist.push(T(parentLink)); }
+  void addWorklist(Symbol, Ptr<Exp<Ptr>> *parentLink) {
+    derived().addWorklist(parentLink);
+  }
+
+  using RetTy =
+      decltype(std::declval<Visitor>().operator()(std::declval<IntExp &>()));
+
+  decltype(auto) operator()(IntExp &exp) { return Visitor::operator()(exp); }
+  decltype(auto) operator()(VarExp &exp) { return Visitor::operator()(exp); }
+  decltype(auto) operator()(LamExp<Ptr> &exp) {
+    DISPATCH(derived().addWorklist(exp.param, &exp.body));
+  }
+  decltype(auto) operator()(AppExp<Ptr> &exp) {
+    DISPATCH({
+      derived().addWorklist(&exp.fn);
+      derived().addWorklist(&exp.arg);
+    });
+  }
+  decltype(auto) operator()(BopExp<Ptr> &exp) {
+    DISPATCH({
+      derived().addWorklist(&exp.arg1);
+      derived().addWorklist(&exp.arg2);
+    });
+  }
+  decltype(auto) operator()(IfExp<Ptr> &exp) {
+    DISPATCH({
+      derived().addWorklist(&exp.cond);
+      derived().addWorklist(&exp.then);
+      derived().addWorklist(&exp.els);
+    });
+  }
+
+  void visitTask(NodeTask<Exp<Ptr>, Ptr> &task) {
+    std::visit(derived(), std::get<1>(task).get());
+  }
+  void run() {
+    while (!worklist.empty()) {
+      auto task = std::move(worklist.top());
+      worklist.pop();
+      std::visit(
+          overloaded{
+              [&](NodeTask<Exp<Ptr>, Ptr> &n) { derived().visitTask(n); },
+              [&](auto &cont) { derived().resume(cont); }},
+          task);
+    }
+  }
+};
+
 } // namespace ast
 
 namespace anf {
@@ -149,8 +262,7 @@ public:
   virtual void addWorklist(const Var &, std::unique_ptr<Exp> *parentLink) {
     addWorklist(parentLink);
   }
-  virtual void addWorklist(const std::vector<Var> &,
-                           std::unique_ptr<Exp> *parentLink) {
+  virtual void addWorklist(const Vars &, std::unique_ptr<Exp> *parentLink) {
     addWorklist(parentLink);
   }
 
@@ -195,6 +307,84 @@ public:
   }
 };
 
+/**
+ * WorklistVisitor without virtual functions, see ast::StaticWorklistVisitor.
+ */
+template <typename Derived, typename Visitor, Task T, template <class> class W>
+  requires Worklist<W<T>, T>
+class StaticWorklistVisitor : public Visitor {
+  W<T> worklist;
+
+  Derived &derived() { return static_cast<Derived &>(*this); }
+
+public:
+  template <class... Args>
+  StaticWorklistVisitor(Args... args) : Visitor(args...) {}
+  W<T> &getWorklist() { return worklist; }
+  void addWorklist(std::unique_ptr<Exp> *parentLink) {
+    worklist.push(T(parentLink));
+  }
+  void addWorklist(const Var &, std::unique_ptr<Exp> *parentLink) {
+    derived().addWorklist(parentLink);
+  }
+  void addWorklist(const Vars &, std::unique_ptr<Exp> *parentLink) {
+    derived().addWorklist(parentLink);
+  }
+
+  using RetTy =
+      decltype(std::declval<Visitor>().operator()(std::declval<HaltExp &>()));
+
+  decltype(auto) operator()(HaltExp &exp) { return Visitor::operator()(exp); }
+  decltype(auto) operator()(FunExp &exp) {
+    DISPATCH({
+      derived().addWorklist(exp.params, &exp.body);
+      derived().addWorklist(exp.name, &exp.rest);
+    });
+  }
+  decltype(auto) operator()(JoinExp &exp) {
+    DISPATCH({
+      if (exp.slot) {
+        derived().addWorklist(*exp.slot, &exp.body);
+      } else {
+        derived().addWorklist(&exp.body);
+      }
+      derived().addWorklist(exp.name, &exp.rest);
+    });
+  }
+  decltype(auto) operator()(JumpExp &exp) { return Visitor::operator()(exp); }
+  decltype(auto) operator()(AppExp &exp) {
+    DISPATCH(derived().addWorklist(exp.name, &exp.rest));
+  }
+  decltype(auto) operator()(BopExp &exp) {
+    DISPATCH(derived().addWorklist(exp.name, &exp.rest));
+  }
+  decltype(auto) operator()(IfExp &exp) {
+    DISPATCH({
+      derived().addWorklist(&exp.thenBranch);
+      derived().addWorklist(&exp.elseBranch);
+    });
+  }
+  decltype(auto) operator()(TupleExp &exp) {
+    DISPATCH(derived().addWorklist(exp.name, &exp.rest));
+  }
+  decltype(auto) operator()(ProjExp &exp) {
+    DISPATCH(derived().addWorklist(exp.name, &exp.rest));
+  }
+
+  void visitTask(NodeTask<Exp> &task) {
+    std::visit(derived(), std::get<1>(task).get());
+  }
+  void run() {
+    while (!worklist.empty()) {
+      auto task = std::move(worklist.top());
+      worklist.pop();
+      std::visit(overloaded{[&](NodeTask<Exp> &n) { derived().visitTask(n); },
+                            [&](auto &cont) { derived().resume(cont); }},
+                 task);
+    }
+  }
+};
+
 template <typename Visitor> class ExpValueVisitor;
 
 template <typename Visitor> struct ValueVisitor {
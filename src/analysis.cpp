@@ -0,0 +1,14 @@
+#include "analysis.h"
+
+namespace lambcalc {
+namespace anf {
+
+std::ostream &operator<<(std::ostream &os, const Statistics &stats) {
+  return os << "nodes: " << stats.nodes << " functions: " << stats.functions
+            << " joins: " << stats.joins
+            << " applications: " << stats.applications
+            << " max function depth: " << stats.maxFunctionDepth;
+}
+
+} // namespace anf
+} // namespace lambcalc
\ No newline at end of file
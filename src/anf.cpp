@@ -1,20 +1,40 @@
 #include "anf.h"
+#include "pool.h"
+#include "rename.h"
+#include "threadpool.h"
 #include "utils.h"
 #include "visitor.h"
-#include <queue>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace lambcalc {
 namespace anf {
 
+// Values and nodes are allocated for every subexpression, so keep them small
+// (bench/anf.cpp reports the size of every node kind).
+static_assert(sizeof(Value) == 8);
+static_assert(sizeof(Exp) <= 48);
+
+static const Symbol tmp("tmp");
 static int counter = 0;
-std::string fresh() { return std::string("tmp") + std::to_string(counter++); }
+Var fresh() { return Symbol::fresh(tmp, counter++); }
 void resetCounter() { counter = 0; }
 
 template <StringLiteral lit> struct StringValueVisitor {
-  std::string operator()(VarValue v) { return v.var; }
-  std::string operator()(GlobValue v) { return v.glob; }
-  std::string operator()(auto) {
+  Var operator()(VarValue v) { return v.var; }
+  Var operator()(GlobValue v) { return v.glob; }
+  Var operator()(auto) {
     throw std::runtime_error(std::string(lit.value) +
                              " expected to return var or glob");
   }
@@ -40,7 +60,7 @@ struct AnfConvertVisitor {
   }
   std::unique_ptr<Exp> operator()(ast::AppExp<std::unique_ptr> &exp) {
     return ast::convert(*exp.fn, [&arg = *exp.arg, &k = k](Value fnValue) {
-      std::string fnName =
+      Var fnName =
           std::visit(StringValueVisitor<"function">{}, std::move(fnValue));
       return ast::convert(arg,
                           [fnName = std::move(fnName), &k = k](Value argValue) {
@@ -103,44 +123,98 @@ std::unique_ptr<Exp> convert(ast::Exp<> &exp) {
   return ast::convert(exp, [](Value value) { return make(HaltExp{value}); });
 }
 
-struct DestructorVisitor
-    : WorklistVisitor<DefaultVisitor, DestructorTask<Exp>, std::queue> {};
+using Links = std::array<std::unique_ptr<Exp> *, 2>;
+
+// Child links of a node for destroyTree, which threads nodes through the
+// rest of the node, or the else branch of an if.
+static Links links(Exp &exp) {
+  return std::visit(
+      overloaded{[](HaltExp &) { return Links{}; },
+                 [](FunExp &exp) { return Links{&exp.rest, &exp.body}; },
+                 [](JoinExp &exp) { return Links{&exp.rest, &exp.body}; },
+                 [](JumpExp &) { return Links{}; },
+                 [](AppExp &exp) { return Links{&exp.rest}; },
+                 [](BopExp &exp) { return Links{&exp.rest}; },
+                 [](IfExp &exp) {
+                   return Links{&exp.elseBranch, &exp.thenBranch};
+                 },
+                 [](TupleExp &exp) { return Links{&exp.rest}; },
+                 [](ProjExp &exp) { return Links{&exp.rest}; }},
+      exp);
+}
 
 Exp::~Exp() {
-  DestructorVisitor visitor;
-  auto &queue = visitor.getWorklist();
-  std::visit(visitor, *this);
-  while (!queue.empty()) {
-    auto task = std::move(queue.front());
-    queue.pop();
-
-    if (task.exp != nullptr) {
-      std::visit(visitor, *task.exp);
+  // The subtrees of a node in an arena are in the arena too, and are freed
+  // along with it by reset. The children are checked rather than the node,
+  // which may be a temporary on the stack.
+  for (auto *link : links(*this)) {
+    if (link == nullptr || *link == nullptr) {
+      continue;
+    }
+    if (NodeArena::owns(link->get())) {
+      (void)link->release();
+    } else {
+      destroyTree(std::move(*link), links);
     }
   }
 }
 
+void *Exp::operator new(size_t size) {
+  NodeArena *arena = NodeArena::current();
+  return arena ? arena->allocate(size)
+               : ::operator new(size, NodeArena::heapAlign);
+}
+
+void Exp::operator delete(void *ptr, size_t size) {
+  if (!NodeArena::owns(ptr)) {
+    ::operator delete(ptr, size, NodeArena::heapAlign);
+  }
+}
+
+size_t NodeArena::nodeSize() { return sizeof(Exp); }
+
+void *NodeArena::allocate(size_t size) {
+  // Nodes and their lists are never more than 8 byte aligned.
+  static_assert(alignof(Exp) <= alignof(uint64_t));
+  static_assert(alignof(Value) <= alignof(uint64_t));
+  static_assert(sizeof(Exp) % 16 == 0);
+  // Sizes are rounded up to 16 bytes, so the bump pointer stays 8 bytes past
+  // a multiple of 16 once it gets there. Blocks start on a page, so the first
+  // allocation of a block takes a word more and starts at its second word.
+  size_t words = (size + 15) / 16 * 2;
+  uint64_t *ptr = allocator_.allocate<uint64_t>(words);
+  while (!owns(ptr)) {
+    uint64_t *pad = allocator_.allocate<uint64_t>(1);
+    if (pad == ptr + words) {
+      return ptr + 1;
+    }
+    // The word didn't fit, so it started another block.
+    ptr = allocator_.allocate<uint64_t>(words);
+  }
+  return ptr;
+}
+
 template <template <class> class Ptr> struct KFrame;
 template <template <class> class Ptr> struct K2Frame;
 template <template <class> class Ptr> using K = std::vector<KFrame<Ptr>>;
 template <template <class> class Ptr> using K2 = std::vector<K2Frame<Ptr>>;
 template <template <class> class Ptr> struct K2_Lam1 {
   K<Ptr> k;
-  std::string v;
+  Var v;
 };
 
 struct K2_Lam2 {
-  std::string f, v;
+  Var f, v;
   std::unique_ptr<Exp> body;
 };
 
 struct K2_App1 {
-  std::string r, f;
+  Var r, f;
   Value x;
 };
 
 struct K2_Bop1 {
-  std::string r;
+  Var r;
   ast::Bop bop;
   Value x, y;
 };
@@ -148,20 +222,20 @@ struct K2_Bop1 {
 template <template <class> class Ptr> struct K2_If1 {
   ast::Exp<Ptr> &t;
   ast::Exp<Ptr> &f;
-  std::string j, p;
+  Var j, p;
   Value c;
 };
 
 template <template <class> class Ptr> struct K2_If2 {
   ast::Exp<Ptr> &f;
-  std::string j, p;
+  Var j, p;
   Value c;
   std::unique_ptr<Exp> rest;
 };
 
 struct K2_If3 {
   std::unique_ptr<Exp> t;
-  std::string j, p;
+  Var j, p;
   Value c;
   std::unique_ptr<Exp> rest;
 };
@@ -197,7 +271,7 @@ template <template <class> class Ptr> struct K_If1 {
 };
 
 struct K_If2 {
-  std::string j;
+  Var j;
 };
 
 template <template <class> class Ptr>
@@ -207,20 +281,126 @@ struct KFrame : public std::variant<K_App1<Ptr>, K_App2, K_Bop1<Ptr>, K_Bop2,
                      K_If2>::variant;
 };
 
+// Lambda parameter enclosing the expression being converted, when scoping
+// isn't Named.
+struct Binder {
+  Symbol param;
+  Var name;
+  // Name the parameter had outside of the lambda when scoping is Fused.
+  std::optional<Var> shadowed;
+};
+
+// State that a conversion starts in: the continuation of the root, the
+// enclosing binders with the innermost last, and the numbers of the next
+// fresh variables, which are updated while converting.
+template <template <class> class Ptr> struct DefuncStart {
+  K<Ptr> k;
+  std::vector<Binder> binders;
+  int tmpCounter = 0;
+  int binderCounter = 0;
+};
+
+// Number of nodes in a subtree and of the fresh variables converting it makes.
+struct SubtreeCounts {
+  size_t nodes = 0;
+  int tmps = 0;
+  int binders = 0;
+};
+
+template <template <class> class Ptr> class ParallelDefunc;
+
+// Shared lambdas of hash-consed trees are the usual cause.
+static Diagnostic duplicateBinder(Symbol param) {
+  return Diagnostic{std::string(param.str()) +
+                        " is bound more than once, which needs Scoping::Fused "
+                        "or Scoping::Indexed",
+                    {}};
+}
+
+// Sets unbound to the variable if the error is a variable that isn't in
+// scope. With parallel, large lambda bodies and if branches are converted in
+// tasks and left as placeholders in the result.
 template <template <class> class Ptr>
-std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root) {
+static Expected<std::unique_ptr<Exp>>
+convertDefunc(ast::Exp<Ptr> &root, Scoping scoping, DefuncStart<Ptr> &start,
+              std::optional<Symbol> &unbound, ParallelDefunc<Ptr> *parallel) {
   // Parameters for apply_k2, apply_k, and go normalized.
   // If two parameters for different functions have the same type,
   // they can share the same variable because tail calls destroy the stack.
   ast::Exp<Ptr> *go_exp = &root;
   std::unique_ptr<Exp> k2_exp;
-  K<Ptr> k;
+  K<Ptr> k = std::move(start.k);
   K2<Ptr> k2;
   Value value;
+  std::vector<Binder> &binders = start.binders;
+  // Current name of every bound symbol when scoping is Fused, indexed by
+  // symbol slot. Only grows to the largest bound slot, so that tasks with few
+  // binders can rebuild it cheaply.
+  std::vector<std::optional<Var>> renamed;
+  auto renaming = [&](Symbol name) -> std::optional<Var> & {
+    if (name.slot() >= renamed.size()) {
+      renamed.resize(std::max<size_t>(name.slot() + 1, renamed.size() * 2));
+    }
+    return renamed[name.slot()];
+  };
+  auto lookup = [&](Symbol name) -> std::optional<Var> {
+    return name.slot() < renamed.size() ? renamed[name.slot()] : std::nullopt;
+  };
+  if (scoping == Scoping::Fused) {
+    for (auto &binder : binders) {
+      renaming(binder.param) = binder.name;
+    }
+  }
+  int &tmpCounter = start.tmpCounter;
+  int &binderCounter = start.binderCounter;
+  auto fresh = [&] { return Symbol::fresh(tmp, tmpCounter++); };
+  std::optional<Diagnostic> error;
+  // Parameters seen so far when scoping is Named, whose names have to be
+  // unique. A parallel conversion checks them before it starts instead.
+  SymbolSet bound;
+
+  // Nodes of root that aren't converted by tasks yet.
+  const SubtreeCounts *rootCounts = parallel ? parallel->counts(root) : nullptr;
+  size_t remaining = rootCounts ? rootCounts->nodes : 0;
+  // Converts exp with the continuation in a task instead if both it and the
+  // rest are large enough, leaving a placeholder in k2_exp and skipping the
+  // fresh variables the task makes.
+  auto split = [&](ast::Exp<Ptr> &exp, auto makeK) {
+    const SubtreeCounts *counts = parallel ? parallel->counts(exp) : nullptr;
+    if (counts == nullptr ||
+        remaining < counts->nodes + ParallelDefunc<Ptr>::Grain) {
+      return false;
+    }
+    remaining -= counts->nodes;
+    k2_exp = parallel->spawn(
+        exp, scoping,
+        DefuncStart<Ptr>{makeK(), binders, tmpCounter, binderCounter});
+    tmpCounter += counts->tmps;
+    binderCounter += counts->binders;
+    return true;
+  };
 
   enum { APPLY_K2, APPLY_K, GO } dispatch = GO;
+  // Converts an if branch that jumps to the join point j.
+  auto goBranch = [&](ast::Exp<Ptr> &branch, Var j) {
+    auto jumpK = [&] {
+      K<Ptr> k;
+      k.emplace_back(std::in_place_type<K_If2>, j);
+      return k;
+    };
+    if (split(branch, jumpK)) {
+      dispatch = APPLY_K2;
+      return;
+    }
+    go_exp = &branch;
+    k = jumpK();
+    dispatch = GO;
+  };
 
   while (true) {
+    if (error) {
+      return std::unexpected(std::move(*error));
+    }
     switch (dispatch) {
     case APPLY_K2: {
       if (k2.empty()) {
@@ -231,6 +411,12 @@ std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root) {
       std::visit(
           overloaded{
               [&](K2_Lam1<Ptr> &frame) {
+                if (scoping == Scoping::Fused) {
+                  renaming(binders.back().param) = binders.back().shadowed;
+                }
+                if (scoping != Scoping::Named) {
+                  binders.pop_back();
+                }
                 auto f = fresh();
                 k = std::move(frame.k);
                 value = VarValue{f};
@@ -258,22 +444,16 @@ std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root) {
                                      .rest = std::move(k2_exp)});
               },
               [&](K2_If1<Ptr> &frame) {
-                go_exp = &frame.t;
                 k2.emplace_back(std::in_place_type<K2_If2<Ptr>>, frame.f,
                                 frame.j, std::move(frame.p), std::move(frame.c),
                                 std::move(k2_exp));
-                k.clear();
-                k.emplace_back(std::in_place_type<K_If2>, frame.j);
-                dispatch = GO;
+                goBranch(frame.t, frame.j);
               },
               [&](K2_If2<Ptr> &frame) {
-                go_exp = &frame.f;
                 k2.emplace_back(std::in_place_type<K2_If3>, std::move(k2_exp),
                                 frame.j, std::move(frame.p), std::move(frame.c),
                                 std::move(frame.rest));
-                k.clear();
-                k.emplace_back(std::in_place_type<K_If2>, frame.j);
-                dispatch = GO;
+                goBranch(frame.f, frame.j);
               },
               [&](K2_If3 &frame) {
                 k2_exp = make(JoinExp{
@@ -311,9 +491,9 @@ std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root) {
                                             f.var, std::move(value));
                                         value = VarValue{r};
                                       },
-                                      [](auto &) {
-                                        throw std::runtime_error(
-                                            "must apply named value");
+                                      [&](auto &) {
+                                        error = Diagnostic{
+                                            "must apply named value", {}};
                                       }},
                            frame.f);
               },
@@ -353,15 +533,53 @@ std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root) {
                        dispatch = APPLY_K;
                      },
                      [&](ast::VarExp &exp) {
-                       value = VarValue{exp.name};
+                       switch (scoping) {
+                       case Scoping::Named:
+                         value = VarValue{exp.name};
+                         break;
+                       case Scoping::Indexed:
+                         assert(exp.index >= 0 &&
+                                size_t(exp.index) < binders.size());
+                         value = VarValue{
+                             binders[binders.size() - 1 - exp.index].name};
+                         break;
+                       case Scoping::Fused:
+                         if (auto name = lookup(exp.name)) {
+                           value = VarValue{*name};
+                         } else {
+                           unbound = exp.name;
+                           error = Diagnostic{std::string(exp.name.str()) +
+                                                  " is not in scope",
+                                              {}};
+                         }
+                         break;
+                       }
                        dispatch = APPLY_K;
                      },
                      [&](ast::LamExp<Ptr> &exp) {
                        go_exp = &*exp.body;
                        K<Ptr> oldK;
                        k.swap(oldK);
+                       Var param = exp.param;
+                       if (scoping == Scoping::Named && parallel == nullptr) {
+                         if (bound.contains(param)) {
+                           error = duplicateBinder(param);
+                         }
+                         bound.insert(param);
+                       }
+                       if (scoping != Scoping::Named) {
+                         param = Symbol::fresh(param, binderCounter++);
+                         std::optional<Var> shadowed;
+                         if (scoping == Scoping::Fused) {
+                           shadowed = std::exchange(renaming(exp.param), param);
+                         }
+                         binders.emplace_back(exp.param, param, shadowed);
+                       }
                        k2.emplace_back(std::in_place_type<K2_Lam1<Ptr>>,
-                                       std::move(oldK), exp.param);
+                                       std::move(oldK), param);
+                       if (split(*exp.body, [] { return K<Ptr>{}; })) {
+                         dispatch = APPLY_K2;
+                       }
                      },
                      [&](ast::AppExp<Ptr> &exp) {
                        go_exp = &*exp.fn;
@@ -386,8 +604,249 @@ std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root) {
   return nullptr;
 }
 
-template std::unique_ptr<Exp> convertDefunc(ast::Exp<std::unique_ptr> &root);
-template std::unique_ptr<Exp> convertDefunc(ast::Exp<raw_ptr> &root);
+/**
+ * Subtrees that the parallel convertDefunc converts in tasks. A conversion
+ * leaves a placeholder node for every subtree it spawns, which is replaced
+ * by the result of the task once every task is done.
+ *
+ * Every task starts with the fresh variable numbers that the sequential
+ * conversion would have reached at its subtree, and the conversion that
+ * spawns it skips over the numbers the task uses, so the result is the same.
+ */
+template <template <class> class Ptr> class ParallelDefunc {
+  struct Spawned {
+    Exp *placeholder;
+    std::unique_ptr<Exp> result;
+  };
+  // Counts of the subtrees of at least Grain nodes, which are the only ones
+  // worth converting in a task.
+  std::unordered_map<const ast::Exp<Ptr> *, SubtreeCounts> counts_;
+  std::mutex mutex_;
+  std::deque<Spawned> spawned_;
+  std::atomic<bool> failed_ = false;
+  // Last so it is destroyed first, waiting for the tasks that use the rest.
+  TaskGroup group_;
+
+public:
+  static constexpr size_t Grain = 1024;
+
+  // With Named scoping, a binder that isn't unique fails the conversion.
+  ParallelDefunc(ThreadPool &pool, const ast::Exp<Ptr> &root,
+                 Scoping scoping);
+  const SubtreeCounts *counts(const ast::Exp<Ptr> &exp) const {
+    auto it = counts_.find(&exp);
+    return it == counts_.end() ? nullptr : &it->second;
+  }
+  std::unique_ptr<Exp> spawn(ast::Exp<Ptr> &exp, Scoping scoping,
+                             DefuncStart<Ptr> start);
+  // Waits for the tasks and fills their results into root. Returns false if
+  // root or any of the tasks failed.
+  bool finish(Expected<std::unique_ptr<Exp>> &root);
+};
+
+template <template <class> class Ptr>
+ParallelDefunc<Ptr>::ParallelDefunc(ThreadPool &pool,
+                                    const ast::Exp<Ptr> &root, Scoping scoping)
+    : group_(pool) {
+  // Postorder traversal with the counts of the visited children on a stack.
+  std::vector<std::pair<const ast::Exp<Ptr> *, bool>> stack{{&root, false}};
+  std::vector<SubtreeCounts> children;
+  SymbolSet bound;
+  while (!stack.empty()) {
+    auto [exp, visited] = stack.back();
+    if (!visited) {
+      stack.back().second = true;
+      auto push = [&](const auto &...exps) {
+        (stack.emplace_back(&*exps, false), ...);
+      };
+      std::visit(overloaded{
+                     [&](const ast::LamExp<Ptr> &exp) {
+                       if (scoping == Scoping::Named) {
+                         if (bound.contains(exp.param)) {
+                           failed_.store(true, std::memory_order_relaxed);
+                         }
+                         bound.insert(exp.param);
+                       }
+                       push(exp.body);
+                     },
+                     [&](const ast::AppExp<Ptr> &exp) {
+                       push(exp.fn, exp.arg);
+                     },
+                     [&](const ast::BopExp<Ptr> &exp) {
+                       push(exp.arg1, exp.arg2);
+                     },
+                     [&](const ast::IfExp<Ptr> &exp) {
+                       push(exp.cond, exp.then, exp.els);
+                     },
+                     [](const auto &) {},
+                 },
+                 *exp);
+      continue;
+    }
+    stack.pop_back();
+    SubtreeCounts counts{.nodes = 1};
+    auto pop = [&](size_t n, int tmps, int binders) {
+      for (size_t i = 0; i < n; ++i) {
+        counts.nodes += children.back().nodes;
+        counts.tmps += children.back().tmps;
+        counts.binders += children.back().binders;
+        children.pop_back();
+      }
+      counts.tmps += tmps;
+      counts.binders += binders;
+    };
+    std::visit(overloaded{
+                   [&](const ast::LamExp<Ptr> &) { pop(1, 1, 1); },
+                   [&](const ast::AppExp<Ptr> &) { pop(2, 1, 0); },
+                   [&](const ast::BopExp<Ptr> &) { pop(2, 1, 0); },
+                   [&](const ast::IfExp<Ptr> &) { pop(3, 2, 0); },
+                   [](const auto &) {},
+               },
+               *exp);
+    if (counts.nodes >= Grain) {
+      counts_.emplace(exp, counts);
+    }
+    children.push_back(counts);
+  }
+}
+
+template <template <class> class Ptr>
+std::unique_ptr<Exp> ParallelDefunc<Ptr>::spawn(ast::Exp<Ptr> &exp,
+                                                Scoping scoping,
+                                                DefuncStart<Ptr> start) {
+  auto placeholder = make(HaltExp{IntValue{0}});
+  Spawned *spawned;
+  {
+    std::lock_guard lock(mutex_);
+    spawned = &spawned_.emplace_back(placeholder.get(), nullptr);
+  }
+  group_.spawn([this, &exp, scoping, spawned,
+                start = std::move(start)]() mutable {
+    if (failed_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    std::optional<Symbol> unbound;
+    auto result = convertDefunc(exp, scoping, start, unbound, this);
+    if (result) {
+      spawned->result = std::move(*result);
+    } else {
+      failed_.store(true, std::memory_order_relaxed);
+    }
+  });
+  return placeholder;
+}
+
+template <template <class> class Ptr>
+bool ParallelDefunc<Ptr>::finish(Expected<std::unique_ptr<Exp>> &root) {
+  if (!root) {
+    failed_.store(true, std::memory_order_relaxed);
+  }
+  group_.wait();
+  if (failed_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  // The placeholders are already linked into the trees, so replace them in
+  // place. The moved out results are left with no children.
+  for (auto &spawned : spawned_) {
+    std::destroy_at(spawned.placeholder);
+    std::construct_at(spawned.placeholder, std::move(*spawned.result));
+  }
+  return true;
+}
+
+static std::unique_ptr<Exp> orThrow(Expected<std::unique_ptr<Exp>> result,
+                                    const std::optional<Symbol> &unbound) {
+  if (!result) {
+    if (unbound) {
+      throw ast::NotInScopeException(*unbound);
+    }
+    throw std::runtime_error(result.error().message);
+  }
+  return std::move(*result);
+}
+
+template <template <class> class Ptr>
+static Expected<std::unique_ptr<Exp>>
+convertDefunc(ast::Exp<Ptr> &root, Scoping scoping,
+              std::optional<Symbol> &unbound) {
+  DefuncStart<Ptr> start{.k = {}, .binders = {}, .tmpCounter = counter};
+  auto result = convertDefunc<Ptr>(root, scoping, start, unbound, nullptr);
+  counter = start.tmpCounter;
+  return result;
+}
+
+// Errors are rare and the tasks would find them in a different order than
+// the sequential conversion, so on an error this converts again sequentially
+// to report the same one.
+template <template <class> class Ptr>
+static Expected<std::unique_ptr<Exp>>
+convertDefunc(ast::Exp<Ptr> &root, Scoping scoping, ThreadPool &pool,
+              std::optional<Symbol> &unbound) {
+  // Tasks make their nodes on the threads of the pool, where the arena isn't
+  // current.
+  assert(NodeArena::current() == nullptr &&
+         "Parallel conversion can't allocate in a NodeArena");
+  {
+    ParallelDefunc<Ptr> parallel(pool, root, scoping);
+    DefuncStart<Ptr> start{.k = {}, .binders = {}, .tmpCounter = counter};
+    auto result = convertDefunc(root, scoping, start, unbound, &parallel);
+    if (parallel.finish(result)) {
+      counter = start.tmpCounter;
+      return result;
+    }
+  }
+  unbound.reset();
+  return convertDefunc(root, scoping, unbound);
+}
+
+template <template <class> class Ptr>
+std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root, Scoping scoping) {
+  std::optional<Symbol> unbound;
+  return orThrow(convertDefunc(root, scoping, unbound), unbound);
+}
+
+template <template <class> class Ptr>
+std::unique_ptr<Exp> convertDefunc(ast::Exp<Ptr> &root, Scoping scoping,
+                                   ThreadPool &pool) {
+  std::optional<Symbol> unbound;
+  return orThrow(convertDefunc(root, scoping, pool, unbound), unbound);
+}
+
+template <template <class> class Ptr>
+Expected<std::unique_ptr<Exp>> tryConvertDefunc(ast::Exp<Ptr> &root,
+                                                Scoping scoping) {
+  std::optional<Symbol> unbound;
+  return convertDefunc(root, scoping, unbound);
+}
+
+template <template <class> class Ptr>
+Expected<std::unique_ptr<Exp>>
+tryConvertDefunc(ast::Exp<Ptr> &root, Scoping scoping, ThreadPool &pool) {
+  std::optional<Symbol> unbound;
+  return convertDefunc(root, scoping, pool, unbound);
+}
+
+template std::unique_ptr<Exp> convertDefunc(ast::Exp<std::unique_ptr> &root,
+                                            Scoping scoping);
+template std::unique_ptr<Exp> convertDefunc(ast::Exp<raw_ptr> &root,
+                                            Scoping scoping);
+template std::unique_ptr<Exp> convertDefunc(ast::Exp<pool::index_ptr> &root,
+                                            Scoping scoping);
+template std::unique_ptr<Exp> convertDefunc(ast::Exp<std::unique_ptr> &root,
+                                            Scoping scoping, ThreadPool &pool);
+template std::unique_ptr<Exp> convertDefunc(ast::Exp<raw_ptr> &root,
+                                            Scoping scoping, ThreadPool &pool);
+template Expected<std::unique_ptr<Exp>>
+tryConvertDefunc(ast::Exp<std::unique_ptr> &root, Scoping scoping);
+template Expected<std::unique_ptr<Exp>>
+tryConvertDefunc(ast::Exp<raw_ptr> &root, Scoping scoping);
+template Expected<std::unique_ptr<Exp>>
+tryConvertDefunc(ast::Exp<pool::index_ptr> &root, Scoping scoping);
+template Expected<std::unique_ptr<Exp>>
+tryConvertDefunc(ast::Exp<std::unique_ptr> &root, Scoping scoping,
+                 ThreadPool &pool);
+template Expected<std::unique_ptr<Exp>>
+tryConvertDefunc(ast::Exp<raw_ptr> &root, Scoping scoping, ThreadPool &pool);
 
 std::string Exp::dump() {
   std::ostringstream out;
@@ -0,0 +1,85 @@
+#include "arena.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace lambcalc {
+namespace arena {
+
+static constexpr size_t hugePageSize = 2 << 20;
+
+static size_t roundUp(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+ChunkedAllocator::ChunkedAllocator() : ChunkedAllocator(Options{}) {}
+
+ChunkedAllocator::ChunkedAllocator(Options options)
+    : options_(options), nextBlock_(0), blockBegin_(nullptr), begin_(nullptr),
+      end_(nullptr), usedBefore_(0), highWaterMark_(0) {}
+
+ChunkedAllocator::~ChunkedAllocator() {
+  for (auto &block : blocks_) {
+    munmap(block.begin, block.size);
+  }
+}
+
+void ChunkedAllocator::enterBlock(size_t index) {
+  Block &block = blocks_[index];
+  nextBlock_ = index + 1;
+  blockBegin_ = begin_ = block.begin;
+  // Cut the block short at the budget so the fast path can't go over it.
+  end_ = block.begin + std::min(block.size, options_.budget - usedBefore_);
+}
+
+void *ChunkedAllocator::allocateSlow(size_t size, size_t align) {
+  // Blocks are page aligned, so a new block never needs padding. The unused
+  // end of the current block doesn't count towards the budget.
+  size_t used = bytesUsed();
+  if (size > options_.budget - used) {
+    throw BudgetExceeded(options_.budget);
+  }
+  usedBefore_ = used;
+  if (nextBlock_ < blocks_.size() && blocks_[nextBlock_].size >= size) {
+    enterBlock(nextBlock_);
+  } else {
+    size_t blockSize = roundUp(std::max(options_.blockSize, size),
+                               options_.hugePages ? hugePageSize
+                                                  : sysconf(_SC_PAGESIZE));
+    void *data = mmap(nullptr, blockSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (options_.hugePages) {
+      madvise(data, blockSize, MADV_HUGEPAGE);
+    }
+    blocks_.insert(blocks_.begin() + nextBlock_,
+                   Block{static_cast<char *>(data), blockSize});
+    enterBlock(nextBlock_);
+  }
+  size_t pad = -reinterpret_cast<uintptr_t>(begin_) & (align - 1);
+  void *ptr = begin_ + pad;
+  begin_ += pad + size;
+  return ptr;
+}
+
+void ChunkedAllocator::reset() {
+  highWaterMark_ = highWaterMark();
+  for (size_t i = options_.retainedBlocks; i < nextBlock_; ++i) {
+    madvise(blocks_[i].begin, blocks_[i].size, MADV_DONTNEED);
+  }
+  nextBlock_ = 0;
+  blockBegin_ = begin_ = end_ = nullptr;
+  usedBefore_ = 0;
+}
+
+size_t ChunkedAllocator::bytesMapped() const {
+  size_t mapped = 0;
+  for (auto &block : blocks_) {
+    mapped += block.size;
+  }
+  return mapped;
+}
+
+} // namespace arena
+} // namespace lambcalc
\ No newline at end of file
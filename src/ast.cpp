@@ -1,9 +1,10 @@
 #include "ast.h"
+#include "pool.h"
 #include "utils.h"
 #include "visitor.h"
+#include <array>
 #include <concepts>
 #include <memory>
-#include <queue>
 #include <sstream>
 
 namespace lambcalc {
@@ -19,20 +20,32 @@ template <template <class> class Ptr> std::string Exp<Ptr>::dump() {
   return out.str();
 }
 
-struct DestructorVisitor
-    : WorklistVisitor<DefaultVisitor, DestructorTask<Exp<>>, std::queue> {};
+using Links = std::array<std::unique_ptr<Exp<>> *, 3>;
+
+// Child links of a node for destroyTree, which threads nodes through the
+// last child.
+static Links links(Exp<> &exp) {
+  return std::visit(
+      overloaded{[](IntExp &) { return Links{}; },
+                 [](VarExp &) { return Links{}; },
+                 [](LamExp<std::unique_ptr> &exp) { return Links{&exp.body}; },
+                 [](AppExp<std::unique_ptr> &exp) {
+                   return Links{&exp.arg, &exp.fn};
+                 },
+                 [](BopExp<std::unique_ptr> &exp) {
+                   return Links{&exp.arg2, &exp.arg1};
+                 },
+                 [](IfExp<std::unique_ptr> &exp) {
+                   return Links{&exp.els, &exp.cond, &exp.then};
+                 }},
+      exp);
+}
 
 template <template <class> class Ptr> Exp<Ptr>::~Exp() {
   if constexpr (std::same_as<Ptr<int>, std::unique_ptr<int>>) {
-    DestructorVisitor visitor;
-    auto &queue = visitor.getWorklist();
-    std::visit(visitor, *this);
-    while (!queue.empty()) {
-      auto task = std::move(queue.front());
-      queue.pop();
-
-      if (task.exp != nullptr) {
-        std::visit(visitor, *task.exp);
+    for (auto *link : links(*this)) {
+      if (link != nullptr) {
+        destroyTree(std::move(*link), links);
       }
     }
   }
@@ -40,6 +53,7 @@ template <template <class> class Ptr> Exp<Ptr>::~Exp() {
 
 template struct Exp<std::unique_ptr>;
 template struct Exp<raw_ptr>;
+template struct Exp<pool::index_ptr>;
 
 }; // namespace ast
 } // namespace lambcalc
\ No newline at end of file
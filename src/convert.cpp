@@ -1,6 +1,8 @@
 #include "convert.h"
+#include "analysis.h"
 #include "utils.h"
 #include "visitor.h"
+#include <algorithm>
 #include <cassert>
 #include <stack>
 
@@ -11,10 +13,10 @@ using namespace anf;
 using FreeVarsPipeline = WorklistVisitor<ExpValueVisitor<DefaultVisitor>,
                                          WorklistTask<Exp>, std::stack>;
 class FreeVarsVisitor : public FreeVarsPipeline {
-  std::set<Var> &freeVars_;
+  SymbolSet &freeVars_;
 
 public:
-  explicit FreeVarsVisitor(std::set<Var> &freeVars) : freeVars_(freeVars) {}
+  explicit FreeVarsVisitor(SymbolSet &freeVars) : freeVars_(freeVars) {}
   using FreeVarsPipeline::operator();
   using FreeVarsPipeline::addWorklist;
 
@@ -23,7 +25,7 @@ public:
                           [&]() { freeVars_.erase(name); });
     addWorklist(parentLink);
   }
-  void addWorklist(const std::vector<Var> &names,
+  void addWorklist(const Vars &names,
                    std::unique_ptr<Exp> *parentLink) override {
     getWorklist().emplace(std::in_place_index<1>, [&]() {
       for (auto &v : names) {
@@ -39,24 +41,43 @@ public:
   }
 };
 
+// Replaces an application with a projection of the function pointer out of
+// the closure and a call that passes the closure, once its rest is converted.
+struct RewriteApp {
+  AppExp *exp;
+  Var projName;
+  Values paramValues;
+  std::unique_ptr<Exp> *parentLink;
+};
+
+static const Symbol closurePrefix("closure");
+static const Symbol projPrefix("proj");
+
+class ClosureConvertVisitor;
 using ClosureConvertPipeline =
-    WorklistVisitor<DefaultVisitor, WorklistTask<Exp>, std::stack>;
+    StaticWorklistVisitor<ClosureConvertVisitor, DefaultVisitor,
+                          TypedTask<Exp, std::unique_ptr, RewriteApp>,
+                          ChunkedStack>;
 class ClosureConvertVisitor : public ClosureConvertPipeline {
   int counter_;
   std::unique_ptr<Exp> *parentLink_;
-  Var fresh(std::string_view prefix) {
-    return prefix.data() + std::to_string(counter_++);
-  }
+  const FunctionFreeVars &functionFreeVars_;
+  Var fresh(Symbol prefix) { return Symbol::fresh(prefix, counter_++); }
 
 public:
   using ClosureConvertPipeline::operator();
-  ClosureConvertVisitor() : counter_(0), parentLink_(nullptr) {}
-  void setParent(std::unique_ptr<Exp> *parentLink) { parentLink_ = parentLink; }
+  explicit ClosureConvertVisitor(const FunctionFreeVars &functionFreeVars)
+      : counter_(0), parentLink_(nullptr),
+        functionFreeVars_(functionFreeVars) {}
+  void visitTask(NodeTask<Exp> &task) {
+    parentLink_ = std::get<0>(task);
+    std::visit(*this, std::get<1>(task).get());
+  }
   void operator()(FunExp &exp) {
     assert(parentLink_ != nullptr &&
            "Expected FunExp to have a unique_ptr link");
-    auto freeVariables = freeVars(**parentLink_);
-    auto closureParam = fresh("closure");
+    const auto &freeVariables = functionFreeVars_.at(&exp);
+    auto closureParam = fresh(closurePrefix);
     exp.params.insert(exp.params.begin(), closureParam);
     auto body = std::move(exp.body);
     int i = 1;
@@ -65,37 +86,38 @@ public:
     }
     exp.body = std::move(body);
 
-    std::vector<Value> vars;
+    Values vars;
     vars.push_back(GlobValue{exp.name});
     for (auto var : freeVariables) {
       vars.push_back(VarValue{std::move(var)});
     }
-    exp.rest = make(TupleExp{exp.name, vars, std::move(exp.rest)});
+    exp.rest = make(TupleExp{exp.name, std::move(vars), std::move(exp.rest)});
     ClosureConvertPipeline::operator()(exp);
   }
   void operator()(AppExp &exp) {
     assert(parentLink_ != nullptr &&
            "Expected AppExp to have a unique_ptr link");
-    auto projName = fresh("proj");
+    auto projName = fresh(projPrefix);
     auto paramValues = std::move(exp.paramValues);
     paramValues.insert(paramValues.begin(), VarValue{exp.funName});
 
-    auto parentLink = parentLink_;
-    getWorklist().emplace(
-        std::in_place_index<1>,
-        [&exp, projName = std::move(projName),
-         paramValues = std::move(paramValues), parentLink]() {
-          auto appData = AppExp{std::move(exp.name), projName,
-                                std::move(paramValues), std::move(exp.rest)};
-          auto app = make(std::move(appData));
-          *parentLink = make(ProjExp{projName, exp.funName, 0, std::move(app)});
-        });
+    getWorklist().emplace(std::in_place_type<RewriteApp>, &exp, projName,
+                          std::move(paramValues), parentLink_);
     addWorklist(&exp.rest);
   }
+  void resume(RewriteApp &cont) {
+    AppExp &exp = *cont.exp;
+    auto app = make(AppExp{std::move(exp.name), cont.projName,
+                           std::move(cont.paramValues), std::move(exp.rest)});
+    *cont.parentLink =
+        make(ProjExp{cont.projName, exp.funName, 0, std::move(app)});
+  }
 };
 
-std::set<Var> freeVars(Exp &root) {
-  std::set<Var> freeVars;
+std::vector<Var> freeVars(Exp &root) {
+  // Reused between calls so that closure conversion doesn't allocate a bitset
+  // as large as the program for every function.
+  thread_local SymbolSet freeVars;
   FreeVarsVisitor visitor(freeVars);
   auto &worklist = visitor.getWorklist();
   std::visit(visitor, root);
@@ -109,25 +131,119 @@ std::set<Var> freeVars(Exp &root) {
                           [](FnTask &f) { std::move(f)(); }},
                task);
   }
-  return freeVars;
+  return freeVars.take();
+}
+
+void FunctionFreeVarsAnalysis::reserve(Symbol name) {
+  if (name.slot() >= levels_.size()) {
+    size_t size = std::max(name.slot() + 1, levels_.size() * 2);
+    levels_.resize(size, 0);
+    recorded_.resize(size, 0);
+  }
+}
+
+void FunctionFreeVarsAnalysis::bind(Symbol name) {
+  reserve(name);
+  levels_[name.slot()] = recorded_[name.slot()] = open_.size();
+}
+
+void FunctionFreeVarsAnalysis::use(Symbol name) {
+  reserve(name);
+  uint32_t depth = open_.size();
+  uint32_t &recorded = recorded_[name.slot()];
+  for (uint32_t i = std::max(levels_[name.slot()], recorded); i < depth; ++i) {
+    open_[i].freeVars.push_back(name);
+  }
+  recorded = std::max(recorded, depth);
+}
+
+void FunctionFreeVarsAnalysis::use(const Value &value) {
+  std::visit(overloaded{[](const IntValue &) {},
+                        [&](const VarValue &value) { use(value.var); },
+                        [&](const GlobValue &value) { use(value.glob); }},
+             value);
+}
+
+void FunctionFreeVarsAnalysis::enter(const HaltExp &exp) { use(exp.value); }
+
+void FunctionFreeVarsAnalysis::enter(const FunExp &exp) { bind(exp.name); }
+
+void FunctionFreeVarsAnalysis::enterBody(const FunExp &exp) {
+  open_.emplace_back(&exp, std::vector<Var>{});
+  for (auto param : exp.params) {
+    bind(param);
+  }
+}
+
+void FunctionFreeVarsAnalysis::leaveBody(const FunExp &) {
+  auto fun = std::move(open_.back());
+  open_.pop_back();
+  for (auto var : fun.freeVars) {
+    recorded_[var.slot()] = std::min<uint32_t>(recorded_[var.slot()],
+                                               open_.size());
+  }
+  std::ranges::sort(fun.freeVars);
+  result_.emplace(fun.fun, std::move(fun.freeVars));
+}
+
+void FunctionFreeVarsAnalysis::enter(const JoinExp &exp) {
+  if (exp.slot) {
+    bind(*exp.slot);
+  }
+  bind(exp.name);
+}
+
+void FunctionFreeVarsAnalysis::enter(const JumpExp &exp) {
+  if (exp.slotValue) {
+    use(*exp.slotValue);
+  }
+}
+
+void FunctionFreeVarsAnalysis::enter(const AppExp &exp) {
+  use(exp.funName);
+  for (auto &value : exp.paramValues) {
+    use(value);
+  }
+  bind(exp.name);
+}
+
+void FunctionFreeVarsAnalysis::enter(const BopExp &exp) {
+  use(exp.param1);
+  use(exp.param2);
+  bind(exp.name);
+}
+
+void FunctionFreeVarsAnalysis::enter(const IfExp &exp) { use(exp.cond); }
+
+void FunctionFreeVarsAnalysis::enter(const TupleExp &exp) {
+  for (auto &value : exp.values) {
+    use(value);
+  }
+  bind(exp.name);
+}
+
+void FunctionFreeVarsAnalysis::enter(const ProjExp &exp) {
+  use(exp.tuple);
+  bind(exp.name);
+}
+
+FunctionFreeVars functionFreeVars(const Exp &root) {
+  FunctionFreeVarsAnalysis analysis;
+  analyze(root, analysis);
+  return std::move(analysis.result());
 }
 
 std::unique_ptr<Exp> closureConvert(std::unique_ptr<Exp> &&start) {
-  ClosureConvertVisitor visitor;
-  auto &worklist = visitor.getWorklist();
+  auto freeVariables = functionFreeVars(*start);
+  return closureConvert(std::move(start), freeVariables);
+}
+
+std::unique_ptr<Exp> closureConvert(std::unique_ptr<Exp> &&start,
+                                    const FunctionFreeVars &freeVars) {
   auto root = std::move(start);
-  worklist.emplace(&root);
-  while (!worklist.empty()) {
-    auto task = std::move(worklist.top());
-    worklist.pop();
-    std::visit(overloaded{[&](const NodeTask<Exp> &n) {
-                            auto [parent, exp] = n;
-                            visitor.setParent(parent);
-                            std::visit(visitor, static_cast<Exp &>(exp));
-                          },
-                          [](FnTask &f) { std::move(f)(); }},
-               task);
-  }
+  ClosureConvertVisitor visitor(freeVars);
+  visitor.addWorklist(&root);
+  visitor.run();
   return root;
 }
 
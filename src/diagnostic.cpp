@@ -0,0 +1,30 @@
+#include "diagnostic.h"
+#include <algorithm>
+
+namespace lambcalc {
+
+void printDiagnostic(std::ostream &os, const Diagnostic &diagnostic,
+                     std::string_view source) {
+  if (!diagnostic.span) {
+    os << "error: " << diagnostic.message << std::endl;
+    return;
+  }
+  auto [begin, end] = *diagnostic.span;
+  if (begin > source.size()) {
+    os << begin << ": error: " << diagnostic.message << std::endl;
+    return;
+  }
+  size_t lineBegin = source.substr(0, begin).rfind('\n');
+  lineBegin = lineBegin == std::string_view::npos ? 0 : lineBegin + 1;
+  size_t lineEnd = std::min(source.find('\n', begin), source.size());
+  size_t line = std::count(source.begin(), source.begin() + begin, '\n') + 1;
+  size_t column = begin - lineBegin + 1;
+  os << line << ":" << column << ": error: " << diagnostic.message << std::endl;
+  os << source.substr(lineBegin, lineEnd - lineBegin) << std::endl;
+  os << std::string(begin - lineBegin, ' ') << '^'
+     << std::string(std::max(std::min(end, lineEnd), begin + 1) - begin - 1,
+                    '~')
+     << std::endl;
+}
+
+} // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,231 @@
+#include "hashcons.h"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace lambcalc {
+namespace hashcons {
+
+using Exp = ast::Exp<raw_ptr>;
+
+static size_t combine(size_t seed, size_t hash) {
+  return seed ^ (hash + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
+Allocator::Header &Allocator::header(const Exp *exp) {
+  auto bytes = reinterpret_cast<unsigned char *>(const_cast<Exp *>(exp));
+  return reinterpret_cast<Node *>(bytes - offsetof(Node, exp))->header;
+}
+
+std::span<const uint32_t> Allocator::freeVars(const Header &header) {
+  if (header.freeCount == 1) {
+    return {&header.freeVar, 1};
+  }
+  return {header.freeVars, header.freeCount};
+}
+
+// Sets the free variables of header to the union of those of parts. The
+// union is usually the free variables of one of the parts, which are shared
+// instead of copied.
+void Allocator::setFreeVars(Header &header,
+                            std::span<const Header *const> parts) {
+  scratch_.clear();
+  const Header *largest = nullptr;
+  for (const Header *part : parts) {
+    auto vars = freeVars(*part);
+    scratch_.insert(scratch_.end(), vars.begin(), vars.end());
+    if (largest == nullptr || part->freeCount > largest->freeCount) {
+      largest = part;
+    }
+  }
+  std::sort(scratch_.begin(), scratch_.end());
+  scratch_.erase(std::unique(scratch_.begin(), scratch_.end()),
+                 scratch_.end());
+  if (scratch_.size() == largest->freeCount) {
+    header.freeCount = largest->freeCount;
+    header.freeVar = largest->freeVar;
+    header.freeVars = largest->freeVars;
+    return;
+  }
+  uint32_t *vars = allocator_.allocate<uint32_t>(scratch_.size());
+  std::copy(scratch_.begin(), scratch_.end(), vars);
+  header.freeCount = scratch_.size();
+  header.freeVar = 0;
+  header.freeVars = vars;
+}
+
+// Sets the free variables of header to those of body without id.
+void Allocator::eraseFreeVar(Header &header, const Header &body, uint32_t id) {
+  auto vars = freeVars(body);
+  if (!std::binary_search(vars.begin(), vars.end(), id)) {
+    header.freeCount = body.freeCount;
+    header.freeVar = body.freeVar;
+    header.freeVars = body.freeVars;
+    return;
+  }
+  header.freeCount = body.freeCount - 1;
+  header.freeVar = 0;
+  header.freeVars = nullptr;
+  if (header.freeCount == 1) {
+    header.freeVar = vars[0] == id ? vars[1] : vars[0];
+  } else if (header.freeCount > 1) {
+    uint32_t *rest = allocator_.allocate<uint32_t>(header.freeCount);
+    std::remove_copy(vars.begin(), vars.end(), rest, id);
+    header.freeVars = rest;
+  }
+}
+
+void Allocator::analyze(Exp &exp) {
+  Header &info = header(&exp);
+  size_t seed = exp.index();
+  info.freeCount = 0;
+  info.renamed = 0;
+  info.freeVar = 0;
+  info.freeVars = nullptr;
+  std::visit(
+      overloaded{
+          [&](const ast::IntExp &exp) {
+            info.hash = combine(seed, std::hash<int>{}(exp.value));
+          },
+          [&](const ast::VarExp &exp) {
+            info.hash = combine(seed, std::hash<Symbol>{}(exp.name));
+            info.freeCount = 1;
+            info.freeVar = exp.name.id();
+          },
+          [&](const ast::LamExp<raw_ptr> &exp) {
+            const Header &body = header(exp.body);
+            info.hash = combine(combine(seed, std::hash<Symbol>{}(exp.param)),
+                                body.hash);
+            eraseFreeVar(info, body, exp.param.id());
+          },
+          [&](const ast::AppExp<raw_ptr> &exp) {
+            const Header *parts[] = {&header(exp.fn), &header(exp.arg)};
+            info.hash = combine(combine(seed, parts[0]->hash), parts[1]->hash);
+            setFreeVars(info, parts);
+          },
+          [&](const ast::BopExp<raw_ptr> &exp) {
+            const Header *parts[] = {&header(exp.arg1), &header(exp.arg2)};
+            seed = combine(seed, static_cast<size_t>(exp.bop));
+            info.hash = combine(combine(seed, parts[0]->hash), parts[1]->hash);
+            setFreeVars(info, parts);
+          },
+          [&](const ast::IfExp<raw_ptr> &exp) {
+            const Header *parts[] = {&header(exp.cond), &header(exp.then),
+                                     &header(exp.els)};
+            info.hash = combine(
+                combine(combine(seed, parts[0]->hash), parts[1]->hash),
+                parts[2]->hash);
+            setFreeVars(info, parts);
+          },
+      },
+      exp);
+}
+
+bool Allocator::NodeEqual::operator()(const Exp *a, const Exp *b) const {
+  return equal(*a, *b);
+}
+
+Exp *Allocator::allocate(ptrdiff_t n) {
+  // Nodes are preceded by their headers, so they can't be allocated as
+  // arrays.
+  if (n != 1) {
+    throw std::bad_array_new_length();
+  }
+  if (free_ != nullptr) {
+    return std::exchange(free_, nullptr);
+  }
+  return reinterpret_cast<Exp *>(allocator_.allocate<Node>()->exp);
+}
+
+Exp *Allocator::intern(Exp *exp) {
+  analyze(*exp);
+  if (header(exp).freeCount == 0) {
+    auto [it, inserted] = interned_.insert(exp);
+    if (!inserted) {
+      std::destroy_at(exp);
+      free_ = exp;
+      ++hits_;
+      return *it;
+    }
+  }
+  return exp;
+}
+
+void Allocator::reset() {
+  interned_.clear();
+  free_ = nullptr;
+  hits_ = 0;
+}
+
+bool Allocator::isInterned(const Exp *exp) const {
+  auto it = interned_.find(const_cast<Exp *>(exp));
+  return it != interned_.end() && *it == exp;
+}
+
+bool Allocator::markRenamed(Exp *exp) {
+  Header &info = header(exp);
+  if (info.freeCount != 0) {
+    return false;
+  }
+  bool renamed = info.renamed;
+  info.renamed = 1;
+  return renamed;
+}
+
+bool equal(const Exp &a, const Exp &b) {
+  std::vector<std::pair<const Exp *, const Exp *>> worklist{{&a, &b}};
+  while (!worklist.empty()) {
+    auto [x, y] = worklist.back();
+    worklist.pop_back();
+    if (x == y) {
+      continue;
+    }
+    if (x->index() != y->index()) {
+      return false;
+    }
+    bool same = std::visit(
+        overloaded{
+            [&](const ast::IntExp &exp) {
+              return exp.value == std::get<ast::IntExp>(*y).value;
+            },
+            [&](const ast::VarExp &exp) {
+              return exp.name == std::get<ast::VarExp>(*y).name;
+            },
+            [&](const ast::LamExp<raw_ptr> &exp) {
+              auto &other = std::get<ast::LamExp<raw_ptr>>(*y);
+              worklist.emplace_back(exp.body, other.body);
+              return exp.param == other.param;
+            },
+            [&](const ast::AppExp<raw_ptr> &exp) {
+              auto &other = std::get<ast::AppExp<raw_ptr>>(*y);
+              worklist.emplace_back(exp.fn, other.fn);
+              worklist.emplace_back(exp.arg, other.arg);
+              return true;
+            },
+            [&](const ast::BopExp<raw_ptr> &exp) {
+              auto &other = std::get<ast::BopExp<raw_ptr>>(*y);
+              worklist.emplace_back(exp.arg1, other.arg1);
+              worklist.emplace_back(exp.arg2, other.arg2);
+              return exp.bop == other.bop;
+            },
+            [&](const ast::IfExp<raw_ptr> &exp) {
+              auto &other = std::get<ast::IfExp<raw_ptr>>(*y);
+              worklist.emplace_back(exp.cond, other.cond);
+              worklist.emplace_back(exp.then, other.then);
+              worklist.emplace_back(exp.els, other.els);
+              return true;
+            },
+        },
+        *x);
+    if (!same) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace hashcons
+} // namespace lambcalc
\ No newline at end of file
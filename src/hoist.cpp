@@ -1,28 +1,58 @@
 #include "hoist.h"
 #include "utils.h"
 #include "visitor.h"
-#include <stack>
 
 namespace lambcalc {
 namespace anf {
 
-using HoistPipeline =
-    WorklistVisitor<DefaultVisitor, WorklistTask<Exp>, std::stack>;
+static const Symbol entryPrefix("entry");
+static const Symbol thenPrefix("then");
+static const Symbol elsePrefix("else");
+
+// Moves the rest of a function or join into its place once the rest is
+// hoisted.
+struct SpliceRest {
+  std::unique_ptr<Exp> *parentLink;
+  std::unique_ptr<Exp> *rest;
+};
+
+// Collects a function once its body is hoisted, along with the joins that
+// were hoisted out of its body.
+struct CollectFunction {
+  FunExp *exp;
+  std::vector<Join> savedJoins;
+};
+
+// Collects a join once its body is hoisted.
+struct CollectJoin {
+  JoinExp *exp;
+};
+
+// Moves the branches of an if into joins once they are hoisted.
+struct CollectBranches {
+  IfExp *exp;
+};
+
+class HoistVisitor;
+using HoistPipeline = StaticWorklistVisitor<
+    HoistVisitor, DefaultVisitor,
+    TypedTask<Exp, std::unique_ptr, SpliceRest, CollectFunction, CollectJoin,
+              CollectBranches>,
+    ChunkedStack>;
 class HoistVisitor : public HoistPipeline {
   int counter_;
   std::vector<Join> currentJoins_;
   std::vector<Function> collected_;
   std::unique_ptr<Exp> *parentLink_;
 
-  Var fresh(std::string_view prefix) {
-    return prefix.data() + std::to_string(counter_++);
-  }
+  Var fresh(Symbol prefix) { return Symbol::fresh(prefix, counter_++); }
 
 public:
   using HoistPipeline::operator();
   HoistVisitor() : counter_(0), parentLink_(nullptr) {}
-  void setParentLink(std::unique_ptr<Exp> *parentLink) {
-    parentLink_ = parentLink;
+  void visitTask(NodeTask<Exp> &task) {
+    parentLink_ = std::get<0>(task);
+    std::visit(*this, std::get<1>(task).get());
   }
   std::vector<Function> moveOutCollectedFunctions() {
     return std::move(collected_);
@@ -34,69 +64,62 @@ public:
     // the current joins into a function, then recurse into the rest.
     // NOTE: ordering is reversed since it is the order in which
     // tasks are pushed to the stack.
-    auto savedParentLink = parentLink_;
-    getWorklist().emplace(std::in_place_index<1>, [savedParentLink, &exp]() {
-      if (savedParentLink)
-        *savedParentLink = std::move(exp.rest);
-    });
+    getWorklist().emplace(std::in_place_type<SpliceRest>, parentLink_,
+                          &exp.rest);
     addWorklist(&exp.rest);
-    getWorklist().emplace(
-        std::in_place_index<1>,
-        [&, savedJoins = std::move(savedJoins)]() mutable {
-          Join entryBlock{fresh("entry"), std::nullopt, std::move(exp.body)};
-          collected_.emplace_back(std::move(exp.name), std::move(exp.params),
-                                  std::move(entryBlock),
-                                  std::move(currentJoins_));
-          currentJoins_ = std::move(savedJoins);
-        });
+    getWorklist().emplace(std::in_place_type<CollectFunction>, &exp,
+                          std::move(savedJoins));
     addWorklist(&exp.body);
   }
   void operator()(JoinExp &exp) {
-    auto savedParentLink = parentLink_;
-    getWorklist().emplace(std::in_place_index<1>, [savedParentLink, &exp]() {
-      if (savedParentLink)
-        *savedParentLink = std::move(exp.rest);
-    });
+    getWorklist().emplace(std::in_place_type<SpliceRest>, parentLink_,
+                          &exp.rest);
     addWorklist(&exp.rest);
-    getWorklist().emplace(std::in_place_index<1>, [&]() {
-      currentJoins_.emplace_back(std::move(exp.name), std::move(exp.slot),
-                                 std::move(exp.body));
-    });
+    getWorklist().emplace(std::in_place_type<CollectJoin>, &exp);
     addWorklist(&exp.body);
   }
   void operator()(IfExp &exp) {
-    getWorklist().emplace(std::in_place_index<1>, [&]() {
-      auto thenBlockName = fresh("then");
-      auto elseBlockName = fresh("else");
-      currentJoins_.emplace_back(thenBlockName, std::nullopt,
-                                 std::move(exp.thenBranch));
-      currentJoins_.emplace_back(elseBlockName, std::nullopt,
-                                 std::move(exp.elseBranch));
-      exp.thenBranch = make(JumpExp{thenBlockName, std::nullopt});
-      exp.elseBranch = make(JumpExp{elseBlockName, std::nullopt});
-    });
+    getWorklist().emplace(std::in_place_type<CollectBranches>, &exp);
     addWorklist(&exp.elseBranch);
     addWorklist(&exp.thenBranch);
   }
+
+  void resume(SpliceRest &cont) {
+    if (cont.parentLink) {
+      *cont.parentLink = std::move(*cont.rest);
+    }
+  }
+  void resume(CollectFunction &cont) {
+    FunExp &exp = *cont.exp;
+    Join entryBlock{fresh(entryPrefix), std::nullopt, std::move(exp.body)};
+    collected_.emplace_back(std::move(exp.name), std::move(exp.params),
+                            std::move(entryBlock), std::move(currentJoins_));
+    currentJoins_ = std::move(cont.savedJoins);
+  }
+  void resume(CollectJoin &cont) {
+    JoinExp &exp = *cont.exp;
+    currentJoins_.emplace_back(std::move(exp.name), std::move(exp.slot),
+                               std::move(exp.body));
+  }
+  void resume(CollectBranches &cont) {
+    IfExp &exp = *cont.exp;
+    auto thenBlockName = fresh(thenPrefix);
+    auto elseBlockName = fresh(elsePrefix);
+    currentJoins_.emplace_back(thenBlockName, std::nullopt,
+                               std::move(exp.thenBranch));
+    currentJoins_.emplace_back(elseBlockName, std::nullopt,
+                               std::move(exp.elseBranch));
+    exp.thenBranch = make(JumpExp{thenBlockName, std::nullopt});
+    exp.elseBranch = make(JumpExp{elseBlockName, std::nullopt});
+  }
 };
 
 std::vector<Function> hoist(std::unique_ptr<anf::Exp> &&start) {
   HoistVisitor visitor;
   auto root =
       make(FunExp{"main", {}, std::move(start), make(HaltExp{IntValue{0}})});
-  auto &worklist = visitor.getWorklist();
-  worklist.emplace(&root);
-  while (!worklist.empty()) {
-    auto task = std::move(worklist.top());
-    worklist.pop();
-    std::visit(overloaded{[&](const NodeTask<Exp> &n) {
-                            auto [parent, exp] = n;
-                            visitor.setParentLink(parent);
-                            std::visit(visitor, static_cast<Exp &>(exp));
-                          },
-                          [](FnTask &f) { std::move(f)(); }},
-               task);
-  }
+  visitor.addWorklist(&root);
+  visitor.run();
   return visitor.moveOutCollectedFunctions();
 }
 
@@ -3,18 +3,24 @@
 
 namespace lambcalc {
 
+int Lexer::get() {
+  ++position_;
+  return in_.get();
+}
+
 Token Lexer::getToken() {
   while (isspace(lastChar_)) {
-    lastChar_ = in_.get();
+    lastChar_ = get();
   }
+  tokenStart_ = position_ - 1;
   if (lastChar_ == '=' && in_.peek() == '>') {
-    in_.get();
-    lastChar_ = in_.get();
+    get();
+    lastChar_ = get();
     return Token::Arrow;
   }
   if (isalpha(lastChar_)) {
     identifier_.assign(1, lastChar_);
-    while (isalnum((lastChar_ = in_.get()))) {
+    while (isalnum((lastChar_ = get()))) {
       identifier_ += lastChar_;
     }
     if (identifier_ == "fn") {
@@ -38,7 +44,7 @@ Token Lexer::getToken() {
     std::string numStr;
     do {
       numStr += lastChar_;
-      lastChar_ = in_.get();
+      lastChar_ = get();
     } while (isdigit(lastChar_));
     numberValue_ = strtod(numStr.c_str(), 0);
     return Token::Number;
@@ -47,8 +53,86 @@ Token Lexer::getToken() {
     return Token::Eof;
   }
   Token token = static_cast<Token>(lastChar_);
-  lastChar_ = in_.get();
+  lastChar_ = get();
   return token;
 }
 
+Token keywordToken(std::string_view identifier) {
+  switch (identifier.size()) {
+  case 2:
+    if (identifier == "fn") {
+      return Token::Fn;
+    }
+    if (identifier == "if") {
+      return Token::If;
+    }
+    break;
+  case 4:
+    if (identifier == "then") {
+      return Token::Then;
+    }
+    if (identifier == "else") {
+      return Token::Else;
+    }
+    break;
+  }
+  return Token::Identifier;
+}
+
+std::string tokenName(Token token) {
+  switch (token) {
+  case Token::Eof:
+    return "end of input";
+  case Token::Number:
+    return "number";
+  case Token::Identifier:
+    return "identifier";
+  case Token::Fn:
+    return "'fn'";
+  case Token::Arrow:
+    return "'=>'";
+  case Token::If:
+    return "'if'";
+  case Token::Then:
+    return "'then'";
+  case Token::Else:
+    return "'else'";
+  default:
+    return std::string{'\'', static_cast<char>(token), '\''};
+  }
+}
+
+Token BufferLexer::getToken() {
+  while (cur_ != end_ && isspace(static_cast<unsigned char>(*cur_))) {
+    ++cur_;
+  }
+  tokenStart_ = cur_;
+  if (cur_ == end_) {
+    return Token::Eof;
+  }
+  unsigned char c = *cur_;
+  if (c == '=' && cur_ + 1 != end_ && cur_[1] == '>') {
+    cur_ += 2;
+    return Token::Arrow;
+  }
+  if (isalpha(c)) {
+    do {
+      ++cur_;
+    } while (cur_ != end_ && isalnum(static_cast<unsigned char>(*cur_)));
+    identifier_ = std::string_view(tokenStart_, cur_ - tokenStart_);
+    return keywordToken(identifier_);
+  }
+  if (isdigit(c)) {
+    unsigned value = 0;
+    do {
+      value = value * 10 + (*cur_ - '0');
+      ++cur_;
+    } while (cur_ != end_ && isdigit(static_cast<unsigned char>(*cur_)));
+    numberValue_ = static_cast<int>(value);
+    return Token::Number;
+  }
+  ++cur_;
+  return static_cast<Token>(c);
+}
+
 } // namespace lambcalc
\ No newline at end of file
@@ -1,13 +1,14 @@
 #include "lower.h"
+#include "threadpool.h"
 #include "utils.h"
 #include "visitor.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Verifier.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Scalar/Reassociate.h"
-#include "llvm/Transforms/Scalar/SimplifyCFG.h"
-#include "llvm/Transforms/Utils/Mem2Reg.h"
+#include "llvm/Support/ErrorHandling.h"
+#include <algorithm>
+#include <span>
 #include <stack>
 
 namespace lambcalc {
@@ -16,20 +17,71 @@ namespace lower {
 using namespace llvm;
 using namespace anf;
 
-template <typename T>
-llvm::FunctionType *getFunctionType(IRBuilder<> &builder,
-                                    const std::vector<T> &params) {
-  std::vector<Type *> tys;
-  for (size_t i = 0; i < params.size(); ++i) {
-    if (i == 0) {
-      tys.push_back(builder.getPtrTy());
-    } else {
-      tys.push_back(builder.getInt64Ty());
-    }
+// Functions take and return every value as a ptr, so closures and tuples stay
+// pointers through calls and environments. Integers are tagged offsets from
+// null. Only main returns an i64, which is what the driver expects.
+template <typename Range>
+llvm::FunctionType *getFunctionType(IRBuilder<> &builder, const Range &params,
+                                    Type *result) {
+  std::vector<Type *> tys(params.size(), builder.getPtrTy());
+  return llvm::FunctionType::get(result, tys, false);
+}
+
+// Returns the runtime function that gets the heap of the thread.
+static llvm::Function *getHeap(Module &module) {
+  if (auto heap = module.getFunction("lambcalc_heap")) {
+    return heap;
   }
-  return llvm::FunctionType::get(builder.getInt64Ty(), tys, false);
+  // The heap address only depends on the thread, so it can be reused across
+  // anything that doesn't touch the runtime's own memory.
+  auto heap = llvm::Function::Create(
+      FunctionType::get(PointerType::get(module.getContext(), 0), false),
+      llvm::GlobalValue::ExternalLinkage, "lambcalc_heap", module);
+  heap->addFnAttr(Attribute::NoUnwind);
+  heap->addFnAttr(Attribute::WillReturn);
+  heap->setMemoryEffects(MemoryEffects::inaccessibleMemOnly(ModRefInfo::Ref));
+  return heap;
 }
 
+// Returns the runtime function that collects when the heap of the thread is
+// full and then allocates. It aborts when it runs out of memory, so it isn't
+// willreturn.
+static llvm::Function *getAllocSlow(Module &module) {
+  if (auto slow = module.getFunction("lambcalc_alloc_slow")) {
+    return slow;
+  }
+  auto &ctx = module.getContext();
+  auto slow = llvm::Function::Create(
+      FunctionType::get(PointerType::get(ctx, 0), Type::getInt64Ty(ctx), false),
+      llvm::GlobalValue::ExternalLinkage, "lambcalc_alloc_slow", module);
+  slow->addFnAttr(Attribute::NoUnwind);
+  slow->addRetAttr(Attribute::NoAlias);
+  return slow;
+}
+
+// Maps symbols to LLVM values by symbol id.
+template <typename T> using SymbolMap = llvm::DenseMap<uint32_t, T>;
+
+// Shadow stack frame of the function being lowered. It is an array of ptrs
+// laid out as a runtime::Frame followed by a root for every value that may
+// point into the heap, so that the collector can find and move them.
+struct ShadowFrame {
+  llvm::AllocaInst *alloca = nullptr;
+  // The number of roots is only known once the function has been lowered.
+  llvm::StoreInst *clear = nullptr;
+  llvm::StoreInst *count = nullptr;
+  // The heap of the thread, which allocations bump, its frames field and the
+  // frame to restore it to when returning.
+  llvm::Value *heap = nullptr;
+  llvm::Value *frames = nullptr;
+  llvm::Value *prev = nullptr;
+  SymbolMap<uint32_t> roots;
+  // A collection may move everything, so a root is loaded again when it is
+  // used after a safepoint, or in a block that may come after one.
+  SymbolMap<uint64_t> loadedAt;
+  uint64_t epoch = 0;
+};
+
 using LLVMLowerPipeline =
     MatchIfJump<WorklistVisitor<ExpValueVisitor<DefaultVisitor>,
                                 WorklistTask<Exp>, std::stack>>;
@@ -38,39 +90,173 @@ class LLVMLowerVisitor : public LLVMLowerPipeline {
   Module &module_;
   IRBuilder<> &builder_;
   llvm::Value *value_;
-  llvm::StringMap<llvm::AllocaInst *> &spillSlots_;
-  llvm::StringMap<llvm::Value *> &namedValues_;
-  llvm::StringMap<llvm::BasicBlock *> &namedBlocks_;
+  // Phi node of the slot of every join that has one.
+  SymbolMap<llvm::PHINode *> &slots_;
+  SymbolMap<llvm::Value *> &namedValues_;
+  SymbolMap<llvm::BasicBlock *> &namedBlocks_;
+  ShadowFrame &frame_;
+  // The tagged or untagged form of the variables that were converted in the
+  // current block. Integers don't move, so a conversion stays valid across
+  // safepoints, but not in blocks that it doesn't dominate.
+  SymbolMap<llvm::Value *> converted_;
 
 public:
   LLVMLowerVisitor(LLVMContext &ctx, Module &module, IRBuilder<> &builder,
-                   llvm::StringMap<llvm::AllocaInst *> &spillSlots,
-                   llvm::StringMap<llvm::Value *> &namedValues,
-                   llvm::StringMap<llvm::BasicBlock *> &namedBlocks)
+                   SymbolMap<llvm::PHINode *> &slots,
+                   SymbolMap<llvm::Value *> &namedValues,
+                   SymbolMap<llvm::BasicBlock *> &namedBlocks,
+                   ShadowFrame &frame)
       : ctx_(ctx), module_(module), builder_(builder), value_(nullptr),
-        spillSlots_(spillSlots), namedValues_(namedValues),
-        namedBlocks_(namedBlocks) {}
+        slots_(slots), namedValues_(namedValues), namedBlocks_(namedBlocks),
+        frame_(frame) {}
+  // Integers stay i64 until they are used where any value can be. There they
+  // are tagged with a set low bit, which tells them apart from heap pointers.
+  llvm::Value *asInt(llvm::Value *value) {
+    if (value->getType()->isIntegerTy()) {
+      return value;
+    }
+    return builder_.CreateAShr(
+        builder_.CreatePtrToInt(value, builder_.getInt64Ty()), 1);
+  }
+  llvm::Value *asPtr(llvm::Value *value) {
+    if (value->getType()->isPointerTy()) {
+      return value;
+    }
+    auto tagged = builder_.CreateOr(builder_.CreateShl(value, 1), 1);
+    return builder_.CreateGEP(builder_.getInt8Ty(),
+                              ConstantPointerNull::get(builder_.getPtrTy()),
+                              tagged);
+  }
+  // Lowers value as an i64 or as a ptr, converting a variable at most once
+  // per block.
+  llvm::Value *lowerAs(Value &value, bool integer) {
+    auto var = std::get_if<VarValue>(&value);
+    if (var) {
+      auto converted = converted_.lookup(var->var.id());
+      if (converted && converted->getType()->isIntegerTy() == integer) {
+        return converted;
+      }
+    }
+    visitValue(value);
+    if (value_->getType()->isIntegerTy() == integer) {
+      return value_;
+    }
+    auto result = integer ? asInt(value_) : asPtr(value_);
+    if (var) {
+      converted_[var->var.id()] = result;
+    }
+    return result;
+  }
+  // Lowers a condition. A tagged integer is compared with a tagged zero
+  // instead of being untagged first.
+  llvm::Value *lowerCond(Value &value) {
+    auto var = std::get_if<VarValue>(&value);
+    auto converted = var ? converted_.lookup(var->var.id()) : nullptr;
+    llvm::Value *cond;
+    if (converted && converted->getType()->isIntegerTy()) {
+      cond = converted;
+    } else {
+      visitValue(value);
+      cond = value_;
+    }
+    auto zero = builder_.getInt64(0);
+    return builder_.CreateICmpNE(
+        cond, cond->getType()->isIntegerTy() ? zero : asPtr(zero));
+  }
+
+  llvm::Value *rootSlot(uint32_t root) {
+    return builder_.CreateGEP(builder_.getPtrTy(), frame_.alloca,
+                              {builder_.getInt64(root + 2)});
+  }
+  // Binds a value that may point into the heap, which gets a root if the
+  // function has a frame.
+  void defineRoot(const Var &var, llvm::Value *value) {
+    namedValues_[var.id()] = value;
+    if (frame_.alloca) {
+      uint32_t root = frame_.roots.size();
+      frame_.roots[var.id()] = root;
+      frame_.loadedAt[var.id()] = frame_.epoch;
+      builder_.CreateStore(value, rootSlot(root));
+    }
+  }
+  llvm::Value *lookup(const Var &var) {
+    auto root = frame_.roots.find(var.id());
+    if (root != frame_.roots.end() &&
+        frame_.loadedAt[var.id()] != frame_.epoch) {
+      namedValues_[var.id()] = builder_.CreateLoad(
+          builder_.getPtrTy(), rootSlot(root->second), var.str());
+      frame_.loadedAt[var.id()] = frame_.epoch;
+    }
+    return namedValues_.lookup(var.id());
+  }
+  void safepoint() { ++frame_.epoch; }
+  // Starts lowering a block, which may come after a safepoint and isn't
+  // dominated by the blocks lowered before it.
+  void startBlock() {
+    safepoint();
+    converted_.clear();
+  }
+
+  // Bumps the heap that the frame loaded, and only calls into the runtime to
+  // collect when it is full. The fast path is emitted at every allocation, so
+  // it needs no inlining even at O0.
+  llvm::Value *allocate(uint64_t size) {
+    assert(frame_.heap && "Functions that allocate have a frame");
+    auto ptrTy = builder_.getPtrTy();
+    auto sizeValue = builder_.getInt64(size);
+    auto next = builder_.CreateLoad(ptrTy, frame_.heap, "next");
+    auto endPtr =
+        builder_.CreateGEP(ptrTy, frame_.heap, {builder_.getInt64(1)});
+    auto end = builder_.CreateLoad(ptrTy, endPtr, "end");
+    auto bumped =
+        builder_.CreateGEP(builder_.getInt8Ty(), next, sizeValue, "bumped");
+    auto fits = builder_.CreateICmpULE(bumped, end, "fits");
+
+    auto current = builder_.GetInsertBlock();
+    auto fn = current->getParent();
+    auto before = current->getNextNode();
+    auto fast = BasicBlock::Create(ctx_, "fast", fn, before);
+    auto slow = BasicBlock::Create(ctx_, "slow", fn, before);
+    auto allocated = BasicBlock::Create(ctx_, "allocated", fn, before);
+    builder_.CreateCondBr(fits, fast, slow);
+    builder_.SetInsertPoint(fast);
+    builder_.CreateStore(bumped, frame_.heap);
+    builder_.CreateBr(allocated);
+    builder_.SetInsertPoint(slow);
+    auto refill =
+        builder_.CreateCall(getAllocSlow(module_), {sizeValue}, "refill");
+    builder_.CreateBr(allocated);
+    builder_.SetInsertPoint(allocated);
+    auto object = builder_.CreatePHI(ptrTy, 2);
+    object->addIncoming(next, fast);
+    object->addIncoming(refill, slow);
+    return object;
+  }
+
   void visitIntValue(IntValue &value) override {
     value_ = builder_.getInt64(value.value);
   }
-  void visitVarValue(VarValue &value) override {
-    value_ = namedValues_.lookup(value.var);
-  }
+  void visitVarValue(VarValue &value) override { value_ = lookup(value.var); }
   void visitGlobValue(GlobValue &value) override {
     llvm::Function *function;
     llvm::GlobalVariable *global;
-    if ((function = module_.getFunction(value.glob))) {
-      value_ = builder_.CreatePtrToInt(function, builder_.getInt64Ty());
-    } else if ((global = module_.getGlobalVariable(value.glob))) {
-      value_ = builder_.CreatePtrToInt(global, builder_.getInt64Ty());
+    if ((function = module_.getFunction(value.glob.str()))) {
+      value_ = function;
+    } else if ((global = module_.getGlobalVariable(value.glob.str()))) {
+      value_ = global;
     } else {
-      value_ = module_.getOrInsertGlobal(value.glob, builder_.getInt64Ty());
+      value_ = module_.getOrInsertGlobal(value.glob.str(), builder_.getPtrTy());
     }
   }
 
   void operator()(HaltExp &exp) {
-    visitValue(exp.value);
-    builder_.CreateRet(value_);
+    bool returnsInt =
+        builder_.GetInsertBlock()->getParent()->getReturnType()->isIntegerTy();
+    auto result = lowerAs(exp.value, returnsInt);
+    if (frame_.alloca) {
+      builder_.CreateStore(frame_.prev, frame_.frames);
+    }
+    builder_.CreateRet(result);
   }
   void operator()(FunExp &) {
     assert(false && "FunExp should have been removed by hoisting");
@@ -79,37 +265,35 @@ public:
     assert(false && "JoinExp should have been removed by hoisting");
   }
   void operator()(JumpExp &exp) {
-    auto block = namedBlocks_.lookup(exp.joinName);
+    auto block = namedBlocks_.lookup(exp.joinName.id());
     if (exp.slotValue) {
-      auto slot = spillSlots_[exp.joinName];
-      visitValue(*exp.slotValue);
-      builder_.CreateStore(value_, slot);
+      slots_[exp.joinName.id()]->addIncoming(lowerAs(*exp.slotValue, false),
+                                             builder_.GetInsertBlock());
     }
     builder_.CreateBr(block);
   }
   void operator()(AppExp &exp) {
     std::vector<llvm::Value *> params;
     for (auto &val : exp.paramValues) {
-      visitValue(val);
-      params.push_back(value_);
+      params.push_back(lowerAs(val, false));
     }
-    if (namedValues_.contains(exp.funName)) {
-      auto fty = getFunctionType(builder_, exp.paramValues);
-      auto fPtrTy = PointerType::get(fty, 0);
-      auto fnPtrInt = namedValues_[exp.funName];
-      auto fn = builder_.CreateIntToPtr(fnPtrInt, fPtrTy);
-      namedValues_[exp.name] = builder_.CreateCall(fty, fn, params, exp.name);
+    llvm::Value *result;
+    if (namedValues_.count(exp.funName.id())) {
+      auto fty =
+          getFunctionType(builder_, exp.paramValues, builder_.getPtrTy());
+      auto fn = lookup(exp.funName);
+      result = builder_.CreateCall(fty, fn, params, exp.name.str());
     } else {
-      auto fn = module_.getFunction(exp.funName);
-      namedValues_[exp.name] = builder_.CreateCall(fn, params, exp.name);
+      auto fn = module_.getFunction(exp.funName.str());
+      result = builder_.CreateCall(fn, params, exp.name.str());
     }
+    safepoint();
+    defineRoot(exp.name, result);
     return LLVMLowerPipeline::operator()(exp);
   }
   void operator()(BopExp &exp) {
-    visitValue(exp.param1);
-    auto param1 = value_;
-    visitValue(exp.param2);
-    auto param2 = value_;
+    auto param1 = lowerAs(exp.param1, true);
+    auto param2 = lowerAs(exp.param2, true);
     llvm::Instruction::BinaryOps bop;
     switch (exp.bop) {
     case ast::Bop::Plus:
@@ -122,51 +306,58 @@ public:
       bop = llvm::Instruction::BinaryOps::Mul;
       break;
     }
-    namedValues_[exp.name] =
-        builder_.CreateBinOp(bop, param1, param2, exp.name);
+    namedValues_[exp.name.id()] =
+        builder_.CreateBinOp(bop, param1, param2, exp.name.str());
     return LLVMLowerPipeline::operator()(exp);
   }
   void operator()(TupleExp &exp) {
-    auto mallocTy =
-        FunctionType::get(builder_.getPtrTy(), builder_.getInt64Ty(), false);
-    auto malloc = module_.getOrInsertFunction("malloc", mallocTy);
-    auto ptr = builder_.CreateCall(
-        malloc, {builder_.getInt64(exp.values.size() * 8)}, exp.name);
-    namedValues_[exp.name] =
-        builder_.CreatePtrToInt(ptr, builder_.getInt64Ty());
+    // The header holds the number of fields as a tagged integer, and the
+    // tuple points past it.
+    size_t fields = exp.values.size();
+    auto object = allocate((fields + 1) * 8);
+    safepoint();
+    builder_.CreateStore(builder_.getInt64(fields << 1 | 1), object);
+    auto ptr = builder_.CreateGEP(builder_.getPtrTy(), object,
+                                  {builder_.getInt64(1)}, exp.name.str());
+    defineRoot(exp.name, ptr);
     for (size_t i = 0; i < exp.values.size(); ++i) {
-      auto value = exp.values[i];
       // getElementPtr just returns the address based off of indexing the
       // pointer. That address can be used for a store instruction.
-      auto gep = builder_.CreateGEP(builder_.getInt64Ty(), ptr,
+      auto gep = builder_.CreateGEP(builder_.getPtrTy(), ptr,
                                     {builder_.getInt64(i)});
-      visitValue(value);
-      builder_.CreateStore(value_, gep);
+      builder_.CreateStore(lowerAs(exp.values[i], false), gep);
     }
     return LLVMLowerPipeline::operator()(exp);
   }
   void operator()(ProjExp &exp) {
-    auto tupleInt = namedValues_[exp.tuple];
-    auto tuplePtr = builder_.CreateIntToPtr(tupleInt, builder_.getPtrTy());
-    auto gep = builder_.CreateGEP(builder_.getInt64Ty(), tuplePtr,
+    auto tuple = lookup(exp.tuple);
+    auto gep = builder_.CreateGEP(builder_.getPtrTy(), tuple,
                                   {builder_.getInt64(exp.index)});
-    namedValues_[exp.name] =
-        builder_.CreateLoad(builder_.getInt64Ty(), gep, exp.name);
+    auto load = builder_.CreateLoad(builder_.getPtrTy(), gep, exp.name.str());
+    // The only tuples are closures, which start with their code pointer. The
+    // collector moves them and reuses their memory, so their slots aren't
+    // invariant.
+    if (exp.index == 0) {
+      // Code pointers are not in the heap, so they need no root.
+      load->setMetadata(LLVMContext::MD_nonnull, MDNode::get(ctx_, {}));
+      namedValues_[exp.name.id()] = load;
+    } else {
+      defineRoot(exp.name, load);
+    }
     return LLVMLowerPipeline::operator()(exp);
   }
   void operator()(IfExp &exp) { return LLVMLowerPipeline::operator()(exp); }
 
   void visitIfJump(IfExp &exp, JumpExp &thenJump, JumpExp &elseJump) override {
-    visitValue(exp.cond);
-    auto cond = builder_.CreateICmpNE(value_, builder_.getInt64(0));
-    if (thenJump.slotValue) {
-      builder_.CreateStore(value_, spillSlots_[thenJump.joinName]);
-    }
-    if (elseJump.slotValue) {
-      builder_.CreateStore(value_, spillSlots_[elseJump.joinName]);
+    auto cond = lowerCond(exp.cond);
+    for (JumpExp *jump : {&thenJump, &elseJump}) {
+      if (jump->slotValue) {
+        slots_[jump->joinName.id()]->addIncoming(
+            lowerAs(*jump->slotValue, false), builder_.GetInsertBlock());
+      }
     }
-    builder_.CreateCondBr(cond, namedBlocks_[thenJump.joinName],
-                          namedBlocks_[elseJump.joinName]);
+    builder_.CreateCondBr(cond, namedBlocks_[thenJump.joinName.id()],
+                          namedBlocks_[elseJump.joinName.id()]);
   }
 };
 
@@ -185,111 +376,318 @@ static void lowerBlock(LLVMLowerVisitor &visitor, Join &block) {
   }
 }
 
-// Context needs a global scope or else if it gets freed
-// it takes the module with it.
-std::unique_ptr<LLVMContext> ctx;
-std::unique_ptr<LoopAnalysisManager> lam;
-std::unique_ptr<FunctionPassManager> fpm;
-std::unique_ptr<FunctionAnalysisManager> fam;
-std::unique_ptr<CGSCCAnalysisManager> cgam;
-std::unique_ptr<ModuleAnalysisManager> mam;
-std::unique_ptr<PassInstrumentationCallbacks> pic;
-std::unique_ptr<StandardInstrumentations> si;
-
-std::unique_ptr<Module> initializeModuleAndManagers() {
-  ctx = std::make_unique<LLVMContext>();
-  fpm = std::make_unique<FunctionPassManager>();
-  lam = std::make_unique<LoopAnalysisManager>();
-  fam = std::make_unique<FunctionAnalysisManager>();
-  cgam = std::make_unique<CGSCCAnalysisManager>();
-  mam = std::make_unique<ModuleAnalysisManager>();
-  pic = std::make_unique<PassInstrumentationCallbacks>();
-  si = std::make_unique<StandardInstrumentations>(*ctx, true);
-  si->registerCallbacks(*pic, mam.get());
-
-  fpm->addPass(PromotePass());
-  fpm->addPass(InstCombinePass());
-  fpm->addPass(ReassociatePass());
-  fpm->addPass(GVNPass());
-  fpm->addPass(SimplifyCFGPass());
-
-  PassBuilder PB;
-  PB.registerModuleAnalyses(*mam);
-  PB.registerFunctionAnalyses(*fam);
-  PB.crossRegisterProxies(*lam, *fam, *cgam, *mam);
-
-  return std::make_unique<Module>("lambcalc program", *ctx);
+// Whether the function allocates or calls, either of which may collect.
+static bool hasSafepoint(Function &fn) {
+  std::vector<Exp *> stack = {fn.entryBlock.body.get()};
+  for (auto &block : fn.blocks) {
+    stack.push_back(block.body.get());
+  }
+  while (!stack.empty()) {
+    Exp *exp = stack.back();
+    stack.pop_back();
+    bool found = std::visit(
+        overloaded{[](AppExp &) { return true; },
+                   [](TupleExp &) { return true; },
+                   [&](BopExp &exp) {
+                     stack.push_back(exp.rest.get());
+                     return false;
+                   },
+                   [&](ProjExp &exp) {
+                     stack.push_back(exp.rest.get());
+                     return false;
+                   },
+                   [&](IfExp &exp) {
+                     stack.push_back(exp.thenBranch.get());
+                     stack.push_back(exp.elseBranch.get());
+                     return false;
+                   },
+                   [](auto &) { return false; }},
+        static_cast<Exp &>(*exp));
+    if (found) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Pushes a frame onto the shadow stack of the heap. Every root starts out
+// cleared, since the frame is scanned before all of them are defined.
+static void pushFrame(IRBuilder<> &builder, Module &module,
+                      ShadowFrame &frame) {
+  auto ptrTy = builder.getPtrTy();
+  frame.alloca =
+      builder.CreateAlloca(ArrayType::get(ptrTy, 2), nullptr, "frame");
+  frame.heap = builder.CreateCall(getHeap(module), {}, "heap");
+  frame.frames = builder.CreateGEP(ptrTy, frame.heap, {builder.getInt64(2)},
+                                   "frames");
+  frame.prev = builder.CreateLoad(ptrTy, frame.frames, "prev");
+  frame.clear = builder.CreateStore(
+      ConstantAggregateZero::get(frame.alloca->getAllocatedType()),
+      frame.alloca);
+  builder.CreateStore(frame.prev, frame.alloca);
+  frame.count = builder.CreateStore(
+      builder.getInt64(0),
+      builder.CreateGEP(ptrTy, frame.alloca, {builder.getInt64(1)}));
+  builder.CreateStore(frame.alloca, frame.frames);
+}
+
+// Sizes the frame for the roots that were defined.
+static void finishFrame(ShadowFrame &frame) {
+  auto &ctx = frame.alloca->getContext();
+  auto ty = ArrayType::get(PointerType::get(ctx, 0), frame.roots.size() + 2);
+  frame.alloca->setAllocatedType(ty);
+  frame.clear->setOperand(0, ConstantAggregateZero::get(ty));
+  frame.count->setOperand(
+      0, ConstantInt::get(Type::getInt64Ty(ctx), frame.roots.size()));
+}
+
+// Closure conversion passes every function its closure as the first
+// parameter, which points to an object in the heap. A collection may move the
+// object and reuse its memory while the function runs, so it is only noalias
+// and dereferenceable up to the last slot that is read when the function has
+// no safepoint. Its loads stay without !invariant.load either way, since that
+// would hold for the whole program.
+static void addClosureAttributes(LLVMContext &ctx, llvm::Argument &closure,
+                                 bool collects) {
+  uint64_t slots = 1;
+  bool captured = false;
+  for (auto user : closure.users()) {
+    auto gep = dyn_cast<GetElementPtrInst>(user);
+    if (!gep) {
+      captured = true;
+      continue;
+    }
+    if (auto index = dyn_cast<ConstantInt>(gep->getOperand(1))) {
+      slots = std::max(slots, index->getZExtValue() + 1);
+    }
+    captured |= !all_of(gep->users(),
+                        [](User *user) { return isa<LoadInst>(user); });
+  }
+  if (!collects) {
+    closure.addAttr(Attribute::NoAlias);
+  }
+  if (!captured) {
+    closure.addAttr(Attribute::NoCapture);
+  }
+  closure.addAttr(Attribute::NonNull);
+  closure.addAttr(Attribute::getWithAlignment(ctx, Align(8)));
+  if (!collects) {
+    closure.addAttr(Attribute::getWithDereferenceableBytes(ctx, slots * 8));
+  }
 }
 
-std::unique_ptr<Module> initializeModuleAndManagers(const DataLayout &layout) {
-  auto mod = initializeModuleAndManagers();
-  mod->setDataLayout(layout);
-  return mod;
+static void addFunctionAttributes(llvm::Function &fn, bool collects) {
+  // Nothing unwinds, but a function that calls another may not terminate,
+  // unless it is one that is known to return like lambcalc_heap.
+  fn.addFnAttr(Attribute::NoUnwind);
+  bool calls = any_of(instructions(fn), [](Instruction &inst) {
+    auto call = dyn_cast<CallInst>(&inst);
+    return call && (!call->getCalledFunction() ||
+                    !call->getCalledFunction()->willReturn());
+  });
+  if (!calls) {
+    fn.addFnAttr(Attribute::WillReturn);
+  }
+  if (fn.arg_size() > 0) {
+    addClosureAttributes(fn.getContext(), *fn.arg_begin(), collects);
+  }
 }
 
-void lowerModule(std::vector<Function> &&fns, Module &module) {
-  auto builder = std::make_unique<IRBuilder<>>(*ctx);
+// Declares every function of fns in module but only defines the ones in
+// defined, so that modules defining different functions can call each other.
+static void lowerFunctions(std::span<Function> fns,
+                           std::span<Function> defined, LLVMContext &ctx,
+                           IRBuilder<> &builder, Module &module) {
+  // Functions are only called from other modules when they are partitioned.
+  bool partitioned = defined.size() != fns.size();
   for (auto &fn : fns) {
+    bool isMain = fn.name.str() == "main";
     // getPtrTy() gets an opaque pointer, which is preferred for modern LLVM
     // than a typed pointer.
-    auto ty = getFunctionType(*builder, fn.params);
-    llvm::Function::Create(ty, llvm::GlobalValue::ExternalLinkage, fn.name,
-                           module);
+    auto ty = getFunctionType(builder, fn.params,
+                              isMain ? builder.getInt64Ty()
+                                     : builder.getPtrTy());
+    auto linkage = isMain || partitioned ? llvm::GlobalValue::ExternalLinkage
+                                          : llvm::GlobalValue::InternalLinkage;
+    llvm::Function::Create(ty, linkage, fn.name.str(), module);
   }
-  for (auto &fn : fns) {
-    StringMap<llvm::AllocaInst *> spillSlots;
-    StringMap<llvm::Value *> namedValues;
-    StringMap<llvm::BasicBlock *> namedBlocks;
-    LLVMLowerVisitor visitor(*ctx, module, *builder, spillSlots, namedValues,
-                             namedBlocks);
+  for (auto &fn : defined) {
+    SymbolMap<llvm::PHINode *> slots;
+    SymbolMap<llvm::Value *> namedValues;
+    SymbolMap<llvm::BasicBlock *> namedBlocks;
+    ShadowFrame frame;
+    LLVMLowerVisitor visitor(ctx, module, builder, slots, namedValues,
+                             namedBlocks, frame);
 
-    auto loweredFn = module.getFunction(fn.name);
+    auto loweredFn = module.getFunction(fn.name.str());
     auto loweredEntryBlock =
-        BasicBlock::Create(*ctx, fn.entryBlock.name, loweredFn);
-    namedBlocks[fn.entryBlock.name] = loweredEntryBlock;
-    builder->SetInsertPoint(loweredEntryBlock);
+        BasicBlock::Create(ctx, fn.entryBlock.name.str(), loweredFn);
+    namedBlocks[fn.entryBlock.name.id()] = loweredEntryBlock;
+    builder.SetInsertPoint(loweredEntryBlock);
     for (auto &block : fn.blocks) {
-      auto loweredBlock = BasicBlock::Create(*ctx, block.name, loweredFn);
-      namedBlocks[block.name] = loweredBlock;
-      // preprocess spill slots
+      auto loweredBlock = BasicBlock::Create(ctx, block.name.str(), loweredFn);
+      namedBlocks[block.name.id()] = loweredBlock;
+      // Jumps to the block add their slot values to the phi as they are
+      // lowered, so it has to exist first.
       if (block.slot) {
-        spillSlots[block.name] = builder->CreateAlloca(builder->getInt64Ty());
+        auto phi = PHINode::Create(builder.getPtrTy(), 2, block.slot->str(),
+                                   loweredBlock);
+        slots[block.name.id()] = phi;
+        namedValues[block.slot->id()] = phi;
       }
     }
+    // Functions that can't reach a collection don't need a frame.
+    if (hasSafepoint(fn)) {
+      pushFrame(builder, module, frame);
+    }
     size_t i = 0;
     for (auto &arg : loweredFn->args()) {
-      const std::string &param = fn.params[i++];
-      arg.setName(param);
-      namedValues[param] = &arg;
+      Symbol param = fn.params[i++];
+      arg.setName(param.str());
+      visitor.defineRoot(param, &arg);
     }
 
     lowerBlock(visitor, fn.entryBlock);
     for (auto &block : fn.blocks) {
-      auto loweredBlock = namedBlocks[block.name];
-      builder->SetInsertPoint(loweredBlock);
+      auto loweredBlock = namedBlocks[block.name.id()];
+      builder.SetInsertPoint(loweredBlock);
+      visitor.startBlock();
       if (block.slot) {
-        auto slot = spillSlots[block.name];
-        namedValues[*block.slot] =
-            builder->CreateLoad(builder->getInt64Ty(), slot, *block.slot);
+        visitor.defineRoot(*block.slot, slots[block.name.id()]);
       }
       lowerBlock(visitor, block);
     }
+    if (frame.alloca) {
+      finishFrame(frame);
+    }
+    addFunctionAttributes(*loweredFn, frame.alloca != nullptr);
     llvm::verifyFunction(*loweredFn);
   }
 }
 
-std::unique_ptr<Module> lower(std::vector<Function> &&fns) {
-  auto module = initializeModuleAndManagers();
-  lowerModule(std::move(fns), *module);
-  return module;
+static OptimizationLevel optimizationLevel(OptLevel level) {
+  switch (level) {
+  case OptLevel::O0:
+    return OptimizationLevel::O0;
+  case OptLevel::O1:
+    return OptimizationLevel::O1;
+  case OptLevel::O2:
+    return OptimizationLevel::O2;
+  case OptLevel::O3:
+    return OptimizationLevel::O3;
+  }
+  llvm_unreachable("Unknown optimization level");
+}
+
+CodeGenOptLevel codeGenOptLevel(OptLevel level) {
+  switch (level) {
+  case OptLevel::O0:
+    return CodeGenOptLevel::None;
+  case OptLevel::O1:
+    return CodeGenOptLevel::Less;
+  case OptLevel::O2:
+    return CodeGenOptLevel::Default;
+  case OptLevel::O3:
+    return CodeGenOptLevel::Aggressive;
+  }
+  llvm_unreachable("Unknown optimization level");
 }
 
-std::unique_ptr<Module> lower(std::vector<Function> &&fns,
-                              const DataLayout &layout) {
-  auto module = initializeModuleAndManagers(layout);
-  lowerModule(std::move(fns), *module);
+Session::Session(std::unique_ptr<TargetMachine> target,
+                 std::optional<DataLayout> layout, OptLevel level)
+    : target_(std::move(target)), layout_(std::move(layout)), level_(level),
+      ctx_(std::make_unique<LLVMContext>()), si_(*ctx_.getContext(), false),
+      builder_(*ctx_.getContext()) {
+  if (target_ && !layout_) {
+    layout_ = target_->createDataLayout();
+  }
+  si_.registerCallbacks(pic_, &mam_);
+
+  PassBuilder PB(target_.get(), PipelineTuningOptions(), std::nullopt, &pic_);
+  PB.registerModuleAnalyses(mam_);
+  PB.registerCGSCCAnalyses(cgam_);
+  PB.registerFunctionAnalyses(fam_);
+  PB.registerLoopAnalyses(lam_);
+  PB.crossRegisterProxies(lam_, fam_, cgam_, mam_);
+  // The O0 pipeline would only run the always-inliner.
+  if (level_ != OptLevel::O0) {
+    mpm_ = PB.buildPerModuleDefaultPipeline(optimizationLevel(level_));
+  }
+}
+
+Session::Session() : Session(nullptr, std::nullopt, OptLevel::O0) {}
+
+Session::Session(const DataLayout &layout, OptLevel level)
+    : Session(nullptr, layout, level) {}
+
+Session::Session(orc::JITTargetMachineBuilder builder, OptLevel level)
+    : Session(cantFail(builder.setCodeGenOptLevel(codeGenOptLevel(level))
+                           .createTargetMachine()),
+              std::nullopt, level) {}
+
+std::unique_ptr<Module> Session::lower(std::vector<Function> &&fns) {
+  return lower(fns, fns);
+}
+
+std::unique_ptr<Module> Session::lower(std::span<Function> fns,
+                                       std::span<Function> defined) {
+  // The JIT may be compiling an earlier module in the same context.
+  auto lock = ctx_.getLock();
+  auto &ctx = *ctx_.getContext();
+  auto module = std::make_unique<Module>("lambcalc program", ctx);
+  if (layout_) {
+    module->setDataLayout(*layout_);
+  }
+  lowerFunctions(fns, defined, ctx, builder_, *module);
+  builder_.ClearInsertionPoint();
+  if (level_ != OptLevel::O0) {
+    mpm_.run(*module, mam_);
+    // The cached results refer to the module, which is about to go away.
+    lam_.clear();
+    fam_.clear();
+    cgam_.clear();
+    mam_.clear();
+  }
   return module;
 }
 
+orc::ThreadSafeModule Session::share(std::unique_ptr<Module> module) {
+  return orc::ThreadSafeModule(std::move(module), ctx_);
+}
+
+std::vector<orc::ThreadSafeModule>
+lowerPartitioned(std::vector<Function> &&fns,
+                 std::span<const std::unique_ptr<Session>> sessions,
+                 ThreadPool &pool) {
+  // Cut the functions into contiguous ranges with about the same number of
+  // blocks. A range ends at the first function that reaches its share.
+  assert(!sessions.empty() && "Need a session per partition");
+  size_t partitions = sessions.size();
+  size_t total = 0;
+  for (auto &fn : fns) {
+    total += fn.blocks.size() + 1;
+  }
+  std::vector<size_t> bounds = {0};
+  size_t seen = 0;
+  for (size_t i = 0; i < fns.size(); ++i) {
+    seen += fns[i].blocks.size() + 1;
+    if (seen * partitions >= total * bounds.size()) {
+      bounds.push_back(i + 1);
+    }
+  }
+
+  std::vector<orc::ThreadSafeModule> modules(bounds.size() - 1);
+  TaskGroup group(pool);
+  for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+    group.spawn([&, i] {
+      std::span<Function> defined(fns.begin() + bounds[i],
+                                  fns.begin() + bounds[i + 1]);
+      modules[i] = sessions[i]->share(sessions[i]->lower(fns, defined));
+    });
+  }
+  group.wait();
+  return modules;
+}
+
 } // namespace lower
 } // namespace lambcalc
\ No newline at end of file
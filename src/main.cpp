@@ -1,51 +1,92 @@
 #include "KaleidoscopeJIT.h"
+#include "analysis.h"
 #include "anf.h"
 #include "arena.h"
 #include "ast.h"
 #include "convert.h"
+#include "diagnostic.h"
 #include "hoist.h"
 #include "lower.h"
 #include "parser.h"
-#include "rename.h"
+#include "runtime.h"
+#include "source.h"
+#include "symbol.h"
+#include "threadpool.h"
+#include "tokenize.h"
 #include "utils.h"
 #include "llvm/Support/TargetSelect.h"
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
 
 using namespace lambcalc;
 
 static llvm::ExitOnError ExitOnErr;
 
 constexpr bool LAMBCALC_DEBUG = false;
+// Maximum bytes of AST that a single expression can allocate.
+constexpr size_t ARENA_BUDGET = 1 << 28;
 
-const std::unordered_map<ast::Bop, std::optional<std::pair<int, int>>>
-    defaultInfixBp{{ast::Bop::Plus, {{1, 2}}},
-                   {ast::Bop::Minus, {{1, 2}}},
-                   {ast::Bop::Times, {{3, 4}}}};
+struct Options {
+  // Converts large expressions to ANF and lowers them on the pool's threads.
+  ThreadPool *pool = nullptr;
+  lower::OptLevel level = lower::OptLevel::O0;
+  // Reports how long compiling and running every expression takes.
+  bool time = false;
+};
 
-int main() {
-  alignas(alignof(ast::Exp<raw_ptr>)) static char buf[1 << 28];
-  char *ptr = std::launder(buf);
-  arena::Allocator allocator(ptr, ptr + sizeof(buf) / sizeof(*buf));
-  arena::TypedAllocator<ast::Exp<raw_ptr>> typedAllocator(allocator);
-
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::InitializeNativeTargetAsmParser();
-
-  std::unique_ptr<llvm::orc::KaleidoscopeJIT> jit =
-      ExitOnErr(llvm::orc::KaleidoscopeJIT::Create());
-  Lexer lexer(std::cin);
-  Parser<raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>>> parser(
-      typedAllocator, lexer, defaultInfixBp);
+// Evaluates every expression, reporting the malformed ones and going on with
+// the next. source is used to show where errors are and may be empty.
+// Returns the number of errors.
+template <typename L>
+static size_t run(llvm::orc::KaleidoscopeJIT &jit,
+                  arena::ChunkedAllocator &allocator, L &lexer,
+                  bool interactive, const Options &options,
+                  std::string_view source = {}) {
+  ThreadPool *pool = options.pool;
+  using Allocator =
+      arena::TypedAllocator<ast::Exp<raw_ptr>, arena::ChunkedAllocator>;
+  Allocator typedAllocator(allocator);
+  IterativeParser<raw_ptr, Allocator, L> parser(typedAllocator, lexer);
+  // The ANF IR of an expression is freed all at once before the next one.
+  // Parallel conversion allocates on the threads of the pool instead.
+  anf::NodeArena nodeArena;
+  std::optional<anf::NodeArena::Scope> nodeArenaScope;
+  if (pool == nullptr) {
+    nodeArenaScope.emplace(nodeArena);
+  }
+  // Lowering state is set up once and reused for every expression, with a
+  // session per thread of the pool.
+  lower::Session session(jit.getTargetMachineBuilder(), options.level);
+  std::vector<std::unique_ptr<lower::Session>> sessions;
+  for (size_t i = 0; pool && i < pool->size(); ++i) {
+    sessions.push_back(std::make_unique<lower::Session>(
+        jit.getTargetMachineBuilder(), options.level));
+  }
+  size_t errors = 0;
+  auto report = [&](const Diagnostic &diagnostic) {
+    printDiagnostic(std::cerr, diagnostic, source);
+    ++errors;
+  };
   while (true) {
     allocator.reset();
+    nodeArena.reset();
+    // Fresh names are numbered from zero again for every expression, so
+    // tables indexed by symbol don't grow over a session.
+    anf::resetCounter();
+    Symbol::resetFresh();
     // If a peek token is already buffered, consume it.
     if (parser.getPeekToken() && *parser.getPeekToken() == Token::Semicolon) {
       parser.nextToken();
       continue;
     }
-    std::cout << "> ";
+    if (interactive) {
+      std::cout << "> ";
+    }
     ast::Exp<raw_ptr> *exp;
     try {
       // If it reads a semicolon token at the start, go back to
@@ -53,29 +94,52 @@ int main() {
       if (parser.peekToken() == Token::Semicolon) {
         continue;
       }
-      exp = parser.parseExpression();
-    } catch (ParserException &e) {
-      std::cerr << e.what() << std::endl;
-      if (e.abort()) {
+      if (parser.peekToken() == Token::Eof) {
         break;
-      } else {
+      }
+      auto parsed = parser.tryParseExpression();
+      if (!parsed) {
+        report(parsed.error());
+        if (parser.getCurrentToken() == Token::Eof) {
+          break;
+        }
+        parser.recover();
         continue;
       }
+      exp = *parsed;
+    } catch (arena::BudgetExceeded &e) {
+      std::cerr << e.what() << std::endl;
+      // The rest of the expression can't be skipped when reading a file.
+      if (!interactive) {
+        break;
+      }
+      continue;
     }
     if constexpr (LAMBCALC_DEBUG) {
       std::cout << *exp << std::endl;
+      std::cout << "AST bytes: " << allocator.bytesUsed()
+                << " (high water mark: " << allocator.highWaterMark() << ")"
+                << std::endl;
     }
-    try {
-      ast::rename(*exp);
-    } catch (ast::NotInScopeException &e) {
-      std::cerr << e.what() << std::endl;
+    auto converted =
+        pool ? anf::tryConvertDefunc(*exp, anf::Scoping::Fused, *pool)
+             : anf::tryConvertDefunc(*exp, anf::Scoping::Fused);
+    if (!converted) {
+      report(converted.error());
       continue;
     }
+    auto anf = std::move(*converted);
+    // Analyses of the ANF tree share a single traversal. Statistics are
+    // only gathered when they are printed.
+    convert::FunctionFreeVarsAnalysis freeVars;
     if constexpr (LAMBCALC_DEBUG) {
-      std::cout << "After renaming: " << *exp << std::endl;
+      anf::Statistics stats;
+      anf::analyze(*anf, freeVars, stats);
+      std::cout << stats << std::endl;
+    } else {
+      anf::analyze(*anf, freeVars);
     }
-    auto anf = anf::convertDefunc(*exp);
-    auto convert = convert::closureConvert(std::move(anf));
+    auto convert = convert::closureConvert(std::move(anf), freeVars.result());
     if constexpr (LAMBCALC_DEBUG) {
       std::cout << *convert << std::endl;
     }
@@ -104,20 +168,116 @@ int main() {
         std::cout << std::endl;
       }
     }
-    auto mod = lower::lower(std::move(hoisted), jit->getDataLayout());
-    if constexpr (LAMBCALC_DEBUG) {
-      mod->dump();
+    auto compileStart = std::chrono::steady_clock::now();
+    auto rt = jit.getMainJITDylib().createResourceTracker();
+    if (pool) {
+      // Lower a module per thread, all of which go into the same JITDylib.
+      auto modules =
+          lower::lowerPartitioned(std::move(hoisted), sessions, *pool);
+      for (auto &tsm : modules) {
+        if constexpr (LAMBCALC_DEBUG) {
+          tsm.withModuleDo([](llvm::Module &mod) { mod.dump(); });
+        }
+        ExitOnErr(jit.addModule(std::move(tsm), rt));
+      }
+    } else {
+      auto mod = session.lower(std::move(hoisted));
+      if constexpr (LAMBCALC_DEBUG) {
+        mod->dump();
+      }
+      ExitOnErr(jit.addModule(session.share(std::move(mod)), rt));
     }
 
-    auto rt = jit->getMainJITDylib().createResourceTracker();
-    auto tsm =
-        llvm::orc::ThreadSafeModule(std::move(mod), std::move(lower::ctx));
-    ExitOnErr(jit->addModule(std::move(tsm), rt));
-
-    auto exprSymbol = ExitOnErr(jit->lookup("main"));
+    // Looking main up compiles the modules to machine code.
+    auto exprSymbol = ExitOnErr(jit.lookup("main"));
     int (*FP)() = exprSymbol.getAddress().toPtr<int (*)()>();
-    std::cout << "Evaluated to: " << FP() << std::endl;
+    auto runStart = std::chrono::steady_clock::now();
+    int result = FP();
+    auto runEnd = std::chrono::steady_clock::now();
+    std::cout << "Evaluated to: " << result << std::endl;
+    if (options.time) {
+      using Millis = std::chrono::duration<double, std::milli>;
+      std::cerr << "-O" << static_cast<int>(options.level) << ": compiled in "
+                << Millis(runStart - compileStart).count() << " ms, ran in "
+                << Millis(runEnd - runStart).count() << " ms" << std::endl;
+      auto gc = runtime::stats();
+      std::cerr << "gc: " << gc.collections << " collections, max pause "
+                << Millis(gc.maxPause).count() << " ms, heap "
+                << gc.heapSize << " bytes" << std::endl;
+    }
     ExitOnErr(rt->remove());
+    // Nothing the evaluation allocated can be reached anymore.
+    runtime::reset();
+  }
+  return errors;
+}
+
+int main(int argc, char **argv) {
+  arena::ChunkedAllocator allocator({.budget = ARENA_BUDGET});
+  // Usage: lambcalc [-jN] [-O0|-O1|-O2|-O3] [-heap=N] [-pause=N] [-time]
+  // [file], where -jN compiles on N threads, -heap=N starts the garbage
+  // collected heap at N bytes and -pause=N grows it when a collection takes
+  // longer than N microseconds.
+  Options options;
+  runtime::Options gcOptions;
+  const char *file = nullptr;
+  size_t jobs = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.starts_with("-j")) {
+      jobs = std::strtoul(argv[i] + 2, nullptr, 10);
+    } else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' &&
+               arg[2] <= '3') {
+      options.level = static_cast<lower::OptLevel>(arg[2] - '0');
+    } else if (arg.starts_with("-heap=")) {
+      gcOptions.heapSize = std::strtoull(argv[i] + 6, nullptr, 10);
+    } else if (arg.starts_with("-pause=")) {
+      gcOptions.pauseTarget =
+          std::chrono::microseconds(std::strtoll(argv[i] + 7, nullptr, 10));
+    } else if (arg == "-time") {
+      options.time = true;
+    } else if (arg.starts_with("-")) {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return 1;
+    } else {
+      file = argv[i];
+    }
+  }
+  // Evaluation runs on this thread, so its heap is the one to configure.
+  runtime::configure(gcOptions);
+  std::unique_ptr<ThreadPool> pool;
+  if (jobs > 1) {
+    pool = std::make_unique<ThreadPool>(jobs);
+    options.pool = pool.get();
+  }
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+
+  std::unique_ptr<llvm::orc::KaleidoscopeJIT> jit =
+      ExitOnErr(llvm::orc::KaleidoscopeJIT::Create(
+          lower::codeGenOptLevel(options.level)));
+  ExitOnErr(jit->addSymbols({
+      {"lambcalc_heap", reinterpret_cast<void *>(&runtime::lambcalc_heap)},
+      {"lambcalc_alloc_slow",
+       reinterpret_cast<void *>(&runtime::lambcalc_alloc_slow)},
+  }));
+  if (file != nullptr) {
+    // Programs given as files are tokenized up front straight out of the
+    // mapped file.
+    SourceBuffer source = SourceBuffer::fromFile(file);
+    TokenArray tokens = tokenize(source.view());
+    TokenArrayLexer lexer(source.view(), tokens);
+    size_t errors = run(*jit, allocator, lexer, false, options, source.view());
+    if (errors > 0) {
+      std::cerr << errors << (errors == 1 ? " error" : " errors")
+                << std::endl;
+      return 1;
+    }
+  } else {
+    Lexer lexer(std::cin);
+    run(*jit, allocator, lexer, true, options);
   }
   return 0;
 }
\ No newline at end of file
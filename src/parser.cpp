@@ -1,8 +1,12 @@
 #include "parser.h"
 #include "arena.h"
+#include "hashcons.h"
+#include "pool.h"
+#include "tokenize.h"
 #include "utils.h"
-#include <cassert>
 #include <memory>
+#include <variant>
+#include <vector>
 
 namespace lambcalc {
 
@@ -19,44 +23,65 @@ static std::optional<ast::Bop> parseOp(const Token &token) {
   }
 }
 
-template <template <class> class Ptr, typename Allocator>
-Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parseFn() {
+template <template <class> class Ptr, typename Allocator, typename L>
+Expected<Ptr<ast::Exp<Ptr>>> Parser<Ptr, Allocator, L>::parseFn() {
   nextToken();
-  assert(getCurrentToken() == Token::Identifier &&
-         "Expected variable parameter");
-  auto param = lexer_.getIdentifier();
+  if (getCurrentToken() != Token::Identifier) {
+    return this->expectError("function parameter");
+  }
+  Symbol param(lexer_.getIdentifier());
   nextToken();
-  assert(getCurrentToken() == Token::Arrow &&
-         "Expected arrow after function parameter");
-  auto body = parseExpression();
-  return make(ast::LamExp<Ptr>{std::move(param), std::move(body)});
+  if (getCurrentToken() != Token::Arrow) {
+    return this->expectError("'=>' after function parameter");
+  }
+  auto body = tryParseExpression();
+  if (!body) {
+    return body;
+  }
+  return make(ast::LamExp<Ptr>{std::move(param), std::move(*body)});
 }
 
-template <template <class> class Ptr, typename Allocator>
-Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parseIf() {
-  auto cond = parseExpression();
+template <template <class> class Ptr, typename Allocator, typename L>
+Expected<Ptr<ast::Exp<Ptr>>> Parser<Ptr, Allocator, L>::parseIf() {
+  auto cond = tryParseExpression();
+  if (!cond) {
+    return cond;
+  }
   nextToken();
-  assert(getCurrentToken() == Token::Then &&
-         "Expected then after if condition");
-  auto then = parseExpression();
+  if (getCurrentToken() != Token::Then) {
+    return this->expectError("'then' after if condition");
+  }
+  auto then = tryParseExpression();
+  if (!then) {
+    return then;
+  }
   nextToken();
-  assert(getCurrentToken() == Token::Else &&
-         "Expected else after then expression");
-  auto els = parseExpression();
-  return make(
-      ast::IfExp<Ptr>{std::move(cond), std::move(then), std::move(els)});
+  if (getCurrentToken() != Token::Else) {
+    return this->expectError("'else' after then expression");
+  }
+  auto els = tryParseExpression();
+  if (!els) {
+    return els;
+  }
+  return make(ast::IfExp<Ptr>{std::move(*cond), std::move(*then),
+                              std::move(*els)});
 }
 
-template <template <class> class Ptr, typename Allocator>
-Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parseParens() {
-  auto exp = parseExpression();
+template <template <class> class Ptr, typename Allocator, typename L>
+Expected<Ptr<ast::Exp<Ptr>>> Parser<Ptr, Allocator, L>::parseParens() {
+  auto exp = tryParseExpression();
+  if (!exp) {
+    return exp;
+  }
   nextToken();
-  assert(getCurrentToken() == Token::RParen && "Expected right parenthesis");
+  if (getCurrentToken() != Token::RParen) {
+    return this->expectError("')'");
+  }
   return exp;
 }
 
-template <template <class> class Ptr, typename Allocator>
-Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parsePrimary() {
+template <template <class> class Ptr, typename Allocator, typename L>
+Expected<Ptr<ast::Exp<Ptr>>> Parser<Ptr, Allocator, L>::parsePrimary() {
   switch (getCurrentToken()) {
   case Token::LParen:
     return parseParens();
@@ -67,20 +92,21 @@ Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parsePrimary() {
   case Token::If:
     return parseIf();
   case Token::Identifier:
-    return make(ast::VarExp{lexer_.getIdentifier()});
+    return make(ast::VarExp{Symbol(lexer_.getIdentifier())});
   default:
-    throw ParserException(
-        "Invalid token: " + std::to_string(static_cast<int>(getCurrentToken())),
-        getCurrentToken() == Token::Eof);
+    return this->expectError("an expression");
   }
 }
 
 constexpr int baseBP = 0;
 
-template <template <class> class Ptr, typename Allocator>
-Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parseBinOp(int minBP) {
+template <template <class> class Ptr, typename Allocator, typename L>
+Expected<Ptr<ast::Exp<Ptr>>> Parser<Ptr, Allocator, L>::parseBinOp(int minBP) {
   nextToken();
-  Ptr<ast::Exp<Ptr>> lhs = parsePrimary();
+  auto lhs = parsePrimary();
+  if (!lhs) {
+    return lhs;
+  }
 
   int appLbp = 100, appRbp = 101;
   while (true) {
@@ -96,7 +122,11 @@ Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parseBinOp(int minBP) {
 
         nextToken();
         auto rhs = parseBinOp(rbp);
-        lhs = make(ast::BopExp<Ptr>{*bop, std::move(lhs), std::move(rhs)});
+        if (!rhs) {
+          return rhs;
+        }
+        lhs = make(
+            ast::BopExp<Ptr>{*bop, std::move(*lhs), std::move(*rhs)});
       } else {
         return lhs;
       }
@@ -108,19 +138,267 @@ Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parseBinOp(int minBP) {
       }
 
       auto rhs = parseBinOp(appRbp);
-      lhs = make(ast::AppExp<Ptr>{std::move(lhs), std::move(rhs)});
+      if (!rhs) {
+        return rhs;
+      }
+      lhs = make(ast::AppExp<Ptr>{std::move(*lhs), std::move(*rhs)});
     } else {
       return lhs;
     }
   }
 }
 
-template <template <class> class Ptr, typename Allocator>
-Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator>::parseExpression() {
+template <template <class> class Ptr, typename Allocator, typename L>
+Ptr<ast::Exp<Ptr>> Parser<Ptr, Allocator, L>::parseExpression() {
+  return this->orThrow(tryParseExpression());
+}
+
+template <template <class> class Ptr, typename Allocator, typename L>
+Expected<Ptr<ast::Exp<Ptr>>> Parser<Ptr, Allocator, L>::tryParseExpression() {
   return parseBinOp(baseBP);
 }
 
+template <template <class> class Ptr> struct BinOpFrame {
+  int minBP;
+  Ptr<ast::Exp<Ptr>> lhs;
+  // Operator waiting for its right hand side, or nullopt for application.
+  std::optional<ast::Bop> bop;
+};
+
+struct ParensFrame {};
+
+struct FnFrame {
+  Symbol param;
+};
+
+template <template <class> class Ptr> struct IfFrame {
+  Ptr<ast::Exp<Ptr>> cond;
+  Ptr<ast::Exp<Ptr>> then;
+};
+
+template <template <class> class Ptr>
+using ParseFrame =
+    std::variant<BinOpFrame<Ptr>, ParensFrame, FnFrame, IfFrame<Ptr>>;
+
+constexpr BindingPower appBP{100, 101};
+
+template <template <class> class Ptr, typename Allocator, typename L,
+          InfixBpTable InfixBp>
+Ptr<ast::Exp<Ptr>>
+IterativeParser<Ptr, Allocator, L, InfixBp>::parseExpression() {
+  return this->orThrow(tryParseExpression());
+}
+
+template <template <class> class Ptr, typename Allocator, typename L,
+          InfixBpTable InfixBp>
+Expected<Ptr<ast::Exp<Ptr>>>
+IterativeParser<Ptr, Allocator, L, InfixBp>::tryParseExpression() {
+  // Each frame stands for a call to the recursive parser that is waiting for
+  // a subexpression. The subexpression is passed back in result.
+  std::vector<ParseFrame<Ptr>> stack;
+  Ptr<ast::Exp<Ptr>> result{};
+  int minBP = baseBP;
+
+  enum { BIN_OP, PRIMARY, RETURN } dispatch = BIN_OP;
+
+  while (true) {
+    switch (dispatch) {
+    case BIN_OP:
+      stack.emplace_back(std::in_place_type<BinOpFrame<Ptr>>, minBP);
+      this->nextToken();
+      dispatch = PRIMARY;
+      break;
+    case PRIMARY:
+      switch (this->getCurrentToken()) {
+      case Token::LParen:
+        stack.emplace_back(std::in_place_type<ParensFrame>);
+        minBP = baseBP;
+        dispatch = BIN_OP;
+        break;
+      case Token::Number:
+        result = this->make(ast::IntExp{this->lexer_.getNumber()});
+        dispatch = RETURN;
+        break;
+      case Token::Fn: {
+        this->nextToken();
+        if (this->getCurrentToken() != Token::Identifier) {
+          return this->expectError("function parameter");
+        }
+        Symbol param(this->lexer_.getIdentifier());
+        this->nextToken();
+        if (this->getCurrentToken() != Token::Arrow) {
+          return this->expectError("'=>' after function parameter");
+        }
+        stack.emplace_back(std::in_place_type<FnFrame>, std::move(param));
+        minBP = baseBP;
+        dispatch = BIN_OP;
+        break;
+      }
+      case Token::If:
+        stack.emplace_back(std::in_place_type<IfFrame<Ptr>>);
+        minBP = baseBP;
+        dispatch = BIN_OP;
+        break;
+      case Token::Identifier:
+        result = this->make(ast::VarExp{Symbol(this->lexer_.getIdentifier())});
+        dispatch = RETURN;
+        break;
+      default:
+        return this->expectError("an expression");
+      }
+      break;
+    case RETURN: {
+      if (stack.empty()) {
+        return result;
+      }
+      // What the frame expected instead of the current token.
+      const char *error = nullptr;
+      bool pop = std::visit(
+          overloaded{
+              [&](BinOpFrame<Ptr> &frame) {
+                if (frame.lhs == nullptr) {
+                  frame.lhs = std::move(result);
+                } else if (frame.bop) {
+                  frame.lhs = this->make(ast::BopExp<Ptr>{
+                      *frame.bop, std::move(frame.lhs), std::move(result)});
+                } else {
+                  frame.lhs = this->make(ast::AppExp<Ptr>{std::move(frame.lhs),
+                                                          std::move(result)});
+                }
+
+                Token token = this->peekToken();
+                std::optional<ast::Bop> bop;
+                if ((bop = parseOp(token))) {
+                  constexpr auto bp = [](ast::Bop bop) {
+                    return InfixBp[static_cast<size_t>(bop)];
+                  };
+                  if (!bp(*bop).infix() || bp(*bop).lbp < frame.minBP) {
+                    result = std::move(frame.lhs);
+                    return true;
+                  }
+                  this->nextToken();
+                  frame.bop = bop;
+                  minBP = bp(*bop).rbp;
+                } else if (token == Token::LParen || token == Token::Number ||
+                           token == Token::Identifier) {
+                  // If lookahead is '(', variable, or number, apply function
+                  // application.
+                  if (appBP.lbp < frame.minBP) {
+                    result = std::move(frame.lhs);
+                    return true;
+                  }
+                  frame.bop = std::nullopt;
+                  minBP = appBP.rbp;
+                } else {
+                  result = std::move(frame.lhs);
+                  return true;
+                }
+                dispatch = BIN_OP;
+                return false;
+              },
+              [&](ParensFrame &) {
+                this->nextToken();
+                if (this->getCurrentToken() != Token::RParen) {
+                  error = "')'";
+                }
+                return true;
+              },
+              [&](FnFrame &frame) {
+                result = this->make(ast::LamExp<Ptr>{std::move(frame.param),
+                                                     std::move(result)});
+                return true;
+              },
+              [&](IfFrame<Ptr> &frame) {
+                if (frame.cond == nullptr) {
+                  frame.cond = std::move(result);
+                  this->nextToken();
+                  if (this->getCurrentToken() != Token::Then) {
+                    error = "'then' after if condition";
+                  }
+                } else if (frame.then == nullptr) {
+                  frame.then = std::move(result);
+                  this->nextToken();
+                  if (this->getCurrentToken() != Token::Else) {
+                    error = "'else' after then expression";
+                  }
+                } else {
+                  result = this->make(ast::IfExp<Ptr>{std::move(frame.cond),
+                                                      std::move(frame.then),
+                                                      std::move(result)});
+                  return true;
+                }
+                minBP = baseBP;
+                dispatch = BIN_OP;
+                return false;
+              },
+          },
+          stack.back());
+      if (error) {
+        return this->expectError(error);
+      }
+      if (pop) {
+        stack.pop_back();
+      }
+      break;
+    }
+    }
+  }
+}
+
 template class Parser<std::unique_ptr, std::allocator<ast::Exp<>>>;
 template class Parser<raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>>>;
+template class Parser<std::unique_ptr, std::allocator<ast::Exp<>>,
+                      BufferLexer>;
+template class Parser<raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>>,
+                      BufferLexer>;
+template class Parser<std::unique_ptr, std::allocator<ast::Exp<>>,
+                      TokenArrayLexer>;
+template class Parser<raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>>,
+                      TokenArrayLexer>;
+template class Parser<
+    raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>, arena::ChunkedAllocator>>;
+template class Parser<
+    raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>, arena::ChunkedAllocator>,
+    BufferLexer>;
+template class Parser<
+    raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>, arena::ChunkedAllocator>,
+    TokenArrayLexer>;
+template class Parser<raw_ptr, hashcons::Allocator>;
+template class Parser<raw_ptr, hashcons::Allocator, BufferLexer>;
+template class Parser<raw_ptr, hashcons::Allocator, TokenArrayLexer>;
+template class Parser<pool::index_ptr, pool::TypedAllocator<ast::PoolExp>>;
+template class Parser<pool::index_ptr, pool::TypedAllocator<ast::PoolExp>,
+                      BufferLexer>;
+template class Parser<pool::index_ptr, pool::TypedAllocator<ast::PoolExp>,
+                      TokenArrayLexer>;
+
+template class IterativeParser<std::unique_ptr, std::allocator<ast::Exp<>>>;
+template class IterativeParser<raw_ptr,
+                               arena::TypedAllocator<ast::Exp<raw_ptr>>>;
+template class IterativeParser<std::unique_ptr, std::allocator<ast::Exp<>>,
+                               BufferLexer>;
+template class IterativeParser<
+    raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>>, BufferLexer>;
+template class IterativeParser<std::unique_ptr, std::allocator<ast::Exp<>>,
+                               TokenArrayLexer>;
+template class IterativeParser<
+    raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>>, TokenArrayLexer>;
+template class IterativeParser<
+    raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>, arena::ChunkedAllocator>>;
+template class IterativeParser<
+    raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>, arena::ChunkedAllocator>,
+    BufferLexer>;
+template class IterativeParser<
+    raw_ptr, arena::TypedAllocator<ast::Exp<raw_ptr>, arena::ChunkedAllocator>,
+    TokenArrayLexer>;
+template class IterativeParser<raw_ptr, hashcons::Allocator>;
+template class IterativeParser<raw_ptr, hashcons::Allocator, BufferLexer>;
+template class IterativeParser<raw_ptr, hashcons::Allocator, TokenArrayLexer>;
+template class IterativeParser<pool::index_ptr,
+                               pool::TypedAllocator<ast::PoolExp>>;
+template class IterativeParser<pool::index_ptr,
+                               pool::TypedAllocator<ast::PoolExp>, BufferLexer>;
+template class IterativeParser<
+    pool::index_ptr, pool::TypedAllocator<ast::PoolExp>, TokenArrayLexer>;
 
 } // namespace lambcalc
\ No newline at end of file
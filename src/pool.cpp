@@ -0,0 +1,64 @@
+#include "pool.h"
+#include "utils.h"
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace lambcalc {
+namespace ast {
+
+using pool::index_ptr;
+
+pool::index_ptr<PoolExp> compact(pool::NodePool<PoolExp> &dest,
+                                  const PoolExp &root) {
+  assert(&dest != &pool::NodePool<PoolExp>::current() &&
+         "Can't compact a tree into its own pool");
+  // Links in dest nodes must stay valid until they are filled in.
+  dest.reserve(dest.size() + pool::NodePool<PoolExp>::current().size());
+
+  // Pairs of a link to fill in with the copy of a node and the node to copy.
+  std::vector<std::pair<index_ptr<PoolExp> *, const PoolExp *>> stack;
+  index_ptr<PoolExp> result;
+  stack.emplace_back(&result, &root);
+  while (!stack.empty()) {
+    auto [link, exp] = stack.back();
+    stack.pop_back();
+
+    uint32_t index = dest.allocate();
+    *link = index_ptr<PoolExp>::fromIndex(index);
+    PoolExp &copy = dest[index];
+    // Children are pushed in reverse so that the first one is copied next.
+    auto push = [&](index_ptr<PoolExp> &link, index_ptr<PoolExp> child) {
+      stack.emplace_back(&link, &*child);
+    };
+    std::visit(overloaded{
+                   [&](const IntExp &exp) { copy.emplace<IntExp>(exp); },
+                   [&](const VarExp &exp) { copy.emplace<VarExp>(exp); },
+                   [&](const LamExp<index_ptr> &exp) {
+                     auto &lam = copy.emplace<LamExp<index_ptr>>(exp.param);
+                     push(lam.body, exp.body);
+                   },
+                   [&](const AppExp<index_ptr> &exp) {
+                     auto &app = copy.emplace<AppExp<index_ptr>>();
+                     push(app.arg, exp.arg);
+                     push(app.fn, exp.fn);
+                   },
+                   [&](const BopExp<index_ptr> &exp) {
+                     auto &bop = copy.emplace<BopExp<index_ptr>>(exp.bop);
+                     push(bop.arg2, exp.arg2);
+                     push(bop.arg1, exp.arg1);
+                   },
+                   [&](const IfExp<index_ptr> &exp) {
+                     auto &ifExp = copy.emplace<IfExp<index_ptr>>();
+                     push(ifExp.els, exp.els);
+                     push(ifExp.then, exp.then);
+                     push(ifExp.cond, exp.cond);
+                   },
+               },
+               *exp);
+  }
+  return result;
+}
+
+} // namespace ast
+} // namespace lambcalc
\ No newline at end of file
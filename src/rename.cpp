@@ -1,74 +1,224 @@
 #include "rename.h"
+#include "hashcons.h"
+#include "pool.h"
 #include "utils.h"
 #include "visitor.h"
+#include <algorithm>
+#include <optional>
 #include <stack>
+#include <type_traits>
+#include <vector>
 
 namespace lambcalc {
 namespace ast {
 
+// Leaves the scope of a lambda, restoring the renaming its parameter shadowed.
+struct RestoreRenaming {
+  Symbol param;
+  std::optional<Symbol> shadowed;
+};
+
+template <template <class> class Ptr> class AlphaRenameVisitor;
 template <template <class> class Ptr>
 using AlphaRenamePipeline =
-    WorklistVisitor<DefaultVisitor, WorklistTask<Exp<Ptr>, Ptr>, std::stack,
-                    Ptr>;
+    StaticWorklistVisitor<AlphaRenameVisitor<Ptr>, DefaultVisitor,
+                          TypedTask<Exp<Ptr>, Ptr, RestoreRenaming>,
+                          ChunkedStack, Ptr>;
 template <template <class> class Ptr>
 class AlphaRenameVisitor : public AlphaRenamePipeline<Ptr> {
   int counter_;
-  std::unordered_map<std::string, std::string> rename_;
+  // Current renaming of every symbol, indexed by symbol slot.
+  std::vector<std::optional<Symbol>> rename_;
+  // Allocator of a hash-consed tree, whose shared subtrees are closed, so
+  // they are renamed the first time they are reached and left alone after.
+  hashcons::Allocator *shared_;
 
-  std::string fresh(std::string_view name) {
-    return name.data() + std::to_string(counter_++);
+  Symbol fresh(Symbol name) { return Symbol::fresh(name, counter_++); }
+  std::optional<Symbol> &renamed(Symbol name) {
+    if (name.slot() >= rename_.size()) {
+      rename_.resize(std::max(name.slot() + 1, rename_.size() * 2));
+    }
+    return rename_[name.slot()];
   }
 
 public:
-  AlphaRenameVisitor() : counter_(0) {}
+  explicit AlphaRenameVisitor(hashcons::Allocator *shared = nullptr)
+      : counter_(0), shared_(shared) {}
   using AlphaRenamePipeline<Ptr>::operator();
   using AlphaRenamePipeline<Ptr>::getWorklist;
+  void visit(Exp<Ptr> &exp) {
+    // Only trees of raw pointers can be hash-consed. The lambda is marked
+    // through the node that holds it.
+    if constexpr (std::is_same_v<Ptr<Exp<Ptr>>, raw_ptr<Exp<Ptr>>>) {
+      if (shared_ != nullptr && std::holds_alternative<LamExp<Ptr>>(exp) &&
+          shared_->markRenamed(&exp)) {
+        return;
+      }
+    }
+    std::visit(*this, exp);
+  }
+  void visitTask(NodeTask<Exp<Ptr>, Ptr> &task) {
+    visit(std::get<1>(task).get());
+  }
   void operator()(LamExp<Ptr> &exp) {
-    auto renamed = fresh(exp.param);
-    std::optional<std::string> oldRenameParam =
-        rename_.contains(exp.param) ? std::optional{rename_[exp.param]}
-                                    : std::nullopt;
-    rename_[exp.param] = renamed;
-    auto oldExpParam = std::move(exp.param);
-    exp.param = std::move(renamed);
-    getWorklist().emplace(std::in_place_index<1>,
-                          [&, expParam = std::move(oldExpParam),
-                           oldParam = std::move(oldRenameParam)]() {
-                            if (oldParam) {
-                              rename_[expParam] = *oldParam;
-                            } else {
-                              rename_.erase(expParam);
-                            }
-                          });
+    Symbol param = exp.param;
+    getWorklist().emplace(std::in_place_type<RestoreRenaming>, param,
+                          renamed(param));
+    exp.param = fresh(param);
+    renamed(param) = exp.param;
     AlphaRenamePipeline<Ptr>::operator()(exp);
   }
   void operator()(VarExp &exp) {
-    if (rename_.contains(exp.name)) {
-      exp.name = rename_[exp.name];
+    if (auto name = renamed(exp.name)) {
+      exp.name = *name;
     } else {
       throw NotInScopeException(exp.name);
     }
   }
+  void resume(const RestoreRenaming &cont) {
+    renamed(cont.param) = cont.shadowed;
+  }
 };
 
 template <template <class> class Ptr> void rename(ast::Exp<Ptr> &exp) {
   AlphaRenameVisitor<Ptr> visitor;
-  auto &worklist = visitor.getWorklist();
+  visitor.visit(exp);
+  visitor.run();
+}
+
+void rename(ast::Exp<raw_ptr> &exp, hashcons::Allocator &shared) {
+  AlphaRenameVisitor<raw_ptr> visitor(&shared);
+  visitor.visit(exp);
+  visitor.run();
+}
+
+template void rename(ast::Exp<std::unique_ptr> &);
+template void rename(ast::Exp<raw_ptr> &);
+template void rename(ast::Exp<pool::index_ptr> &);
+
+// Leaves the scope of a lambda, restoring the binder its parameter shadowed.
+struct LeaveLam {
+  Symbol param;
+  int shadowedLevel;
+};
+
+template <template <class> class Ptr> class ResolveVisitor;
+template <template <class> class Ptr>
+using ResolvePipeline =
+    StaticWorklistVisitor<ResolveVisitor<Ptr>, DefaultVisitor,
+                          TypedTask<Exp<Ptr>, Ptr, LeaveLam>, ChunkedStack,
+                          Ptr>;
+template <template <class> class Ptr>
+class ResolveVisitor : public ResolvePipeline<Ptr> {
+  // Number of enclosing lambdas.
+  int depth_;
+  // Level of the innermost binder of every symbol, indexed by symbol slot, or
+  // -1 if the symbol isn't bound.
+  std::vector<int> levels_;
+
+  int &level(Symbol name) {
+    if (name.slot() >= levels_.size()) {
+      levels_.resize(std::max(name.slot() + 1, levels_.size() * 2), -1);
+    }
+    return levels_[name.slot()];
+  }
+
+public:
+  ResolveVisitor() : depth_(0) {}
+  using ResolvePipeline<Ptr>::operator();
+  using ResolvePipeline<Ptr>::getWorklist;
+  void operator()(LamExp<Ptr> &exp) {
+    getWorklist().emplace(std::in_place_type<LeaveLam>, exp.param,
+                          level(exp.param));
+    level(exp.param) = depth_++;
+    ResolvePipeline<Ptr>::operator()(exp);
+  }
+  void operator()(VarExp &exp) {
+    int binderLevel = level(exp.name);
+    if (binderLevel < 0) {
+      throw NotInScopeException(exp.name);
+    }
+    exp.index = depth_ - 1 - binderLevel;
+  }
+  void resume(const LeaveLam &cont) {
+    level(cont.param) = cont.shadowedLevel;
+    --depth_;
+  }
+};
+
+template <template <class> class Ptr> void resolve(ast::Exp<Ptr> &exp) {
+  ResolveVisitor<Ptr> visitor;
   std::visit(visitor, exp);
+  visitor.run();
+}
+
+template void resolve(ast::Exp<std::unique_ptr> &);
+template void resolve(ast::Exp<raw_ptr> &);
+template void resolve(ast::Exp<pool::index_ptr> &);
+
+template <template <class> class Ptr>
+bool alphaEquivalent(const ast::Exp<Ptr> &a, const ast::Exp<Ptr> &b) {
+  std::stack<std::pair<const Exp<Ptr> *, const Exp<Ptr> *>> worklist;
+  worklist.emplace(&a, &b);
   while (!worklist.empty()) {
-    auto task = std::move(worklist.top());
+    auto [x, y] = worklist.top();
     worklist.pop();
-    std::visit(overloaded{[&](NodeTask<Exp<Ptr>, Ptr> &n) {
-                            Exp<Ptr> &exp = std::get<1>(n);
-                            std::visit(visitor, exp);
-                          },
-                          [](FnTask &f) { std::move(f)(); }},
-               task);
+    if (x == y) {
+      continue;
+    }
+    if (x->index() != y->index()) {
+      return false;
+    }
+    bool equal = std::visit(
+        overloaded{
+            [&](const IntExp &exp) {
+              return exp.value == std::get<IntExp>(*y).value;
+            },
+            [&](const VarExp &exp) {
+              const auto &other = std::get<VarExp>(*y);
+              if (exp.index < 0 || other.index < 0) {
+                return exp.index == other.index && exp.name == other.name;
+              }
+              return exp.index == other.index;
+            },
+            [&](const LamExp<Ptr> &exp) {
+              worklist.emplace(&*exp.body, &*std::get<LamExp<Ptr>>(*y).body);
+              return true;
+            },
+            [&](const AppExp<Ptr> &exp) {
+              const auto &other = std::get<AppExp<Ptr>>(*y);
+              worklist.emplace(&*exp.fn, &*other.fn);
+              worklist.emplace(&*exp.arg, &*other.arg);
+              return true;
+            },
+            [&](const BopExp<Ptr> &exp) {
+              const auto &other = std::get<BopExp<Ptr>>(*y);
+              worklist.emplace(&*exp.arg1, &*other.arg1);
+              worklist.emplace(&*exp.arg2, &*other.arg2);
+              return exp.bop == other.bop;
+            },
+            [&](const IfExp<Ptr> &exp) {
+              const auto &other = std::get<IfExp<Ptr>>(*y);
+              worklist.emplace(&*exp.cond, &*other.cond);
+              worklist.emplace(&*exp.then, &*other.then);
+              worklist.emplace(&*exp.els, &*other.els);
+              return true;
+            },
+        },
+        *x);
+    if (!equal) {
+      return false;
+    }
   }
+  return true;
 }
 
-template void rename(ast::Exp<std::unique_ptr> &);
-template void rename(ast::Exp<raw_ptr> &);
+template bool alphaEquivalent(const ast::Exp<std::unique_ptr> &,
+                              const ast::Exp<std::unique_ptr> &);
+template bool alphaEquivalent(const ast::Exp<raw_ptr> &,
+                              const ast::Exp<raw_ptr> &);
+template bool alphaEquivalent(const ast::Exp<pool::index_ptr> &,
+                              const ast::Exp<pool::index_ptr> &);
 
 } // namespace ast
 } // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "runtime.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace lambcalc {
+namespace runtime {
+
+namespace {
+
+struct Space {
+  char *begin = nullptr;
+  size_t size = 0;
+};
+
+// Heap that lowered code allocates from. It is constant initialized, so
+// lambcalc_heap only computes its address and never runs the lazy
+// initialization of a thread_local.
+constinit thread_local Heap currentHeap = {nullptr, nullptr, nullptr};
+
+struct ThreadHeap {
+  Heap &heap = currentHeap;
+  Options options;
+  Stats stats;
+  // Size of the space that the next collection copies into.
+  size_t spaceSize = Options().heapSize;
+  Space space;
+  // The space that was collected last, which is kept to copy into next.
+  Space spare;
+
+  ~ThreadHeap() {
+    unmap(space);
+    unmap(spare);
+  }
+
+  static void unmap(Space &space) {
+    if (space.begin != nullptr) {
+      munmap(space.begin, space.size);
+    }
+    space = Space();
+  }
+};
+
+thread_local ThreadHeap threadHeap;
+
+size_t roundToPages(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+Space map(size_t size) {
+  size = roundToPages(size);
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    std::cerr << "lambcalc: out of memory" << std::endl;
+    std::abort();
+  }
+  return Space{static_cast<char *>(data), size};
+}
+
+// Cheney's algorithm: the roots are copied first, and then the copied objects
+// are scanned in order for the objects they point to, which are copied after
+// them. Returns the bytes copied.
+size_t copy(ThreadHeap &t, Space to) {
+  auto from = reinterpret_cast<uintptr_t>(t.space.begin);
+  auto fromEnd = reinterpret_cast<uintptr_t>(t.heap.next);
+  char *free = to.begin;
+  auto forward = [&](void *&slot) {
+    auto value = reinterpret_cast<uintptr_t>(slot);
+    if ((value & 1) || value < from || value >= fromEnd) {
+      return;
+    }
+    auto header = reinterpret_cast<uint64_t *>(value) - 1;
+    // A moved object's header is replaced with its new address, which is
+    // never tagged.
+    if ((*header & 1) == 0) {
+      slot = reinterpret_cast<void *>(*header);
+      return;
+    }
+    size_t bytes = ((*header >> 1) + 1) * sizeof(void *);
+    std::memcpy(free, header, bytes);
+    slot = free + sizeof(void *);
+    *header = reinterpret_cast<uintptr_t>(slot);
+    free += bytes;
+  };
+
+  for (Frame *frame = t.heap.frames; frame != nullptr; frame = frame->prev) {
+    auto roots = reinterpret_cast<void **>(frame + 1);
+    for (uint64_t i = 0; i < frame->count; ++i) {
+      forward(roots[i]);
+    }
+  }
+  for (char *scan = to.begin; scan < free;) {
+    size_t fields = *reinterpret_cast<uint64_t *>(scan) >> 1;
+    auto object = reinterpret_cast<void **>(scan) + 1;
+    for (size_t i = 1; i < fields; ++i) {
+      forward(object[i]);
+    }
+    scan += (fields + 1) * sizeof(void *);
+  }
+  return free - to.begin;
+}
+
+// Collects the heap into a space with room for at least size more bytes.
+void collect(ThreadHeap &t, size_t size) {
+  auto start = std::chrono::steady_clock::now();
+  // Everything that was allocated may still be live.
+  size_t used = t.heap.next - t.space.begin;
+  size_t toSize = std::max(t.spaceSize, used + size);
+  Space to;
+  if (t.spare.size >= toSize) {
+    std::swap(to, t.spare);
+  } else {
+    ThreadHeap::unmap(t.spare);
+    to = map(toSize);
+  }
+  size_t live = copy(t, to);
+  t.spare = t.space;
+  t.space = to;
+  t.heap.next = to.begin + live;
+  t.heap.end = to.begin + to.size;
+
+  auto pause = std::chrono::steady_clock::now() - start;
+  ++t.stats.collections;
+  t.stats.bytesCopied += live;
+  t.stats.maxPause =
+      std::max<std::chrono::nanoseconds>(t.stats.maxPause, pause);
+  t.stats.totalPause += pause;
+  if (live + size > t.options.maxHeapSize) {
+    std::cerr << "lambcalc: out of heap memory" << std::endl;
+    std::abort();
+  }
+  // Grow when the live objects take up most of the space, or when copying
+  // them took too long to do as often.
+  if (live * 2 > t.spaceSize || pause > t.options.pauseTarget) {
+    t.spaceSize = std::min(t.spaceSize * 2, t.options.maxHeapSize);
+  }
+}
+
+} // namespace
+
+extern "C" Heap *lambcalc_heap() { return &currentHeap; }
+
+extern "C" void *lambcalc_alloc_slow(uint64_t size) noexcept {
+  auto &t = threadHeap;
+  if (t.space.begin == nullptr) {
+    t.space = map(std::max(t.spaceSize, size));
+    t.heap.next = t.space.begin;
+    t.heap.end = t.space.begin + t.space.size;
+  } else {
+    collect(t, size);
+  }
+  char *ptr = t.heap.next;
+  t.heap.next += size;
+  return ptr;
+}
+
+void configure(const Options &options) {
+  auto &t = threadHeap;
+  t.options = options;
+  // Spaces are mapped in whole pages, so reset can tell whether a space has
+  // the configured size.
+  t.options.heapSize = roundToPages(options.heapSize);
+  if (t.space.begin == nullptr) {
+    t.spaceSize = t.options.heapSize;
+  }
+}
+
+void collect() {
+  auto &t = threadHeap;
+  if (t.space.begin != nullptr) {
+    collect(t, 0);
+  }
+}
+
+void reset() {
+  auto &t = threadHeap;
+  if (t.space.size != t.options.heapSize) {
+    ThreadHeap::unmap(t.space);
+    ThreadHeap::unmap(t.spare);
+  }
+  t.spaceSize = std::max(t.space.size, t.options.heapSize);
+  t.heap = {t.space.begin, t.space.begin + t.space.size, nullptr};
+  t.stats = Stats();
+}
+
+Stats stats() {
+  auto &t = threadHeap;
+  Stats stats = t.stats;
+  stats.heapSize = t.space.size;
+  return stats;
+}
+
+size_t bytesMapped() {
+  auto &t = threadHeap;
+  return t.space.size + t.spare.size;
+}
+
+} // namespace runtime
+} // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "source.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace lambcalc {
+
+SourceBuffer::SourceBuffer(SourceBuffer &&other) noexcept
+    : data_(other.data_), size_(other.size_), mapped_(other.mapped_),
+      contents_(std::move(other.contents_)) {
+  if (!mapped_) {
+    data_ = contents_.data();
+  }
+  other.data_ = nullptr;
+  other.size_ = 0;
+  other.mapped_ = false;
+}
+
+SourceBuffer &SourceBuffer::operator=(SourceBuffer &&other) noexcept {
+  if (this != &other) {
+    if (mapped_) {
+      munmap(const_cast<char *>(data_), size_);
+    }
+    size_ = other.size_;
+    mapped_ = other.mapped_;
+    contents_ = std::move(other.contents_);
+    data_ = mapped_ ? other.data_ : contents_.data();
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.mapped_ = false;
+  }
+  return *this;
+}
+
+SourceBuffer::~SourceBuffer() {
+  if (mapped_) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+}
+
+SourceBuffer SourceBuffer::fromFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::system_error(errno, std::generic_category(), path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    int err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(), path);
+  }
+  SourceBuffer buffer{std::string()};
+  // mmap rejects empty mappings, so empty files keep the empty string.
+  if (st.st_size > 0) {
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(), path);
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    buffer.data_ = static_cast<const char *>(data);
+    buffer.size_ = st.st_size;
+    buffer.mapped_ = true;
+  }
+  close(fd);
+  return buffer;
+}
+
+} // namespace lambcalc
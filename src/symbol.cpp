@@ -0,0 +1,233 @@
+#include "symbol.h"
+#include "arena.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace lambcalc {
+
+namespace {
+
+// Storage indexed by id in chunks that double in size and never move, so
+// finding the slot of an id doesn't lock.
+template <typename T> class Chunks {
+  static constexpr size_t FirstChunkSize = 1024;
+  static constexpr size_t ChunkCount = 23;
+
+  std::array<std::atomic<T *>, ChunkCount> chunks_;
+
+  // Chunk c holds the ids from FirstChunkSize * (2^c - 1) on.
+  static std::pair<size_t, size_t> locate(uint32_t id) {
+    size_t chunk = std::bit_width(id / FirstChunkSize + 1) - 1;
+    return {chunk, id - FirstChunkSize * ((size_t(1) << chunk) - 1)};
+  }
+
+public:
+  Chunks() {
+    for (auto &chunk : chunks_) {
+      chunk.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+  Chunks(const Chunks &) = delete;
+  Chunks &operator=(const Chunks &) = delete;
+  ~Chunks() {
+    for (auto &chunk : chunks_) {
+      delete[] chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+  // Returns the slot of id, allocating its chunk if no thread has yet.
+  T &make(uint32_t id) {
+    auto [chunk, index] = locate(id);
+    T *storage = chunks_[chunk].load(std::memory_order_acquire);
+    if (storage == nullptr) {
+      T *allocated = new T[FirstChunkSize << chunk]();
+      if (chunks_[chunk].compare_exchange_strong(storage, allocated,
+                                                 std::memory_order_acq_rel)) {
+        storage = allocated;
+      } else {
+        delete[] allocated;
+      }
+    }
+    return storage[index];
+  }
+  // The slot of id must have been made, possibly on another thread that
+  // published id with some synchronization.
+  T &operator[](uint32_t id) const {
+    auto [chunk, index] = locate(id);
+    return chunks_[chunk].load(std::memory_order_acquire)[index];
+  }
+};
+
+/**
+ * Thread safe table of spellings.
+ *
+ * Interning takes a shared lock to look a spelling up and an exclusive lock
+ * to add it. Looking up the spelling of an id doesn't lock at all.
+ */
+class SymbolTable {
+  std::shared_mutex mutex_;
+  arena::ChunkedAllocator spellingArena_;
+  Chunks<std::string_view> spellings_;
+  std::atomic<uint32_t> size_;
+  std::unordered_map<std::string_view, uint32_t> ids_;
+
+public:
+  SymbolTable() : spellingArena_({.blockSize = 1 << 16}), size_(0) {
+    // The empty symbol gets id 0 so default constructed symbols don't need
+    // a lookup.
+    intern(std::string_view());
+  }
+
+  uint32_t intern(std::string_view spelling) {
+    {
+      std::shared_lock lock(mutex_);
+      auto it = ids_.find(spelling);
+      if (it != ids_.end()) {
+        return it->second;
+      }
+    }
+    std::unique_lock lock(mutex_);
+    auto it = ids_.find(spelling);
+    if (it != ids_.end()) {
+      return it->second;
+    }
+    char *copy = spellingArena_.allocate<char>(spelling.size());
+    // The empty spelling may not have any data to copy.
+    if (!spelling.empty()) {
+      std::memcpy(copy, spelling.data(), spelling.size());
+    }
+    std::string_view stored(copy, spelling.size());
+    uint32_t id = size_.load(std::memory_order_relaxed);
+    spellings_.make(id) = stored;
+    size_.store(id + 1, std::memory_order_release);
+    ids_.emplace(stored, id);
+    return id;
+  }
+
+  std::string_view spelling(uint32_t id) const { return spellings_[id]; }
+  size_t size() const { return size_.load(std::memory_order_acquire); }
+};
+
+struct FreshEntry {
+  Symbol prefix;
+  uint32_t counter;
+  // Set the first time the symbol is spelled.
+  std::atomic<const std::string_view *> spelling;
+};
+
+/**
+ * Fresh symbols of the current compilation, numbered in the order they are
+ * made. Making one only takes the next number, and the spelling is formatted
+ * under a lock the first time it is asked for.
+ */
+class FreshTable {
+  // Ids from here on can't be told apart from the empty keys of hash tables.
+  static constexpr uint32_t MaxSize = (uint32_t(1) << 31) - 2;
+
+  std::mutex mutex_;
+  arena::ChunkedAllocator spellingArena_;
+  Chunks<FreshEntry> entries_;
+  std::atomic<uint32_t> size_;
+
+public:
+  FreshTable() : spellingArena_({.blockSize = 1 << 16}), size_(0) {}
+
+  uint32_t make(Symbol prefix, uint32_t counter) {
+    uint32_t index = size_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= MaxSize) {
+      throw std::length_error("Too many fresh symbols");
+    }
+    FreshEntry &entry = entries_.make(index);
+    entry.prefix = prefix;
+    entry.counter = counter;
+    entry.spelling.store(nullptr, std::memory_order_relaxed);
+    return index;
+  }
+
+  std::string_view spelling(uint32_t index) {
+    FreshEntry &entry = entries_[index];
+    if (auto *spelling = entry.spelling.load(std::memory_order_acquire)) {
+      return *spelling;
+    }
+    // The prefix may be fresh too, so spell it before locking.
+    std::string_view prefix = entry.prefix.str();
+    char digits[16];
+    char *end =
+        std::to_chars(digits, digits + sizeof(digits), entry.counter).ptr;
+    std::lock_guard lock(mutex_);
+    if (auto *spelling = entry.spelling.load(std::memory_order_relaxed)) {
+      return *spelling;
+    }
+    size_t size = prefix.size() + (end - digits);
+    char *copy = spellingArena_.allocate<char>(size);
+    if (!prefix.empty()) {
+      std::memcpy(copy, prefix.data(), prefix.size());
+    }
+    std::memcpy(copy + prefix.size(), digits, end - digits);
+    auto *spelling = spellingArena_.allocate<std::string_view>();
+    *spelling = std::string_view(copy, size);
+    entry.spelling.store(spelling, std::memory_order_release);
+    return *spelling;
+  }
+
+  void reset() {
+    size_.store(0, std::memory_order_relaxed);
+    spellingArena_.reset();
+  }
+};
+
+SymbolTable &table() {
+  static SymbolTable table;
+  return table;
+}
+
+FreshTable &freshTable() {
+  static FreshTable table;
+  return table;
+}
+
+} // namespace
+
+Symbol::Symbol() : id_(0) { table(); }
+
+Symbol::Symbol(std::string_view spelling) : id_(table().intern(spelling)) {}
+
+Symbol Symbol::fresh(Symbol prefix, uint32_t counter) {
+  Symbol symbol;
+  symbol.id_ = FreshBit | freshTable().make(prefix, counter);
+  return symbol;
+}
+
+void Symbol::resetFresh() { freshTable().reset(); }
+
+size_t Symbol::count() { return table().size(); }
+
+std::string_view Symbol::str() const {
+  return isFresh() ? freshTable().spelling(id_ & ~FreshBit)
+                   : table().spelling(id_);
+}
+
+std::vector<Symbol> SymbolSet::take() {
+  std::vector<Symbol> symbols;
+  for (Symbol symbol : inserted_) {
+    // Erasing makes repeated symbols only show up once.
+    if (contains(symbol)) {
+      symbols.push_back(symbol);
+      erase(symbol);
+    }
+  }
+  inserted_.clear();
+  std::sort(symbols.begin(), symbols.end());
+  return symbols;
+}
+
+} // namespace lambcalc
\ No newline at end of file
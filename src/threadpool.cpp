@@ -0,0 +1,155 @@
+#include "threadpool.h"
+#include <algorithm>
+#include <utility>
+
+namespace lambcalc {
+
+// Pool and deque of the worker running on this thread, if any.
+static thread_local ThreadPool *currentPool = nullptr;
+static thread_local size_t currentIndex = 0;
+
+ThreadPool::ThreadPool(size_t threads) {
+  threads = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    threads_.emplace_back([this, i] { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(sleepMutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  threads_.clear();
+}
+
+void ThreadPool::spawn(Task task) {
+  size_t index = currentPool == this
+                     ? currentIndex
+                     : next_.fetch_add(1, std::memory_order_relaxed) %
+                           workers_.size();
+  {
+    std::lock_guard lock(workers_[index]->mutex);
+    workers_[index]->tasks.push_back(std::move(task));
+  }
+  queued_.fetch_add(1);
+  // Lock so a worker can't miss the task between checking for one and
+  // sleeping.
+  { std::lock_guard lock(sleepMutex_); }
+  wake_.notify_one();
+}
+
+bool ThreadPool::pop(Worker &worker, bool back, Task &task) {
+  std::lock_guard lock(worker.mutex);
+  if (worker.tasks.empty()) {
+    return false;
+  }
+  if (back) {
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+  } else {
+    task = std::move(worker.tasks.front());
+    worker.tasks.pop_front();
+  }
+  queued_.fetch_sub(1);
+  return true;
+}
+
+bool ThreadPool::runOne() {
+  if (queued_.load() == 0) {
+    return false;
+  }
+  bool worker = currentPool == this;
+  size_t start = worker ? currentIndex : 0;
+  Task task;
+  bool found = worker && pop(*workers_[start], true, task);
+  for (size_t i = 0; !found && i < workers_.size(); ++i) {
+    found = pop(*workers_[(start + i) % workers_.size()], false, task);
+  }
+  if (found) {
+    task();
+  }
+  return found;
+}
+
+void ThreadPool::work(size_t index) {
+  currentPool = this;
+  currentIndex = index;
+  while (true) {
+    if (runOne()) {
+      continue;
+    }
+    std::unique_lock lock(sleepMutex_);
+    wake_.wait(lock, [&] { return stop_ || queued_.load() > 0; });
+    if (stop_ && queued_.load() == 0) {
+      return;
+    }
+  }
+}
+
+TaskGroup::~TaskGroup() {
+  try {
+    wait();
+  } catch (...) {
+  }
+}
+
+void TaskGroup::spawn(ThreadPool::Task task) {
+  pending_.fetch_add(1);
+  pool_.spawn([this, task = std::move(task)]() mutable {
+    // Destroy the task before finishing, since the group may be gone after.
+    try {
+      auto run = std::move(task);
+      run();
+    } catch (...) {
+      std::lock_guard lock(mutex_);
+      if (!exception_) {
+        exception_ = std::current_exception();
+      }
+    }
+    // Notify while holding the lock, since the waiter can only return and
+    // destroy the group once it gets the lock back.
+    std::lock_guard lock(mutex_);
+    ++progress_;
+    pending_.fetch_sub(1, std::memory_order_release);
+    changed_.notify_all();
+  });
+  // The spawner is either waiting for the group or one of its tasks, so the
+  // group is still alive here.
+  {
+    std::lock_guard lock(mutex_);
+    ++progress_;
+  }
+  changed_.notify_all();
+}
+
+void TaskGroup::wait() {
+  while (pending_.load(std::memory_order_acquire) > 0) {
+    size_t progress;
+    {
+      std::lock_guard lock(mutex_);
+      progress = progress_;
+    }
+    if (pool_.runOne()) {
+      continue;
+    }
+    // Every task left is running on another thread, or is queued on a
+    // deque that was already searched. Sleep until one of them finishes or
+    // another task is queued.
+    std::unique_lock lock(mutex_);
+    changed_.wait(lock, [&] {
+      return progress_ != progress ||
+             pending_.load(std::memory_order_acquire) == 0;
+    });
+  }
+  std::lock_guard lock(mutex_);
+  if (exception_) {
+    std::rethrow_exception(std::exchange(exception_, nullptr));
+  }
+}
+
+} // namespace lambcalc
\ No newline at end of file
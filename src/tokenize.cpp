@@ -0,0 +1,246 @@
+#include "tokenize.h"
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace lambcalc {
+
+constexpr size_t blockSize = 64;
+
+// Bit i of each mask is set when byte i of a 64 byte block is in that class.
+struct BlockMasks {
+  uint64_t space;
+  uint64_t alnum;
+  uint64_t digit;
+};
+
+using ClassifyFn = void (*)(const char *block, BlockMasks &masks);
+
+static void classifyScalar(const char *block, BlockMasks &masks) {
+  masks = {0, 0, 0};
+  for (size_t i = 0; i < blockSize; ++i) {
+    unsigned char c = block[i];
+    uint64_t bit = uint64_t{1} << i;
+    if (c == ' ' || (c >= '\t' && c <= '\r')) {
+      masks.space |= bit;
+    }
+    if (c >= '0' && c <= '9') {
+      masks.digit |= bit;
+      masks.alnum |= bit;
+    } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') {
+      masks.alnum |= bit;
+    }
+  }
+}
+
+#if defined(__SSE2__)
+
+// There are only signed byte comparisons, so inRange shifts [lo, hi] down to
+// the bottom of the signed range and checks both bounds with one comparison.
+
+// SSE2 is part of every x86-64 CPU, so it needs no check.
+namespace sse2 {
+using Vec = __m128i;
+static inline Vec load(const char *p) {
+  return _mm_loadu_si128(reinterpret_cast<const Vec *>(p));
+}
+static inline Vec splat(int8_t c) { return _mm_set1_epi8(c); }
+static inline Vec add(Vec a, Vec b) { return _mm_add_epi8(a, b); }
+static inline Vec bitOr(Vec a, Vec b) { return _mm_or_si128(a, b); }
+static inline Vec greater(Vec a, Vec b) { return _mm_cmpgt_epi8(a, b); }
+static inline Vec equal(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline uint64_t mask(Vec v) {
+  return static_cast<uint16_t>(_mm_movemask_epi8(v));
+}
+static inline Vec inRange(Vec v, unsigned char lo, unsigned char hi) {
+  Vec shifted = add(v, splat(static_cast<int8_t>(-128 - lo)));
+  return greater(splat(static_cast<int8_t>(-128 + (hi - lo) + 1)), shifted);
+}
+
+static void classify(const char *block, BlockMasks &masks) {
+  masks = {0, 0, 0};
+  for (size_t i = 0; i < blockSize; i += sizeof(Vec)) {
+    Vec v = load(block + i);
+    Vec space = bitOr(equal(v, splat(' ')), inRange(v, '\t', '\r'));
+    Vec digit = inRange(v, '0', '9');
+    Vec alpha = inRange(bitOr(v, splat(0x20)), 'a', 'z');
+    masks.space |= mask(space) << i;
+    masks.digit |= mask(digit) << i;
+    masks.alnum |= mask(bitOr(alpha, digit)) << i;
+  }
+}
+} // namespace sse2
+
+// The same with 32 bytes at a time. The build targets baseline x86-64, so
+// these are compiled for AVX2 on their own and only called when the CPU has
+// it.
+namespace avx2 {
+#define AVX2 __attribute__((target("avx2")))
+using Vec = __m256i;
+AVX2 static inline Vec load(const char *p) {
+  return _mm256_loadu_si256(reinterpret_cast<const Vec *>(p));
+}
+AVX2 static inline Vec splat(int8_t c) { return _mm256_set1_epi8(c); }
+AVX2 static inline Vec add(Vec a, Vec b) { return _mm256_add_epi8(a, b); }
+AVX2 static inline Vec bitOr(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+AVX2 static inline Vec greater(Vec a, Vec b) {
+  return _mm256_cmpgt_epi8(a, b);
+}
+AVX2 static inline Vec equal(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+AVX2 static inline uint64_t mask(Vec v) {
+  return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+}
+AVX2 static inline Vec inRange(Vec v, unsigned char lo, unsigned char hi) {
+  Vec shifted = add(v, splat(static_cast<int8_t>(-128 - lo)));
+  return greater(splat(static_cast<int8_t>(-128 + (hi - lo) + 1)), shifted);
+}
+
+AVX2 static void classify(const char *block, BlockMasks &masks) {
+  masks = {0, 0, 0};
+  for (size_t i = 0; i < blockSize; i += sizeof(Vec)) {
+    Vec v = load(block + i);
+    Vec space = bitOr(equal(v, splat(' ')), inRange(v, '\t', '\r'));
+    Vec digit = inRange(v, '0', '9');
+    Vec alpha = inRange(bitOr(v, splat(0x20)), 'a', 'z');
+    masks.space |= mask(space) << i;
+    masks.digit |= mask(digit) << i;
+    masks.alnum |= mask(bitOr(alpha, digit)) << i;
+  }
+}
+#undef AVX2
+} // namespace avx2
+
+#endif
+
+bool supports(Classifier classifier) {
+  switch (classifier) {
+  case Classifier::Avx2:
+#if defined(__SSE2__)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+  case Classifier::Sse2:
+#if defined(__SSE2__)
+    return true;
+#else
+    return false;
+#endif
+  case Classifier::Scalar:
+    return true;
+  }
+  return false;
+}
+
+static ClassifyFn classifyFn(Classifier classifier) {
+  if (!supports(classifier)) {
+    throw std::invalid_argument("classifier is not supported by this CPU");
+  }
+  switch (classifier) {
+#if defined(__SSE2__)
+  case Classifier::Avx2:
+    return avx2::classify;
+  case Classifier::Sse2:
+    return sse2::classify;
+#endif
+  default:
+    return classifyScalar;
+  }
+}
+
+// Finds the ends of character runs by scanning the block masks, classifying
+// each block the first time it is reached.
+class Scanner {
+  std::string_view source_;
+  ClassifyFn classify_;
+  size_t base_;
+  BlockMasks masks_;
+
+  void load(size_t base) {
+    base_ = base;
+    if (base + blockSize <= source_.size()) {
+      classify_(source_.data() + base, masks_);
+    } else {
+      // Zero padding isn't in any class, so scans stop at the end.
+      char tail[blockSize] = {};
+      std::memcpy(tail, source_.data() + base, source_.size() - base);
+      classify_(tail, masks_);
+    }
+  }
+
+public:
+  Scanner(std::string_view source, ClassifyFn classify)
+      : source_(source), classify_(classify),
+        base_(std::numeric_limits<size_t>::max()), masks_{0, 0, 0} {}
+
+  // Returns the first position at or after pos whose byte is not in the
+  // class selected by Class, or the size of the source.
+  template <uint64_t BlockMasks::*Class> size_t skip(size_t pos) {
+    while (pos < source_.size()) {
+      size_t base = pos & ~(blockSize - 1);
+      if (base != base_) {
+        load(base);
+      }
+      uint64_t outside = ~(masks_.*Class) >> (pos - base);
+      if (outside != 0) {
+        return std::min(pos + std::countr_zero(outside), source_.size());
+      }
+      pos = base + blockSize;
+    }
+    return source_.size();
+  }
+};
+
+TokenArray tokenize(std::string_view source) {
+  // Checking the CPU once is enough.
+  static const Classifier best = supports(Classifier::Avx2)
+                                     ? Classifier::Avx2
+                                     : supports(Classifier::Sse2)
+                                           ? Classifier::Sse2
+                                           : Classifier::Scalar;
+  return tokenize(source, best);
+}
+
+TokenArray tokenize(std::string_view source, Classifier classifier) {
+  ClassifyFn classify = classifyFn(classifier);
+  if (source.size() >= std::numeric_limits<uint32_t>::max()) {
+    throw std::length_error("source is too large to tokenize");
+  }
+  TokenArray tokens(source.size() + 1);
+  Scanner scanner(source, classify);
+  const char *data = source.data();
+  size_t size = source.size();
+  size_t pos = 0;
+  while ((pos = scanner.skip<&BlockMasks::space>(pos)) < size) {
+    size_t start = pos;
+    unsigned char c = data[pos];
+    if (c == '=' && pos + 1 < size && data[pos + 1] == '>') {
+      tokens.push(Token::Arrow, start, 2);
+      pos += 2;
+    } else if (isalpha(c)) {
+      pos = scanner.skip<&BlockMasks::alnum>(pos + 1);
+      tokens.push(keywordToken(source.substr(start, pos - start)), start,
+                  pos - start);
+    } else if (isdigit(c)) {
+      pos = scanner.skip<&BlockMasks::digit>(pos + 1);
+      unsigned value = 0;
+      for (size_t i = start; i < pos; ++i) {
+        value = value * 10 + (data[i] - '0');
+      }
+      tokens.push(Token::Number, start, pos - start, static_cast<int>(value));
+    } else {
+      tokens.push(static_cast<Token>(c), start, 1);
+      ++pos;
+    }
+  }
+  tokens.push(Token::Eof, size, 0);
+  return tokens;
+}
+
+} // namespace lambcalc
@@ -1,4 +1,5 @@
 #include "visitor.h"
+#include "pool.h"
 #include "utils.h"
 #include <utility>
 #include <variant>
@@ -17,8 +18,8 @@ std::string binOpString(ast::Bop bop) {
   std::unreachable();
 }
 
-template <typename T>
-void print_vector(std::ostream &os, const std::vector<T> &vec) {
+template <typename Range>
+void print_vector(std::ostream &os, const Range &vec) {
   os << "[";
   for (auto it = vec.begin(); it != vec.end(); ++it) {
     os << *it;
@@ -75,6 +76,7 @@ void PrintExpVisitor<Ptr>::operator()(const IfExp<Ptr> &exp) {
 
 template class PrintExpVisitor<std::unique_ptr>;
 template class PrintExpVisitor<raw_ptr>;
+template class PrintExpVisitor<pool::index_ptr>;
 
 } // namespace ast
 
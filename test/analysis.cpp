@@ -0,0 +1,118 @@
+#include "analysis.h"
+#include "convert.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace lambcalc {
+
+namespace {
+
+// Records the hooks it was called with, to check the order of a traversal.
+struct Trace {
+  std::vector<std::string> events;
+
+  void enter(const anf::FunExp &exp) {
+    events.push_back(std::string("fun ").append(exp.name.str()));
+  }
+  void enterBody(const anf::FunExp &exp) {
+    events.push_back(std::string("body ").append(exp.name.str()));
+  }
+  void leaveBody(const anf::FunExp &exp) {
+    events.push_back(std::string("~body ").append(exp.name.str()));
+  }
+  void leave(const anf::FunExp &exp) {
+    events.push_back(std::string("~fun ").append(exp.name.str()));
+  }
+  void enter(const anf::BopExp &exp) {
+    events.push_back(std::string("bop ").append(exp.name.str()));
+  }
+  void enter(const anf::IfExp &) { events.push_back("if"); }
+  void enter(const anf::HaltExp &) { events.push_back("halt"); }
+
+  void enter(const ast::LamExp<std::unique_ptr> &exp) {
+    events.push_back(std::string("lam ").append(exp.param.str()));
+  }
+  void leave(const ast::LamExp<std::unique_ptr> &exp) {
+    events.push_back(std::string("~lam ").append(exp.param.str()));
+  }
+  void enter(const ast::VarExp &exp) { events.emplace_back(exp.name.str()); }
+  void enter(const ast::IntExp &exp) {
+    events.push_back(std::to_string(exp.value));
+  }
+};
+
+struct CountNodes {
+  size_t count = 0;
+  void enter(const auto &) { ++count; }
+};
+
+} // namespace
+
+TEST(Analyze, Anf) {
+  using namespace anf;
+  // fun f a = (if a then (let x = a + 1 in halt x) else halt a) in halt f
+  auto exp = make(FunExp{
+      "f",
+      {"a"},
+      make(IfExp{VarValue{"a"},
+                 make(BopExp{"x", ast::Bop::Plus, VarValue{"a"}, IntValue{1},
+                             make(HaltExp{VarValue{"x"}})}),
+                 make(HaltExp{VarValue{"a"}})}),
+      make(HaltExp{GlobValue{"f"}})});
+  Trace trace;
+  Statistics stats;
+  CountNodes count;
+  analyze(*exp, trace, stats, count);
+  std::vector<std::string> expected{"fun f", "body f", "if",   "bop x", "halt",
+                                    "halt",  "~body f", "halt", "~fun f"};
+  EXPECT_EQ(trace.events, expected);
+  EXPECT_EQ(stats.nodes, 6);
+  EXPECT_EQ(stats.functions, 1);
+  EXPECT_EQ(stats.applications, 0);
+  EXPECT_EQ(stats.maxFunctionDepth, 1);
+  EXPECT_EQ(count.count, 6);
+}
+
+TEST(Analyze, FusedFreeVars) {
+  using namespace anf;
+  // fun f a = (fun g b = halt (a + b) in halt g) in halt f
+  auto exp = make(FunExp{
+      "f",
+      {"a"},
+      make(FunExp{"g",
+                  {"b"},
+                  make(BopExp{"c", ast::Bop::Plus, VarValue{"a"},
+                              VarValue{"b"}, make(HaltExp{VarValue{"c"}})}),
+                  make(HaltExp{GlobValue{"g"}})}),
+      make(HaltExp{GlobValue{"f"}})});
+  convert::FunctionFreeVarsAnalysis freeVars;
+  Statistics stats;
+  analyze(*exp, freeVars, stats);
+  auto &result = freeVars.result();
+  auto &f = std::get<FunExp>(*exp);
+  auto &g = std::get<FunExp>(*f.body);
+  EXPECT_EQ(result.at(&f), std::vector<Var>{});
+  EXPECT_EQ(result.at(&g), std::vector<Var>{"a"});
+  EXPECT_EQ(result, convert::functionFreeVars(*exp));
+  EXPECT_EQ(stats.functions, 2);
+  EXPECT_EQ(stats.maxFunctionDepth, 2);
+}
+
+TEST(Analyze, Ast) {
+  using namespace ast;
+  // (fn a => (fn b => a) 1) 2
+  auto exp = make(AppExp{
+      make(LamExp{"a", make(AppExp{make(LamExp{"b", make(VarExp{"a"})}),
+                                   make(IntExp{1})})}),
+      make(IntExp{2})});
+  Trace trace;
+  CountNodes count;
+  analyze(*exp, trace, count);
+  std::vector<std::string> expected{"lam a", "lam b", "a", "~lam b",
+                                    "1",     "~lam a", "2"};
+  EXPECT_EQ(trace.events, expected);
+  EXPECT_EQ(count.count, 7);
+}
+
+} // namespace lambcalc
\ No newline at end of file
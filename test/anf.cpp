@@ -1,5 +1,8 @@
 #include "anf.h"
 #include "ast.h"
+#include "heap.h"
+#include "rename.h"
+#include "threadpool.h"
 #include <gtest/gtest.h>
 
 namespace lambcalc {
@@ -87,4 +90,221 @@ TEST(AnfConversion, NoStackOverflow) {
   EXPECT_EQ(anf->dump().size(), 67793);
 }
 
+TEST(AnfConversion, IndexedScoping) {
+  // (fn x => (fn x => x + 1) x) 1
+  auto expr = make(AppExp{
+      make(LamExp{
+          "x", make(AppExp{make(LamExp{"x", make(BopExp{Bop::Plus,
+                                                        make(VarExp{"x"}),
+                                                        make(IntExp{1})})}),
+                           make(VarExp{"x"})})}),
+      make(IntExp{1})});
+  resolve(*expr);
+  anf::resetCounter();
+  auto anf = anf::convertDefunc(*expr, anf::Scoping::Indexed);
+  std::string expected =
+      "FunExp { tmp3, [x0], FunExp { tmp1, [x1], BopExp { tmp0, +, x1, 1, "
+      "HaltExp { tmp0 } }, AppExp { tmp2, tmp1, [x0], HaltExp { tmp2 } } }, "
+      "AppExp { tmp4, tmp3, [1], HaltExp { tmp4 } } }";
+  EXPECT_EQ(anf->dump(), expected);
+}
+
+TEST(AnfConversion, FusedScoping) {
+  // (fn x => (fn x => x + 1) x) 1
+  auto expr = make(AppExp{
+      make(LamExp{
+          "x", make(AppExp{make(LamExp{"x", make(BopExp{Bop::Plus,
+                                                        make(VarExp{"x"}),
+                                                        make(IntExp{1})})}),
+                           make(VarExp{"x"})})}),
+      make(IntExp{1})});
+  anf::resetCounter();
+  auto fused = anf::convertDefunc(*expr, anf::Scoping::Fused);
+  resolve(*expr);
+  anf::resetCounter();
+  auto indexed = anf::convertDefunc(*expr, anf::Scoping::Indexed);
+  EXPECT_EQ(fused->dump(), indexed->dump());
+
+  // fn x => (fn y => y) y
+  expr = make(LamExp{"x", make(AppExp{make(LamExp{"y", make(VarExp{"y"})}),
+                                      make(VarExp{"y"})})});
+  EXPECT_THROW(anf::convertDefunc(*expr, anf::Scoping::Fused),
+               NotInScopeException);
+}
+
+TEST(AnfConversion, TryConvertReportsErrors) {
+  auto unbound = make(LamExp{"x", make(VarExp{"y"})});
+  auto result = anf::tryConvertDefunc(*unbound, anf::Scoping::Fused);
+  ASSERT_FALSE(result);
+  EXPECT_EQ(result.error().message, "y is not in scope");
+
+  auto notFunction = make(AppExp{make(IntExp{1}), make(IntExp{2})});
+  result = anf::tryConvertDefunc(*notFunction, anf::Scoping::Fused);
+  ASSERT_FALSE(result);
+  EXPECT_EQ(result.error().message, "must apply named value");
+  EXPECT_THROW(anf::convertDefunc(*notFunction), std::runtime_error);
+}
+
+TEST(AnfConversion, NodeArena) {
+  auto expr =
+      make(AppExp{make(LamExp{"x", make(BopExp{Bop::Plus, make(VarExp{"x"}),
+                                               make(IntExp{1})})}),
+                  make(IntExp{1})});
+  anf::resetCounter();
+  auto expected = anf::convertDefunc(*expr)->dump();
+
+  anf::NodeArena arena;
+  {
+    anf::NodeArena::Scope scope(arena);
+    anf::resetCounter();
+    auto anf = anf::convertDefunc(*expr);
+    EXPECT_EQ(anf->dump(), expected);
+    // The block starts with a word of padding, so that the nodes are 8 bytes
+    // past a multiple of 16.
+    EXPECT_EQ(arena.allocator().bytesUsed(),
+              5 * anf::NodeArena::nodeSize() + sizeof(uint64_t));
+  }
+  arena.reset();
+  EXPECT_EQ(arena.allocator().bytesUsed(), 0u);
+}
+
+TEST(AnfConversion, NodeArenaDeleteOutsideScope) {
+  auto expr = make(BopExp{Bop::Plus, make(IntExp{1}), make(IntExp{2})});
+  anf::NodeArena arena;
+  std::unique_ptr<anf::Exp> inArena;
+  {
+    anf::NodeArena::Scope scope(arena);
+    inArena = anf::convertDefunc(*expr);
+  }
+  auto onHeap = anf::convertDefunc(*expr);
+  {
+    // The heap nodes are freed even though a scope is active.
+    anf::NodeArena::Scope scope(arena);
+    onHeap.reset();
+  }
+  size_t used = arena.allocator().bytesUsed();
+  // The arena nodes are left to the arena even though no scope is active.
+  inArena.reset();
+  EXPECT_EQ(arena.allocator().bytesUsed(), used);
+  arena.reset();
+}
+
+TEST(AnfConversion, NodeArenaReleasesTree) {
+  anf::NodeArena arena;
+  std::unique_ptr<anf::Exp> tree;
+  {
+    anf::NodeArena::Scope scope(arena);
+    // A chain of tuples whose values don't fit inline.
+    tree = anf::make(anf::HaltExp{anf::IntValue{0}});
+    for (int i = 0; i < 1000; ++i) {
+      anf::Values values;
+      for (int j = 0; j < 8; ++j) {
+        values.push_back(anf::IntValue{j});
+      }
+      tree = anf::make(anf::TupleExp{"t", std::move(values), std::move(tree)});
+    }
+  }
+  EXPECT_TRUE(anf::NodeArena::owns(tree.get()));
+  EXPECT_TRUE(anf::NodeArena::owns(
+      std::get<anf::TupleExp>(*tree).values.data()));
+  // Nothing is freed node by node, and the leak checker would report the
+  // lists if they had been allocated on the heap.
+  size_t used = arena.allocator().bytesUsed();
+  tree.reset();
+  EXPECT_EQ(arena.allocator().bytesUsed(), used);
+  arena.reset();
+
+  auto onHeap = anf::make(anf::HaltExp{anf::IntValue{0}});
+  EXPECT_FALSE(anf::NodeArena::owns(onHeap.get()));
+}
+
+// Tree of applied lambdas, ifs and additions that alternate by level, with
+// variables of the enclosing lambdas and integers at the leaves.
+static std::unique_ptr<Exp<>> generate(int depth, std::vector<Symbol> &vars,
+                                       int &leaves) {
+  if (depth == 0) {
+    if (vars.empty() || leaves++ % 3 == 0) {
+      return make(IntExp{leaves});
+    }
+    return make(VarExp{vars[leaves % vars.size()]});
+  }
+  switch (depth % 3) {
+  case 0: {
+    Symbol param = depth % 2 == 0 ? "a" : "b";
+    vars.push_back(param);
+    auto body = generate(depth - 1, vars, leaves);
+    vars.pop_back();
+    return make(AppExp{make(LamExp{param, std::move(body)}),
+                       generate(depth - 1, vars, leaves)});
+  }
+  case 1: {
+    auto cond = generate(depth - 1, vars, leaves);
+    auto then = generate(depth - 1, vars, leaves);
+    return make(IfExp{std::move(cond), std::move(then),
+                      generate(depth - 1, vars, leaves)});
+  }
+  default: {
+    auto arg1 = generate(depth - 1, vars, leaves);
+    return make(
+        BopExp{Bop::Plus, std::move(arg1), generate(depth - 1, vars, leaves)});
+  }
+  }
+}
+
+TEST(AnfConversion, ParallelMatchesSequential) {
+  std::vector<Symbol> vars;
+  int leaves = 0;
+  auto expr = generate(12, vars, leaves);
+  // Named needs the binders to be unique.
+  rename(*expr);
+  resolve(*expr);
+  ThreadPool pool(4);
+  for (auto scoping :
+       {anf::Scoping::Named, anf::Scoping::Indexed, anf::Scoping::Fused}) {
+    anf::resetCounter();
+    auto sequential = anf::convertDefunc(*expr, scoping)->dump();
+    anf::resetCounter();
+    auto parallel = anf::convertDefunc(*expr, scoping, pool)->dump();
+    EXPECT_EQ(parallel, sequential);
+  }
+}
+
+TEST(AnfConversion, ParallelReportsSequentialError) {
+  std::vector<Symbol> vars = {"a"};
+  int leaves = 0;
+  // Two unbound variables, in different tasks.
+  auto expr = make(BopExp{Bop::Plus,
+                          make(LamExp{"b", generate(12, vars, leaves)}),
+                          make(LamExp{"b", generate(12, vars, leaves)})});
+  ThreadPool pool(4);
+  auto sequential = anf::tryConvertDefunc(*expr, anf::Scoping::Fused);
+  auto parallel = anf::tryConvertDefunc(*expr, anf::Scoping::Fused, pool);
+  ASSERT_FALSE(sequential);
+  ASSERT_FALSE(parallel);
+  EXPECT_EQ(parallel.error().message, sequential.error().message);
+  EXPECT_EQ(parallel.error().message, "a is not in scope");
+}
+
+TEST(AnfDestructor, NoStackOverflow) {
+  auto exp = anf::make(anf::HaltExp{anf::IntValue{0}});
+  for (size_t i = 0; i < 100000; ++i) {
+    exp = anf::make(anf::BopExp{"x", Bop::Plus, anf::IntValue{1},
+                                anf::IntValue{2}, std::move(exp)});
+  }
+  exp.reset();
+  EXPECT_EQ(exp, nullptr);
+}
+
+TEST(AnfDestructor, ConstantSpace) {
+  // Functions nested in the rest of each other, with bodies on the side, for
+  // 10M nodes in all.
+  anf::Var f("f"), x("x");
+  auto exp = anf::make(anf::HaltExp{anf::IntValue{0}});
+  for (size_t i = 0; i < 5'000'000; ++i) {
+    exp = anf::make(anf::FunExp{
+        f, {x}, anf::make(anf::HaltExp{anf::IntValue{1}}), std::move(exp)});
+  }
+  EXPECT_EQ(heapUsedToFree(std::move(exp)), 0);
+}
+
 } // namespace lambcalc
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "arena.h"
 #include <cstddef>
+#include <cstdint>
 #include <gtest/gtest.h>
 #include <new>
 #include <vector>
@@ -36,4 +37,56 @@ TEST(Arena, Vector) {
   }
 }
 
+TEST(ChunkedArena, Grows) {
+  ChunkedAllocator allocator({.blockSize = 4096});
+  std::vector<int64_t *> ptrs;
+  for (int i = 0; i < 10000; ++i) {
+    int64_t *ptr = allocator.allocate<int64_t>();
+    EXPECT_EQ(*ptr, 0);
+    *ptr = i;
+    ptrs.push_back(ptr);
+  }
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_EQ(*ptrs[i], i);
+  }
+  EXPECT_EQ(allocator.bytesUsed(), 10000 * sizeof(int64_t));
+  EXPECT_GT(allocator.blockCount(), 1u);
+
+  // Allocations larger than a block get their own block.
+  char *big = allocator.allocate<char>(10000);
+  EXPECT_EQ(big[9999], 0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(allocator.allocate<int64_t>()) %
+                alignof(int64_t),
+            0u);
+}
+
+TEST(ChunkedArena, ResetKeepsBlocks) {
+  ChunkedAllocator allocator({.blockSize = 4096, .retainedBlocks = 1});
+  for (int i = 0; i < 2000; ++i) {
+    *allocator.allocate<int64_t>() = i;
+  }
+  size_t used = allocator.bytesUsed();
+  size_t blocks = allocator.blockCount();
+  allocator.reset();
+  EXPECT_EQ(allocator.bytesUsed(), 0u);
+  EXPECT_EQ(allocator.highWaterMark(), used);
+  for (int i = 0; i < 2000; ++i) {
+    EXPECT_EQ(*allocator.allocate<int64_t>(), 0);
+  }
+  EXPECT_EQ(allocator.blockCount(), blocks);
+  EXPECT_EQ(allocator.bytesMapped(), blocks * 4096);
+}
+
+TEST(ChunkedArena, Budget) {
+  ChunkedAllocator allocator({.blockSize = 4096, .budget = 10000});
+  allocator.allocate<char>(6000);
+  EXPECT_THROW(allocator.allocate<char>(6000), BudgetExceeded);
+  EXPECT_EQ(allocator.bytesUsed(), 6000u);
+  allocator.allocate<char>(4000);
+  EXPECT_THROW(allocator.allocate<char>(), BudgetExceeded);
+  allocator.reset();
+  allocator.allocate<char>(10000);
+  EXPECT_EQ(allocator.highWaterMark(), 10000u);
+}
+
 } // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,28 @@
+#include "ast.h"
+#include "heap.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+namespace lambcalc {
+
+using namespace ast;
+
+TEST(AstDestructor, ConstantSpace) {
+  // Complete binary tree of additions with 2^22 leaves, about 8M nodes.
+  std::vector<std::unique_ptr<Exp<>>> level;
+  for (size_t i = 0; i < (1 << 22); ++i) {
+    level.push_back(make(IntExp{1}));
+  }
+  while (level.size() > 1) {
+    std::vector<std::unique_ptr<Exp<>>> next;
+    for (size_t i = 0; i < level.size(); i += 2) {
+      next.push_back(make(
+          BopExp{Bop::Plus, std::move(level[i]), std::move(level[i + 1])}));
+    }
+    level = std::move(next);
+  }
+  EXPECT_EQ(heapUsedToFree(std::move(level[0])), 0);
+}
+
+} // namespace lambcalc
\ No newline at end of file
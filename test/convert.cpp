@@ -35,6 +35,67 @@ TEST(FreeVars, FunJoin) {
   EXPECT_EQ(vars, expected);
 }
 
+TEST(FunctionFreeVars, Nested) {
+  // let f1 = fn a =>
+  //   let f2 = fn b =>
+  //     let r = a + c in
+  //     let s = r + b in
+  //     s
+  //   in
+  //   f2
+  // in
+  // let t = f1 d in
+  // t
+  auto exp = make(FunExp{
+      "f1",
+      {"a"},
+      make(FunExp{
+          "f2",
+          {"b"},
+          make(BopExp{"r", ast::Bop::Plus, VarValue{"a"}, VarValue{"c"},
+                      make(BopExp{"s", ast::Bop::Plus, VarValue{"r"},
+                                  VarValue{"b"},
+                                  make(HaltExp{VarValue{"s"}})})}),
+          make(HaltExp{VarValue{"f2"}})}),
+      make(AppExp{"t", "f1", {VarValue{"d"}}, make(HaltExp{VarValue{"t"}})})});
+  auto result = convert::functionFreeVars(*exp);
+  auto &f1 = std::get<FunExp>(*exp);
+  auto &f2 = std::get<FunExp>(*f1.body);
+  ASSERT_EQ(result.size(), 2u);
+  // Variables used after a function aren't free in it.
+  EXPECT_EQ(result.at(&f1), std::vector<Var>{"c"});
+  std::vector<Var> expected{"a", "c"};
+  EXPECT_EQ(result.at(&f2), expected);
+}
+
+TEST(FunctionFreeVars, Curried) {
+  // fn x0 => fn x1 => ... fn xn => x0 + ... + xn, where every function has
+  // the parameters of the functions around it as free variables.
+  constexpr int depth = 1000;
+  std::vector<Var> vars;
+  for (int i = 0; i < depth; ++i) {
+    vars.push_back(Symbol::fresh("x", i));
+  }
+  std::unique_ptr<Exp> body = make(HaltExp{VarValue{vars[0]}});
+  for (int i = depth - 1; i > 0; --i) {
+    body = make(BopExp{Symbol::fresh("s", i), ast::Bop::Plus,
+                       VarValue{vars[i]}, IntValue{1}, std::move(body)});
+  }
+  for (int i = depth - 1; i >= 0; --i) {
+    auto name = Symbol::fresh("f", i);
+    body = make(FunExp{name, {vars[i]}, std::move(body),
+                       make(HaltExp{VarValue{name}})});
+  }
+  auto result = convert::functionFreeVars(*body);
+  ASSERT_EQ(result.size(), size_t(depth));
+  Exp *exp = body.get();
+  for (int i = 0; i < depth; ++i) {
+    auto &fun = std::get<FunExp>(*exp);
+    EXPECT_EQ(result.at(&fun).size(), size_t(i));
+    exp = fun.body.get();
+  }
+}
+
 TEST(ClosureConvert, Simple) {
   // let a = 1 + 2 in
   // let b = 3 * 4 in
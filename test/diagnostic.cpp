@@ -0,0 +1,26 @@
+#include "diagnostic.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+namespace lambcalc {
+
+TEST(Diagnostic, PrintsLineAndColumn) {
+  std::ostringstream out;
+  printDiagnostic(out, {"Unexpected identifier", Span{4, 7}}, "1 +\nfoo bar");
+  EXPECT_EQ(out.str(), "2:1: error: Unexpected identifier\nfoo bar\n^~~\n");
+}
+
+TEST(Diagnostic, PrintsEndOfInput) {
+  std::ostringstream out;
+  printDiagnostic(out, {"Expected ')'", Span{6, 6}}, "(1 + 2");
+  EXPECT_EQ(out.str(), "1:7: error: Expected ')'\n(1 + 2\n      ^\n");
+}
+
+TEST(Diagnostic, PrintsWithoutSource) {
+  std::ostringstream out;
+  printDiagnostic(out, {"Expected ')'", Span{6, 6}});
+  printDiagnostic(out, {"x is not in scope", std::nullopt}, "fn y => x");
+  EXPECT_EQ(out.str(), "6: error: Expected ')'\nerror: x is not in scope\n");
+}
+
+} // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "anf.h"
+#include "hashcons.h"
+#include "parser.h"
+#include "rename.h"
+#include "threadpool.h"
+#include <gtest/gtest.h>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+
+namespace lambcalc {
+
+using namespace ast;
+
+class HashCons : public testing::Test {
+protected:
+  alignas(alignof(Exp<raw_ptr>)) char buf_[16384];
+  arena::Allocator arena_;
+  hashcons::Allocator allocator_;
+
+  HashCons()
+      : arena_(std::launder(buf_), std::launder(buf_) + sizeof(buf_)),
+        allocator_(arena_) {}
+
+  Exp<raw_ptr> *parse(const std::string &source) {
+    std::istringstream is(source);
+    Lexer lexer(is);
+    IterativeParser<raw_ptr, hashcons::Allocator> parser(allocator_, lexer);
+    return parser.parseExpression();
+  }
+};
+
+TEST_F(HashCons, SharesClosedSubtrees) {
+  auto exp = parse("(1 + 2) * (1 + 2) + (fn x => x) (fn x => x)");
+  auto &plus = std::get<BopExp<raw_ptr>>(*exp);
+  auto &times = std::get<BopExp<raw_ptr>>(*plus.arg1);
+  auto &app = std::get<AppExp<raw_ptr>>(*plus.arg2);
+  EXPECT_EQ(times.arg1, times.arg2);
+  EXPECT_EQ(app.fn, app.arg);
+  EXPECT_TRUE(allocator_.isInterned(app.fn));
+  // 1, 2, 1 + 2 and fn x => x are each built twice. The x in the body is
+  // open, so it's allocated twice.
+  EXPECT_EQ(allocator_.hits(), 4u);
+  EXPECT_EQ(exp->dump(), "(((1 + 2) * (1 + 2)) + ((fn x => x) (fn x => x)))");
+}
+
+TEST_F(HashCons, SharesLambdasClosedByTheirParameters) {
+  auto exp = parse("(fn x => fn y => y x + x) (fn x => fn y => y x + x)");
+  auto &app = std::get<AppExp<raw_ptr>>(*exp);
+  EXPECT_EQ(app.fn, app.arg);
+  // The body is open since it refers to x, which fn x binds.
+  auto &outer = std::get<LamExp<raw_ptr>>(*app.fn);
+  EXPECT_FALSE(allocator_.isInterned(outer.body));
+  EXPECT_EQ(allocator_.hits(), 1u);
+}
+
+TEST_F(HashCons, OpenSubtreesAreNotShared) {
+  auto exp = parse("(fn x => x + 1) (fn y => x + 1)");
+  auto &app = std::get<AppExp<raw_ptr>>(*exp);
+  auto &lam1 = std::get<LamExp<raw_ptr>>(*app.fn);
+  auto &lam2 = std::get<LamExp<raw_ptr>>(*app.arg);
+  EXPECT_NE(lam1.body, lam2.body);
+  EXPECT_FALSE(allocator_.isInterned(lam1.body));
+  EXPECT_FALSE(allocator_.isInterned(app.arg));
+  EXPECT_EQ(allocator_.hash(lam1.body), allocator_.hash(lam2.body));
+  EXPECT_NE(allocator_.hash(app.fn), allocator_.hash(app.arg));
+  EXPECT_TRUE(hashcons::equal(*lam1.body, *lam2.body));
+  EXPECT_FALSE(hashcons::equal(*app.fn, *app.arg));
+}
+
+TEST_F(HashCons, RenameSharedSubtrees) {
+  auto exp = parse("(fn f => f (fn x => x) (fn x => x)) (fn x => x)");
+  rename(*exp, allocator_);
+  // The shared fn x => x is only renamed the first time it's reached.
+  EXPECT_EQ(exp->dump(),
+            "((fn f1 => ((f1 (fn x0 => x0)) (fn x0 => x0))) (fn x0 => x0))");
+  // Lambdas renamed by an earlier call are left alone too.
+  rename(*exp, allocator_);
+  EXPECT_EQ(exp->dump(),
+            "((fn f1 => ((f1 (fn x0 => x0)) (fn x0 => x0))) (fn x0 => x0))");
+}
+
+TEST_F(HashCons, NamedConversionRejectsSharedBinders) {
+  auto exp = parse("(fn f => f (fn x => x) (fn x => x)) (fn x => x)");
+  rename(*exp, allocator_);
+  EXPECT_THROW(anf::convertDefunc(*exp, anf::Scoping::Named),
+               std::runtime_error);
+  ThreadPool pool(2);
+  EXPECT_THROW(anf::convertDefunc(*exp, anf::Scoping::Named, pool),
+               std::runtime_error);
+  EXPECT_NO_THROW(anf::convertDefunc(*exp, anf::Scoping::Fused));
+}
+
+TEST_F(HashCons, Reset) {
+  auto exp1 = parse("fn x => x");
+  allocator_.reset();
+  arena_.reset();
+  auto exp2 = parse("fn y => y");
+  EXPECT_EQ(exp1, exp2);
+  EXPECT_EQ(allocator_.hits(), 0u);
+  EXPECT_EQ(exp2->dump(), "(fn y => y)");
+}
+
+} // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "heap.h"
+#include <atomic>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace lambcalc {
+
+static std::atomic<size_t> live = 0;
+static std::atomic<size_t> peak = 0;
+
+size_t liveHeapBytes() { return live.load(); }
+size_t peakHeapBytes() { return peak.load(); }
+void resetPeakHeapBytes() { peak = live.load(); }
+
+} // namespace lambcalc
+
+static void *countAllocation(void *ptr) {
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  size_t live = lambcalc::live += malloc_usable_size(ptr);
+  size_t peak = lambcalc::peak.load(std::memory_order_relaxed);
+  while (live > peak && !lambcalc::peak.compare_exchange_weak(peak, live)) {
+  }
+  return ptr;
+}
+
+static void countFree(void *ptr) {
+  if (ptr) {
+    lambcalc::live -= malloc_usable_size(ptr);
+    std::free(ptr);
+  }
+}
+
+void *operator new(size_t size) { return countAllocation(std::malloc(size)); }
+
+void *operator new(size_t size, std::align_val_t align) {
+  // aligned_alloc wants a multiple of the alignment.
+  size_t alignment = static_cast<size_t>(align);
+  return countAllocation(
+      std::aligned_alloc(alignment, (size + alignment - 1) & -alignment));
+}
+
+void operator delete(void *ptr) noexcept { countFree(ptr); }
+void operator delete(void *ptr, size_t) noexcept { countFree(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { countFree(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+  countFree(ptr);
+}
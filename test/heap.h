@@ -0,0 +1,28 @@
+#ifndef TEST_HEAP_H
+#define TEST_HEAP_H
+
+#include <cstddef>
+
+namespace lambcalc {
+
+// The test binary replaces the global operator new and delete to count the
+// bytes on the heap. Unlike the peak RSS, the counts aren't thrown off by
+// AddressSanitizer, which holds on to freed memory for a while.
+
+// Bytes allocated with operator new that haven't been deleted yet.
+size_t liveHeapBytes();
+// Highest number of live bytes since the last resetPeakHeapBytes.
+size_t peakHeapBytes();
+void resetPeakHeapBytes();
+
+// Bytes that freeing the tree allocates on top of what was live before.
+template <typename Tree> size_t heapUsedToFree(Tree tree) {
+  size_t before = liveHeapBytes();
+  resetPeakHeapBytes();
+  tree.reset();
+  return peakHeapBytes() - before;
+}
+
+} // namespace lambcalc
+
+#endif
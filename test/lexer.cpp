@@ -1,4 +1,7 @@
 #include "lexer.h"
+#include "source.h"
+#include <cstdio>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <sstream>
 
@@ -43,4 +46,81 @@ TEST(Lexer, Tokens) {
   EXPECT_EQ(tokens, expected);
 }
 
+static std::vector<std::string> bufferTokens(BufferLexer &lexer) {
+  std::vector<std::string> tokens;
+  Token token;
+  while ((token = lexer.getToken()) != Token::Eof) {
+    switch (token) {
+    case Token::Number:
+      tokens.push_back(std::to_string(lexer.getNumber()));
+      break;
+    case Token::Identifier:
+      tokens.emplace_back(lexer.getIdentifier());
+      break;
+    case Token::Fn:
+      tokens.emplace_back("fn");
+      break;
+    case Token::Arrow:
+      tokens.emplace_back("=>");
+      break;
+    case Token::If:
+      tokens.emplace_back("if");
+      break;
+    case Token::Then:
+      tokens.emplace_back("then");
+      break;
+    case Token::Else:
+      tokens.emplace_back("else");
+      break;
+    default:
+      tokens.emplace_back(1, static_cast<char>(token));
+      break;
+    }
+  }
+  return tokens;
+}
+
+TEST(BufferLexer, Tokens) {
+  std::string source(" (fn a => a + 1 ) ( if 1  then  2 else  3)  ");
+  BufferLexer lexer(source);
+  std::vector<std::string> expected{"(", "fn",   "a", "=>", "a", "+",
+                                    "1", ")",    "(", "if", "1", "then",
+                                    "2", "else", "3", ")"};
+  EXPECT_EQ(bufferTokens(lexer), expected);
+}
+
+TEST(BufferLexer, IdentifiersAndOffsets) {
+  std::string source("fnord x12 => 4096;");
+  BufferLexer lexer(source);
+  EXPECT_EQ(lexer.getToken(), Token::Identifier);
+  EXPECT_EQ(lexer.getIdentifier(), "fnord");
+  EXPECT_EQ(lexer.getIdentifier().data(), source.data());
+  EXPECT_EQ(lexer.getToken(), Token::Identifier);
+  EXPECT_EQ(lexer.getIdentifier(), "x12");
+  EXPECT_EQ(lexer.getTokenOffset(), static_cast<size_t>(6));
+  EXPECT_EQ(lexer.getToken(), Token::Arrow);
+  EXPECT_EQ(lexer.getTokenOffset(), static_cast<size_t>(10));
+  EXPECT_EQ(lexer.getToken(), Token::Number);
+  EXPECT_EQ(lexer.getNumber(), 4096);
+  EXPECT_EQ(lexer.getToken(), Token::Semicolon);
+  EXPECT_EQ(lexer.getTokenOffset(), static_cast<size_t>(17));
+  EXPECT_EQ(lexer.getToken(), Token::Eof);
+  EXPECT_EQ(lexer.getToken(), Token::Eof);
+}
+
+TEST(BufferLexer, MappedFile) {
+  std::string path = testing::TempDir() + "lambcalc_lexer_test.lc";
+  {
+    std::ofstream out(path);
+    out << "if x then 1 else 2";
+  }
+  {
+    SourceBuffer source = SourceBuffer::fromFile(path);
+    BufferLexer lexer(source.view());
+    std::vector<std::string> expected{"if", "x", "then", "1", "else", "2"};
+    EXPECT_EQ(bufferTokens(lexer), expected);
+  }
+  std::remove(path.c_str());
+}
+
 } // namespace lambcalc
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include "lower.h"
 #include "convert.h"
+#include "threadpool.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Verifier.h"
 #include "llvm/Support/raw_os_ostream.h"
 #include <gtest/gtest.h>
+#include <set>
+#include <string>
 
 namespace lambcalc {
 
@@ -12,16 +17,19 @@ TEST(Lower, Simple) {
   auto exp = make(BopExp{"c", ast::Bop::Plus, IntValue{1}, IntValue{2},
                          make(HaltExp{VarValue{"c"}})});
   auto hoisted = anf::hoist(std::move(exp));
-  auto lowered = lower::lower(std::move(hoisted));
+  lower::Session session;
+  auto lowered = session.lower(std::move(hoisted));
   std::ostringstream out;
   llvm::raw_os_ostream rout(out);
   lowered->print(rout, nullptr);
   std::string expected = "; ModuleID = 'lambcalc program'\n"
                          "source_filename = \"lambcalc program\"\n\n"
-                         "define i64 @main() {\n"
+                         "define i64 @main() #0 {\n"
                          "entry0:\n"
                          "  ret i64 3\n"
-                         "}\n";
+                         "}\n"
+                         "\n"
+                         "attributes #0 = { nounwind willreturn }\n";
   EXPECT_EQ(out.str(), expected);
 }
 
@@ -39,13 +47,23 @@ TEST(Lower, Functions) {
                            {"c"},
                            make(HaltExp{VarValue{"c"}}),
                            make(JumpExp{"j2", {IntValue{0}}})}),
-              make(AppExp{
-                  "y", "f2", {IntValue{1}}, make(HaltExp{VarValue{"y"}})})}),
+              make(TupleExp{"clo2",
+                            {GlobValue{"f2"}},
+                            make(AppExp{"y",
+                                        "f2",
+                                        {VarValue{"clo2"}},
+                                        make(HaltExp{VarValue{"y"}})})})}),
           make(JoinExp{
               "j3", {}, make(JumpExp{"j1", {}}), make(JumpExp{"j3", {}})})}),
-      make(AppExp{"x", "f1", {IntValue{0}}, make(HaltExp{VarValue{"x"}})})});
+      make(TupleExp{"clo1",
+                    {GlobValue{"f1"}},
+                    make(AppExp{"x",
+                                "f1",
+                                {VarValue{"clo1"}},
+                                make(HaltExp{VarValue{"x"}})})})});
   auto hoisted = anf::hoist(std::move(exp));
-  auto lowered = lower::lower(std::move(hoisted));
+  lower::Session session;
+  auto lowered = session.lower(std::move(hoisted));
   std::ostringstream out;
   llvm::raw_os_ostream rout(out);
   lowered->print(rout, nullptr);
@@ -53,34 +71,117 @@ TEST(Lower, Functions) {
       "; ModuleID = 'lambcalc program'\n"
       "source_filename = \"lambcalc program\"\n"
       "\n"
-      "define i64 @f2(ptr %b) {\n"
+      "define internal ptr @f2(ptr noalias nocapture nonnull align 8 "
+      "dereferenceable(8) %b) #0 {\n"
       "entry0:\n"
-      "  %0 = alloca i64, align 8\n"
-      "  store i64 0, ptr %0, align 4\n"
       "  br label %j2\n"
       "\n"
       "j2:                                               ; preds = %entry0\n"
-      "  %c = load i64, ptr %0, align 4\n"
-      "  ret i64 %c\n"
+      "  %c = phi ptr [ getelementptr (i8, ptr null, i64 1), %entry0 ]\n"
+      "  ret ptr %c\n"
       "}\n"
       "\n"
-      "define i64 @f1(ptr %a) {\n"
+      "define internal ptr @f1(ptr nonnull align 8 %a) #1 {\n"
       "entry1:\n"
+      "  %frame = alloca [5 x ptr], align 8\n"
+      "  %heap = call ptr @lambcalc_heap()\n"
+      "  %frames = getelementptr ptr, ptr %heap, i64 2\n"
+      "  %prev = load ptr, ptr %frames, align 8\n"
+      "  store [5 x ptr] zeroinitializer, ptr %frame, align 8\n"
+      "  store ptr %prev, ptr %frame, align 8\n"
+      "  %0 = getelementptr ptr, ptr %frame, i64 1\n"
+      "  store i64 3, ptr %0, align 4\n"
+      "  store ptr %frame, ptr %frames, align 8\n"
+      "  %1 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  store ptr %a, ptr %1, align 8\n"
       "  br label %j3\n"
       "\n"
       "j1:                                               ; preds = %j3\n"
-      "  %y = call i64 @f2(i64 1)\n"
-      "  ret i64 %y\n"
+      "  %next = load ptr, ptr %heap, align 8\n"
+      "  %2 = getelementptr ptr, ptr %heap, i64 1\n"
+      "  %end = load ptr, ptr %2, align 8\n"
+      "  %bumped = getelementptr i8, ptr %next, i64 16\n"
+      "  %fits = icmp ule ptr %bumped, %end\n"
+      "  br i1 %fits, label %fast, label %slow\n"
+      "\n"
+      "fast:                                             ; preds = %j1\n"
+      "  store ptr %bumped, ptr %heap, align 8\n"
+      "  br label %allocated\n"
+      "\n"
+      "slow:                                             ; preds = %j1\n"
+      "  %refill = call ptr @lambcalc_alloc_slow(i64 16)\n"
+      "  br label %allocated\n"
+      "\n"
+      "allocated:                                        ; preds = %slow, "
+      "%fast\n"
+      "  %3 = phi ptr [ %next, %fast ], [ %refill, %slow ]\n"
+      "  store i64 3, ptr %3, align 4\n"
+      "  %clo2 = getelementptr ptr, ptr %3, i64 1\n"
+      "  %4 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  store ptr %clo2, ptr %4, align 8\n"
+      "  %5 = getelementptr ptr, ptr %clo2, i64 0\n"
+      "  store ptr @f2, ptr %5, align 8\n"
+      "  %y = call ptr @f2(ptr %clo2)\n"
+      "  %6 = getelementptr ptr, ptr %frame, i64 4\n"
+      "  store ptr %y, ptr %6, align 8\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret ptr %y\n"
       "\n"
       "j3:                                               ; preds = %entry1\n"
       "  br label %j1\n"
       "}\n"
       "\n"
-      "define i64 @main() {\n"
+      "define i64 @main() #1 {\n"
       "entry2:\n"
-      "  %x = call i64 @f1(i64 0)\n"
-      "  ret i64 %x\n"
-      "}\n";
+      "  %frame = alloca [4 x ptr], align 8\n"
+      "  %heap = call ptr @lambcalc_heap()\n"
+      "  %frames = getelementptr ptr, ptr %heap, i64 2\n"
+      "  %prev = load ptr, ptr %frames, align 8\n"
+      "  store [4 x ptr] zeroinitializer, ptr %frame, align 8\n"
+      "  store ptr %prev, ptr %frame, align 8\n"
+      "  %0 = getelementptr ptr, ptr %frame, i64 1\n"
+      "  store i64 2, ptr %0, align 4\n"
+      "  store ptr %frame, ptr %frames, align 8\n"
+      "  %next = load ptr, ptr %heap, align 8\n"
+      "  %1 = getelementptr ptr, ptr %heap, i64 1\n"
+      "  %end = load ptr, ptr %1, align 8\n"
+      "  %bumped = getelementptr i8, ptr %next, i64 16\n"
+      "  %fits = icmp ule ptr %bumped, %end\n"
+      "  br i1 %fits, label %fast, label %slow\n"
+      "\n"
+      "fast:                                             ; preds = %entry2\n"
+      "  store ptr %bumped, ptr %heap, align 8\n"
+      "  br label %allocated\n"
+      "\n"
+      "slow:                                             ; preds = %entry2\n"
+      "  %refill = call ptr @lambcalc_alloc_slow(i64 16)\n"
+      "  br label %allocated\n"
+      "\n"
+      "allocated:                                        ; preds = %slow, "
+      "%fast\n"
+      "  %2 = phi ptr [ %next, %fast ], [ %refill, %slow ]\n"
+      "  store i64 3, ptr %2, align 4\n"
+      "  %clo1 = getelementptr ptr, ptr %2, i64 1\n"
+      "  %3 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  store ptr %clo1, ptr %3, align 8\n"
+      "  %4 = getelementptr ptr, ptr %clo1, i64 0\n"
+      "  store ptr @f1, ptr %4, align 8\n"
+      "  %x = call ptr @f1(ptr %clo1)\n"
+      "  %5 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  store ptr %x, ptr %5, align 8\n"
+      "  %6 = ptrtoint ptr %x to i64\n"
+      "  %7 = ashr i64 %6, 1\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret i64 %7\n"
+      "}\n"
+      "\n"
+      "declare ptr @lambcalc_heap() #2\n"
+      "\n"
+      "declare noalias ptr @lambcalc_alloc_slow(i64) #1\n"
+      "\n"
+      "attributes #0 = { nounwind willreturn }\n"
+      "attributes #1 = { nounwind }\n"
+      "attributes #2 = { nounwind willreturn memory(inaccessiblemem: read) }\n";
   EXPECT_EQ(out.str(), expected);
 }
 
@@ -101,50 +202,147 @@ TEST(Lower, IfElse) {
                                           make(HaltExp{VarValue{"d"}})})}),
                   make(HaltExp{IntValue{5}})}),
               make(HaltExp{VarValue{"a"}})})}),
-      make(AppExp{"b",
-                  "f",
-                  {IntValue{0}, IntValue{1}}, // Pass 0 for closure for now.
-                  make(HaltExp{VarValue{"b"}})})});
+      make(TupleExp{"clo",
+                    {GlobValue{"f"}},
+                    make(AppExp{"b",
+                                "f",
+                                {VarValue{"clo"}, IntValue{1}},
+                                make(HaltExp{VarValue{"b"}})})})});
   auto hoisted = anf::hoist(std::move(exp));
-  auto lowered = lower::lower(std::move(hoisted));
+  lower::Session session;
+  auto lowered = session.lower(std::move(hoisted));
   std::ostringstream out;
   llvm::raw_os_ostream rout(out);
   lowered->print(rout, nullptr);
-  std::string expected = "; ModuleID = 'lambcalc program'\n"
-                         "source_filename = \"lambcalc program\"\n"
-                         "\n"
-                         "define i64 @f(ptr %closure, i64 %x) {\n"
-                         "entry4:\n"
-                         "  br i1 true, label %then2, label %else3\n"
-                         "\n"
-                         "then0:                                            ; "
-                         "preds = %then2\n"
-                         "  %c = add i64 %x, 3\n"
-                         "  %d = call i64 @f(i64 %c)\n"
-                         "  ret i64 %d\n"
-                         "\n"
-                         "else1:                                            ; "
-                         "preds = %then2\n"
-                         "  ret i64 5\n"
-                         "\n"
-                         "then2:                                            ; "
-                         "preds = %entry4\n"
-                         "  %0 = icmp ne i64 %x, 0\n"
-                         "  br i1 %0, label %then0, label %else1\n"
-                         "\n"
-                         "else3:                                            ; "
-                         "preds = %entry4\n"
-                         "  ret i64 3\n"
-                         "}\n"
-                         "\n"
-                         "define i64 @main() {\n"
-                         "entry5:\n"
-                         "  %b = call i64 @f(i64 0, i64 1)\n"
-                         "  ret i64 %b\n"
-                         "}\n";
+  std::string expected =
+      "; ModuleID = 'lambcalc program'\n"
+      "source_filename = \"lambcalc program\"\n"
+      "\n"
+      "define internal ptr @f(ptr nonnull align 8 %closure, ptr %x) #0 {\n"
+      "entry4:\n"
+      "  %frame = alloca [5 x ptr], align 8\n"
+      "  %heap = call ptr @lambcalc_heap()\n"
+      "  %frames = getelementptr ptr, ptr %heap, i64 2\n"
+      "  %prev = load ptr, ptr %frames, align 8\n"
+      "  store [5 x ptr] zeroinitializer, ptr %frame, align 8\n"
+      "  store ptr %prev, ptr %frame, align 8\n"
+      "  %0 = getelementptr ptr, ptr %frame, i64 1\n"
+      "  store i64 3, ptr %0, align 4\n"
+      "  store ptr %frame, ptr %frames, align 8\n"
+      "  %1 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  store ptr %closure, ptr %1, align 8\n"
+      "  %2 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  store ptr %x, ptr %2, align 8\n"
+      "  br i1 true, label %then2, label %else3\n"
+      "\n"
+      "then0:                                            ; preds = %then2\n"
+      "  %3 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  %x1 = load ptr, ptr %3, align 8\n"
+      "  %4 = ptrtoint ptr %x1 to i64\n"
+      "  %5 = ashr i64 %4, 1\n"
+      "  %c = add i64 %5, 3\n"
+      "  %6 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  %closure2 = load ptr, ptr %6, align 8\n"
+      "  %7 = shl i64 %c, 1\n"
+      "  %8 = or i64 %7, 1\n"
+      "  %9 = getelementptr i8, ptr null, i64 %8\n"
+      "  %d = call ptr @f(ptr %closure2, ptr %9)\n"
+      "  %10 = getelementptr ptr, ptr %frame, i64 4\n"
+      "  store ptr %d, ptr %10, align 8\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret ptr %d\n"
+      "\n"
+      "else1:                                            ; preds = %then2\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret ptr getelementptr (i8, ptr null, i64 11)\n"
+      "\n"
+      "then2:                                            ; preds = %entry4\n"
+      "  %11 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  %x3 = load ptr, ptr %11, align 8\n"
+      "  %12 = icmp ne ptr %x3, getelementptr (i8, ptr null, i64 1)\n"
+      "  br i1 %12, label %then0, label %else1\n"
+      "\n"
+      "else3:                                            ; preds = %entry4\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret ptr getelementptr (i8, ptr null, i64 7)\n"
+      "}\n"
+      "\n"
+      "define i64 @main() #0 {\n"
+      "entry5:\n"
+      "  %frame = alloca [4 x ptr], align 8\n"
+      "  %heap = call ptr @lambcalc_heap()\n"
+      "  %frames = getelementptr ptr, ptr %heap, i64 2\n"
+      "  %prev = load ptr, ptr %frames, align 8\n"
+      "  store [4 x ptr] zeroinitializer, ptr %frame, align 8\n"
+      "  store ptr %prev, ptr %frame, align 8\n"
+      "  %0 = getelementptr ptr, ptr %frame, i64 1\n"
+      "  store i64 2, ptr %0, align 4\n"
+      "  store ptr %frame, ptr %frames, align 8\n"
+      "  %next = load ptr, ptr %heap, align 8\n"
+      "  %1 = getelementptr ptr, ptr %heap, i64 1\n"
+      "  %end = load ptr, ptr %1, align 8\n"
+      "  %bumped = getelementptr i8, ptr %next, i64 16\n"
+      "  %fits = icmp ule ptr %bumped, %end\n"
+      "  br i1 %fits, label %fast, label %slow\n"
+      "\n"
+      "fast:                                             ; preds = %entry5\n"
+      "  store ptr %bumped, ptr %heap, align 8\n"
+      "  br label %allocated\n"
+      "\n"
+      "slow:                                             ; preds = %entry5\n"
+      "  %refill = call ptr @lambcalc_alloc_slow(i64 16)\n"
+      "  br label %allocated\n"
+      "\n"
+      "allocated:                                        ; preds = %slow, "
+      "%fast\n"
+      "  %2 = phi ptr [ %next, %fast ], [ %refill, %slow ]\n"
+      "  store i64 3, ptr %2, align 4\n"
+      "  %clo = getelementptr ptr, ptr %2, i64 1\n"
+      "  %3 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  store ptr %clo, ptr %3, align 8\n"
+      "  %4 = getelementptr ptr, ptr %clo, i64 0\n"
+      "  store ptr @f, ptr %4, align 8\n"
+      "  %b = call ptr @f(ptr %clo, ptr getelementptr (i8, ptr null, i64 3))\n"
+      "  %5 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  store ptr %b, ptr %5, align 8\n"
+      "  %6 = ptrtoint ptr %b to i64\n"
+      "  %7 = ashr i64 %6, 1\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret i64 %7\n"
+      "}\n"
+      "\n"
+      "declare ptr @lambcalc_heap() #1\n"
+      "\n"
+      "declare noalias ptr @lambcalc_alloc_slow(i64) #0\n"
+      "\n"
+      "attributes #0 = { nounwind }\n"
+      "attributes #1 = { nounwind willreturn memory(inaccessiblemem: read) }\n";
   EXPECT_EQ(out.str(), expected);
 }
 
+TEST(Lower, ConvertsOncePerBlock) {
+  // fn x => let a = x + x in let b = a * x in b, which never collects.
+  auto exp = make(FunExp{
+      "f",
+      {"closure", "x"},
+      make(BopExp{"a", ast::Bop::Plus, VarValue{"x"}, VarValue{"x"},
+                  make(BopExp{"b", ast::Bop::Times, VarValue{"a"},
+                              VarValue{"x"}, make(HaltExp{VarValue{"b"}})})}),
+      make(HaltExp{IntValue{0}})});
+  auto hoisted = anf::hoist(std::move(exp));
+  lower::Session session;
+  auto lowered = session.lower(std::move(hoisted));
+  EXPECT_FALSE(verifyModule(*lowered, &errs()));
+  // x is untagged for its first use and the result is tagged to return it.
+  size_t untagged = 0, tagged = 0;
+  for (auto &inst : instructions(*lowered->getFunction("f"))) {
+    untagged += isa<PtrToIntInst>(inst);
+    tagged += isa<GetElementPtrInst>(inst);
+  }
+  EXPECT_EQ(untagged, 1u);
+  EXPECT_EQ(tagged, 1u);
+}
+
 TEST(Lower, AppClosure) {
   // (fn g => (fn x => g x) (fn y => g y))
   // let f1 = fn g =>
@@ -190,7 +388,8 @@ TEST(Lower, AppClosure) {
   EXPECT_EQ(converted->dump(), expectedANF);
 
   auto hoisted = anf::hoist(std::move(converted));
-  auto lowered = lower::lower(std::move(hoisted));
+  lower::Session session;
+  auto lowered = session.lower(std::move(hoisted));
   std::ostringstream out;
   llvm::raw_os_ostream rout(out);
   lowered->print(rout, nullptr);
@@ -198,67 +397,262 @@ TEST(Lower, AppClosure) {
       "; ModuleID = 'lambcalc program'\n"
       "source_filename = \"lambcalc program\"\n"
       "\n"
-      "define i64 @f2(ptr %closure1, i64 %x) {\n"
+      "define internal ptr @f2(ptr nonnull align 8 %closure1, ptr %x) #0 {\n"
       "entry0:\n"
-      "  %0 = getelementptr i64, ptr %closure1, i64 1\n"
-      "  %g = load i64, ptr %0, align 4\n"
-      "  %1 = inttoptr i64 %g to ptr\n"
-      "  %2 = getelementptr i64, ptr %1, i64 0\n"
-      "  %proj5 = load i64, ptr %2, align 4\n"
-      "  %3 = inttoptr i64 %proj5 to ptr\n"
-      "  %t1 = call i64 %3(i64 %g, i64 %x)\n"
-      "  ret i64 %t1\n"
+      "  %frame = alloca [6 x ptr], align 8\n"
+      "  %heap = call ptr @lambcalc_heap()\n"
+      "  %frames = getelementptr ptr, ptr %heap, i64 2\n"
+      "  %prev = load ptr, ptr %frames, align 8\n"
+      "  store [6 x ptr] zeroinitializer, ptr %frame, align 8\n"
+      "  store ptr %prev, ptr %frame, align 8\n"
+      "  %0 = getelementptr ptr, ptr %frame, i64 1\n"
+      "  store i64 4, ptr %0, align 4\n"
+      "  store ptr %frame, ptr %frames, align 8\n"
+      "  %1 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  store ptr %closure1, ptr %1, align 8\n"
+      "  %2 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  store ptr %x, ptr %2, align 8\n"
+      "  %3 = getelementptr ptr, ptr %closure1, i64 1\n"
+      "  %g = load ptr, ptr %3, align 8\n"
+      "  %4 = getelementptr ptr, ptr %frame, i64 4\n"
+      "  store ptr %g, ptr %4, align 8\n"
+      "  %5 = getelementptr ptr, ptr %g, i64 0\n"
+      "  %proj5 = load ptr, ptr %5, align 8, !nonnull !0\n"
+      "  %t1 = call ptr %proj5(ptr %g, ptr %x)\n"
+      "  %6 = getelementptr ptr, ptr %frame, i64 5\n"
+      "  store ptr %t1, ptr %6, align 8\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret ptr %t1\n"
       "}\n"
       "\n"
-      "define i64 @f3(ptr %closure2, i64 %y) {\n"
+      "define internal ptr @f3(ptr nonnull align 8 %closure2, ptr %y) #0 {\n"
       "entry1:\n"
-      "  %0 = getelementptr i64, ptr %closure2, i64 2\n"
-      "  %g = load i64, ptr %0, align 4\n"
-      "  %1 = getelementptr i64, ptr %closure2, i64 1\n"
-      "  %f2 = load i64, ptr %1, align 4\n"
-      "  %2 = inttoptr i64 %g to ptr\n"
-      "  %3 = getelementptr i64, ptr %2, i64 0\n"
-      "  %proj4 = load i64, ptr %3, align 4\n"
-      "  %4 = inttoptr i64 %proj4 to ptr\n"
-      "  %t2 = call i64 %4(i64 %g, i64 %y)\n"
-      "  ret i64 %t2\n"
+      "  %frame = alloca [7 x ptr], align 8\n"
+      "  %heap = call ptr @lambcalc_heap()\n"
+      "  %frames = getelementptr ptr, ptr %heap, i64 2\n"
+      "  %prev = load ptr, ptr %frames, align 8\n"
+      "  store [7 x ptr] zeroinitializer, ptr %frame, align 8\n"
+      "  store ptr %prev, ptr %frame, align 8\n"
+      "  %0 = getelementptr ptr, ptr %frame, i64 1\n"
+      "  store i64 5, ptr %0, align 4\n"
+      "  store ptr %frame, ptr %frames, align 8\n"
+      "  %1 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  store ptr %closure2, ptr %1, align 8\n"
+      "  %2 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  store ptr %y, ptr %2, align 8\n"
+      "  %3 = getelementptr ptr, ptr %closure2, i64 2\n"
+      "  %g = load ptr, ptr %3, align 8\n"
+      "  %4 = getelementptr ptr, ptr %frame, i64 4\n"
+      "  store ptr %g, ptr %4, align 8\n"
+      "  %5 = getelementptr ptr, ptr %closure2, i64 1\n"
+      "  %f2 = load ptr, ptr %5, align 8\n"
+      "  %6 = getelementptr ptr, ptr %frame, i64 5\n"
+      "  store ptr %f2, ptr %6, align 8\n"
+      "  %7 = getelementptr ptr, ptr %g, i64 0\n"
+      "  %proj4 = load ptr, ptr %7, align 8, !nonnull !0\n"
+      "  %t2 = call ptr %proj4(ptr %g, ptr %y)\n"
+      "  %8 = getelementptr ptr, ptr %frame, i64 6\n"
+      "  store ptr %t2, ptr %8, align 8\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret ptr %t2\n"
       "}\n"
       "\n"
-      "define i64 @f1(ptr %closure0, i64 %g) {\n"
+      "define internal ptr @f1(ptr nonnull align 8 %closure0, ptr %g) #0 {\n"
       "entry2:\n"
-      "  %f2 = call ptr @malloc(i64 16)\n"
-      "  %0 = ptrtoint ptr %f2 to i64\n"
-      "  %1 = getelementptr i64, ptr %f2, i64 0\n"
-      "  store i64 ptrtoint (ptr @f2 to i64), ptr %1, align 4\n"
-      "  %2 = getelementptr i64, ptr %f2, i64 1\n"
-      "  store i64 %g, ptr %2, align 4\n"
-      "  %f3 = call ptr @malloc(i64 24)\n"
-      "  %3 = ptrtoint ptr %f3 to i64\n"
-      "  %4 = getelementptr i64, ptr %f3, i64 0\n"
-      "  store i64 ptrtoint (ptr @f3 to i64), ptr %4, align 4\n"
-      "  %5 = getelementptr i64, ptr %f3, i64 1\n"
-      "  store i64 %0, ptr %5, align 4\n"
-      "  %6 = getelementptr i64, ptr %f3, i64 2\n"
-      "  store i64 %g, ptr %6, align 4\n"
-      "  %7 = inttoptr i64 %0 to ptr\n"
-      "  %8 = getelementptr i64, ptr %7, i64 0\n"
-      "  %proj3 = load i64, ptr %8, align 4\n"
-      "  %9 = inttoptr i64 %proj3 to ptr\n"
-      "  %t3 = call i64 %9(i64 %0, i64 %3)\n"
-      "  ret i64 %t3\n"
+      "  %frame = alloca [7 x ptr], align 8\n"
+      "  %heap = call ptr @lambcalc_heap()\n"
+      "  %frames = getelementptr ptr, ptr %heap, i64 2\n"
+      "  %prev = load ptr, ptr %frames, align 8\n"
+      "  store [7 x ptr] zeroinitializer, ptr %frame, align 8\n"
+      "  store ptr %prev, ptr %frame, align 8\n"
+      "  %0 = getelementptr ptr, ptr %frame, i64 1\n"
+      "  store i64 5, ptr %0, align 4\n"
+      "  store ptr %frame, ptr %frames, align 8\n"
+      "  %1 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  store ptr %closure0, ptr %1, align 8\n"
+      "  %2 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  store ptr %g, ptr %2, align 8\n"
+      "  %next = load ptr, ptr %heap, align 8\n"
+      "  %3 = getelementptr ptr, ptr %heap, i64 1\n"
+      "  %end = load ptr, ptr %3, align 8\n"
+      "  %bumped = getelementptr i8, ptr %next, i64 24\n"
+      "  %fits = icmp ule ptr %bumped, %end\n"
+      "  br i1 %fits, label %fast, label %slow\n"
+      "\n"
+      "fast:                                             ; preds = %entry2\n"
+      "  store ptr %bumped, ptr %heap, align 8\n"
+      "  br label %allocated\n"
+      "\n"
+      "slow:                                             ; preds = %entry2\n"
+      "  %refill = call ptr @lambcalc_alloc_slow(i64 24)\n"
+      "  br label %allocated\n"
+      "\n"
+      "allocated:                                        ; preds = %slow, "
+      "%fast\n"
+      "  %4 = phi ptr [ %next, %fast ], [ %refill, %slow ]\n"
+      "  store i64 5, ptr %4, align 4\n"
+      "  %f2 = getelementptr ptr, ptr %4, i64 1\n"
+      "  %5 = getelementptr ptr, ptr %frame, i64 4\n"
+      "  store ptr %f2, ptr %5, align 8\n"
+      "  %6 = getelementptr ptr, ptr %f2, i64 0\n"
+      "  store ptr @f2, ptr %6, align 8\n"
+      "  %7 = getelementptr ptr, ptr %f2, i64 1\n"
+      "  %8 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  %g1 = load ptr, ptr %8, align 8\n"
+      "  store ptr %g1, ptr %7, align 8\n"
+      "  %next2 = load ptr, ptr %heap, align 8\n"
+      "  %9 = getelementptr ptr, ptr %heap, i64 1\n"
+      "  %end3 = load ptr, ptr %9, align 8\n"
+      "  %bumped4 = getelementptr i8, ptr %next2, i64 32\n"
+      "  %fits5 = icmp ule ptr %bumped4, %end3\n"
+      "  br i1 %fits5, label %fast6, label %slow7\n"
+      "\n"
+      "fast6:                                            ; preds = %allocated\n"
+      "  store ptr %bumped4, ptr %heap, align 8\n"
+      "  br label %allocated8\n"
+      "\n"
+      "slow7:                                            ; preds = %allocated\n"
+      "  %refill9 = call ptr @lambcalc_alloc_slow(i64 32)\n"
+      "  br label %allocated8\n"
+      "\n"
+      "allocated8:                                       ; preds = %slow7, "
+      "%fast6\n"
+      "  %10 = phi ptr [ %next2, %fast6 ], [ %refill9, %slow7 ]\n"
+      "  store i64 7, ptr %10, align 4\n"
+      "  %f3 = getelementptr ptr, ptr %10, i64 1\n"
+      "  %11 = getelementptr ptr, ptr %frame, i64 5\n"
+      "  store ptr %f3, ptr %11, align 8\n"
+      "  %12 = getelementptr ptr, ptr %f3, i64 0\n"
+      "  store ptr @f3, ptr %12, align 8\n"
+      "  %13 = getelementptr ptr, ptr %f3, i64 1\n"
+      "  %14 = getelementptr ptr, ptr %frame, i64 4\n"
+      "  %f210 = load ptr, ptr %14, align 8\n"
+      "  store ptr %f210, ptr %13, align 8\n"
+      "  %15 = getelementptr ptr, ptr %f3, i64 2\n"
+      "  %16 = getelementptr ptr, ptr %frame, i64 3\n"
+      "  %g11 = load ptr, ptr %16, align 8\n"
+      "  store ptr %g11, ptr %15, align 8\n"
+      "  %17 = getelementptr ptr, ptr %f210, i64 0\n"
+      "  %proj3 = load ptr, ptr %17, align 8, !nonnull !0\n"
+      "  %t3 = call ptr %proj3(ptr %f210, ptr %f3)\n"
+      "  %18 = getelementptr ptr, ptr %frame, i64 6\n"
+      "  store ptr %t3, ptr %18, align 8\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret ptr %t3\n"
       "}\n"
       "\n"
-      "define i64 @main() {\n"
+      "define i64 @main() #0 {\n"
       "entry3:\n"
-      "  %f1 = call ptr @malloc(i64 8)\n"
-      "  %0 = ptrtoint ptr %f1 to i64\n"
-      "  %1 = getelementptr i64, ptr %f1, i64 0\n"
-      "  store i64 ptrtoint (ptr @f1 to i64), ptr %1, align 4\n"
-      "  ret i64 %0\n"
+      "  %frame = alloca [3 x ptr], align 8\n"
+      "  %heap = call ptr @lambcalc_heap()\n"
+      "  %frames = getelementptr ptr, ptr %heap, i64 2\n"
+      "  %prev = load ptr, ptr %frames, align 8\n"
+      "  store [3 x ptr] zeroinitializer, ptr %frame, align 8\n"
+      "  store ptr %prev, ptr %frame, align 8\n"
+      "  %0 = getelementptr ptr, ptr %frame, i64 1\n"
+      "  store i64 1, ptr %0, align 4\n"
+      "  store ptr %frame, ptr %frames, align 8\n"
+      "  %next = load ptr, ptr %heap, align 8\n"
+      "  %1 = getelementptr ptr, ptr %heap, i64 1\n"
+      "  %end = load ptr, ptr %1, align 8\n"
+      "  %bumped = getelementptr i8, ptr %next, i64 16\n"
+      "  %fits = icmp ule ptr %bumped, %end\n"
+      "  br i1 %fits, label %fast, label %slow\n"
+      "\n"
+      "fast:                                             ; preds = %entry3\n"
+      "  store ptr %bumped, ptr %heap, align 8\n"
+      "  br label %allocated\n"
+      "\n"
+      "slow:                                             ; preds = %entry3\n"
+      "  %refill = call ptr @lambcalc_alloc_slow(i64 16)\n"
+      "  br label %allocated\n"
+      "\n"
+      "allocated:                                        ; preds = %slow, "
+      "%fast\n"
+      "  %2 = phi ptr [ %next, %fast ], [ %refill, %slow ]\n"
+      "  store i64 3, ptr %2, align 4\n"
+      "  %f1 = getelementptr ptr, ptr %2, i64 1\n"
+      "  %3 = getelementptr ptr, ptr %frame, i64 2\n"
+      "  store ptr %f1, ptr %3, align 8\n"
+      "  %4 = getelementptr ptr, ptr %f1, i64 0\n"
+      "  store ptr @f1, ptr %4, align 8\n"
+      "  %5 = ptrtoint ptr %f1 to i64\n"
+      "  %6 = ashr i64 %5, 1\n"
+      "  store ptr %prev, ptr %frames, align 8\n"
+      "  ret i64 %6\n"
       "}\n"
       "\n"
-      "declare ptr @malloc(i64)\n";
+      "declare ptr @lambcalc_heap() #1\n"
+      "\n"
+      "declare noalias ptr @lambcalc_alloc_slow(i64) #0\n"
+      "\n"
+      "attributes #0 = { nounwind }\n"
+      "attributes #1 = { nounwind willreturn memory(inaccessiblemem: read) }\n"
+      "\n"
+      "!0 = !{}\n";
   EXPECT_EQ(out.str(), expectedLLVM);
 }
 
+TEST(Lower, Optimized) {
+  // (fn x => x + 1) 2
+  auto exp = make(FunExp{
+      "f",
+      {"x"},
+      make(BopExp{"y", ast::Bop::Plus, VarValue{"x"}, IntValue{1},
+                  make(HaltExp{VarValue{"y"}})}),
+      make(AppExp{"r", "f", {IntValue{2}}, make(HaltExp{VarValue{"r"}})})});
+  auto hoisted = anf::hoist(convert::closureConvert(std::move(exp)));
+  lower::Session session(DataLayout(""), lower::OptLevel::O2);
+  auto lowered = session.lower(std::move(hoisted));
+  EXPECT_FALSE(verifyModule(*lowered, &errs()));
+  // The closure is inlined through its environment and folded away. Its
+  // allocation stays, so main may branch on whether the heap has room.
+  size_t returns = 0;
+  for (auto &block : *lowered->getFunction("main")) {
+    auto ret = dyn_cast<ReturnInst>(block.getTerminator());
+    if (ret == nullptr) {
+      continue;
+    }
+    ++returns;
+    auto value = dyn_cast<ConstantInt>(ret->getReturnValue());
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(value->getSExtValue(), 3);
+  }
+  EXPECT_GT(returns, 0u);
+}
+
+TEST(Lower, Partitioned) {
+  // fn a => fn b => ... fn z => 1, applied to nothing.
+  std::unique_ptr<Exp> exp = make(HaltExp{IntValue{1}});
+  std::set<std::string> expected = {"main"};
+  for (char c = 'z'; c >= 'a'; --c) {
+    std::string name = std::string("f") + c;
+    exp = make(FunExp{name, {std::string(1, c)}, std::move(exp),
+                      make(HaltExp{VarValue{name}})});
+    expected.insert(name);
+  }
+  auto hoisted = anf::hoist(convert::closureConvert(std::move(exp)));
+  ThreadPool pool(4);
+  std::vector<std::unique_ptr<lower::Session>> sessions;
+  for (size_t i = 0; i < 4; ++i) {
+    sessions.push_back(std::make_unique<lower::Session>(DataLayout("")));
+  }
+  auto modules = lower::lowerPartitioned(std::move(hoisted), sessions, pool);
+  EXPECT_EQ(modules.size(), 4u);
+  // Every function is defined exactly once, and the modules stay valid with
+  // declarations of the others.
+  std::set<std::string> defined;
+  for (auto &tsm : modules) {
+    tsm.withModuleDo([&](Module &module) {
+      EXPECT_FALSE(verifyModule(module, &errs()));
+      for (auto &fn : module) {
+        if (!fn.isDeclaration()) {
+          EXPECT_TRUE(defined.insert(fn.getName().str()).second);
+        }
+      }
+    });
+  }
+  EXPECT_EQ(defined, expected);
+}
+
 } // namespace lambcalc
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "tokenize.h"
 #include <gtest/gtest.h>
 #include <sstream>
 
@@ -54,4 +55,131 @@ TEST(Parser, ZCombinator) {
   EXPECT_EQ(exp->dump(), expected);
 }
 
+TEST(Parser, BufferLexer) {
+  std::string source("if x then x * f (x - 1) else 1");
+  std::allocator<ast::Exp<>> allocator;
+  BufferLexer lexer(source);
+  Parser parser(allocator, lexer, defaultInfixBp);
+  auto exp = parser.parseExpression();
+  std::string expected = "(if x then (x * (f (x - 1))) else 1)";
+  EXPECT_EQ(exp->dump(), expected);
+}
+
+TEST(IterativeParser, SameTreesAsParser) {
+  std::vector<std::string> sources{
+      " (fn a => a + 1 + 2 * 3 * 4 + 5 ) ",
+      "a b c + d e f",
+      "if x then x * f (x - 1) else 1",
+      "(fn g => (fn x => g (fn v => x x v)) (fn x => g (fn v => x x v))) (fn f "
+      "=> fn x => if x then (if x - 1 then x * f (x - 1) else 1) else 1) 5",
+      "f (if a then b else c) - fn x => x * (y z) + 1",
+      "1 - 2 - 3 * 4 * (5 - 6) a",
+  };
+  for (const auto &source : sources) {
+    std::allocator<ast::Exp<>> allocator;
+    std::istringstream is1(source), is2(source);
+    Lexer lexer1(is1), lexer2(is2);
+    Parser parser(allocator, lexer1, defaultInfixBp);
+    IterativeParser iterativeParser(allocator, lexer2);
+    EXPECT_EQ(iterativeParser.parseExpression()->dump(),
+              parser.parseExpression()->dump());
+  }
+}
+
+TEST(IterativeParser, ExpressionSequence) {
+  std::string source("1 + 2; fn x => x; ");
+  TokenArray tokens = tokenize(source);
+  TokenArrayLexer lexer(source, tokens);
+  std::allocator<ast::Exp<>> allocator;
+  IterativeParser parser(allocator, lexer);
+  EXPECT_EQ(parser.parseExpression()->dump(), "(1 + 2)");
+  EXPECT_EQ(parser.peekToken(), Token::Semicolon);
+  parser.nextToken();
+  EXPECT_EQ(parser.parseExpression()->dump(), "(fn x => x)");
+  parser.nextToken();
+  EXPECT_THROW(parser.parseExpression(), ParserException);
+}
+
+TEST(IterativeParser, NoStackOverflow) {
+  constexpr size_t depth = 20000;
+  std::string source;
+  for (size_t i = 0; i < depth; ++i) {
+    source += "(fn x => if x then ";
+  }
+  source += "x";
+  for (size_t i = 0; i < depth; ++i) {
+    source += " else 1)";
+  }
+  TokenArray tokens = tokenize(source);
+  TokenArrayLexer lexer(source, tokens);
+  std::allocator<ast::Exp<>> allocator;
+  IterativeParser parser(allocator, lexer);
+  auto exp = parser.parseExpression();
+
+  size_t lams = 0;
+  ast::Exp<> *current = exp.get();
+  while (auto lam = std::get_if<ast::LamExp<std::unique_ptr>>(current)) {
+    ++lams;
+    current = std::get<ast::IfExp<std::unique_ptr>>(*lam->body).then.get();
+  }
+  EXPECT_EQ(lams, depth);
+  EXPECT_EQ(current->dump(), "x");
+}
+
+TEST(Parser, ReportsErrorSpans) {
+  std::istringstream is("fn x 1");
+  std::allocator<ast::Exp<>> allocator;
+  Lexer lexer(is);
+  Parser parser(allocator, lexer, defaultInfixBp);
+  auto exp = parser.tryParseExpression();
+  ASSERT_FALSE(exp);
+  EXPECT_EQ(exp.error().message,
+            "Expected '=>' after function parameter but found number");
+  EXPECT_EQ(exp.error().span->begin, 5u);
+  EXPECT_EQ(exp.error().span->end, 6u);
+
+  std::istringstream is2("(1 + 2");
+  Lexer lexer2(is2);
+  Parser parser2(allocator, lexer2, defaultInfixBp);
+  exp = parser2.tryParseExpression();
+  ASSERT_FALSE(exp);
+  EXPECT_EQ(exp.error().message, "Expected ')' but found end of input");
+  EXPECT_EQ(exp.error().span->begin, 6u);
+}
+
+TEST(IterativeParser, RecoversAfterErrors) {
+  std::string source("fn => 1; (1 + 2; if 1 then 2 3; 4 + 5;");
+  TokenArray tokens = tokenize(source);
+  TokenArrayLexer lexer(source, tokens);
+  std::allocator<ast::Exp<>> allocator;
+  IterativeParser parser(allocator, lexer);
+  std::vector<std::string> parsed;
+  std::vector<Diagnostic> errors;
+  while (true) {
+    while (parser.peekToken() == Token::Semicolon) {
+      parser.nextToken();
+    }
+    if (parser.peekToken() == Token::Eof) {
+      break;
+    }
+    auto exp = parser.tryParseExpression();
+    if (exp) {
+      parsed.push_back((*exp)->dump());
+    } else {
+      errors.push_back(exp.error());
+      parser.recover();
+    }
+  }
+  EXPECT_EQ(parsed, std::vector<std::string>{"(4 + 5)"});
+  ASSERT_EQ(errors.size(), 3u);
+  EXPECT_EQ(errors[0].message, "Expected function parameter but found '=>'");
+  EXPECT_EQ(errors[0].span->begin, 3u);
+  EXPECT_EQ(errors[0].span->end, 5u);
+  EXPECT_EQ(errors[1].message, "Expected ')' but found ';'");
+  EXPECT_EQ(errors[1].span->begin, 15u);
+  EXPECT_EQ(errors[2].message,
+            "Expected 'else' after then expression but found ';'");
+  EXPECT_EQ(errors[2].span->begin, 30u);
+}
+
 } // namespace lambcalc
\ No newline at end of file
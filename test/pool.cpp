@@ -0,0 +1,80 @@
+#include "anf.h"
+#include "parser.h"
+#include "pool.h"
+#include "rename.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <vector>
+
+namespace lambcalc {
+
+using namespace ast;
+
+static_assert(sizeof(pool::index_ptr<PoolExp>) == sizeof(uint32_t));
+
+static pool::index_ptr<PoolExp> parse(pool::NodePool<PoolExp> &nodes,
+                                      const std::string &source) {
+  std::istringstream is(source);
+  Lexer lexer(is);
+  pool::TypedAllocator<PoolExp> allocator(nodes);
+  IterativeParser<pool::index_ptr, pool::TypedAllocator<PoolExp>> parser(
+      allocator, lexer);
+  return parser.parseExpression();
+}
+
+TEST(NodePool, Parse) {
+  pool::NodePool<PoolExp> nodes;
+  pool::NodePool<PoolExp>::Scope scope(nodes);
+  auto exp = parse(nodes, "(fn x => if x then x * 2 else 1) 3");
+  EXPECT_EQ(nodes.size(), 9u);
+  EXPECT_EQ(exp->dump(), "((fn x => (if x then (x * 2) else 1)) 3)");
+}
+
+TEST(NodePool, CompactPreorder) {
+  pool::NodePool<PoolExp> nodes;
+  pool::NodePool<PoolExp> compacted;
+  pool::index_ptr<PoolExp> exp;
+  {
+    pool::NodePool<PoolExp>::Scope scope(nodes);
+    exp = parse(nodes, "(fn x => if x then x * 2 else 1) 3");
+    exp = compact(compacted, *exp);
+  }
+  pool::NodePool<PoolExp>::Scope scope(compacted);
+  EXPECT_EQ(exp.index(), 0u);
+  EXPECT_EQ(exp->dump(), "((fn x => (if x then (x * 2) else 1)) 3)");
+
+  std::vector<size_t> kinds;
+  for (auto &node : compacted.nodes()) {
+    kinds.push_back(node.index());
+  }
+  // App, Lam, If, Var, Bop, Var, Int, Int, Int
+  std::vector<size_t> expected{3, 2, 5, 1, 4, 1, 0, 0, 0};
+  EXPECT_EQ(kinds, expected);
+  auto &app = std::get<AppExp<pool::index_ptr>>(*exp);
+  EXPECT_EQ(app.fn.index(), 1u);
+  EXPECT_EQ(app.arg.index(), 8u);
+}
+
+TEST(NodePool, RenameAndConvert) {
+  std::string source("(fn x => (fn y => x + y) 2) 1");
+  pool::NodePool<PoolExp> nodes;
+  pool::NodePool<PoolExp>::Scope scope(nodes);
+  auto exp = parse(nodes, source);
+  rename(*exp);
+
+  std::istringstream is(source);
+  Lexer lexer(is);
+  std::allocator<Exp<>> allocator;
+  Parser parser(allocator, lexer, {{Bop::Plus, {{1, 2}}}});
+  auto expected = parser.parseExpression();
+  rename(*expected);
+  EXPECT_EQ(exp->dump(), expected->dump());
+
+  anf::resetCounter();
+  auto converted = anf::convertDefunc(*exp);
+  anf::resetCounter();
+  auto expectedConverted = anf::convertDefunc(*expected);
+  EXPECT_EQ(converted->dump(), expectedConverted->dump());
+}
+
+} // namespace lambcalc
\ No newline at end of file
@@ -1,5 +1,7 @@
+#include "parser.h"
 #include "rename.h"
 #include <gtest/gtest.h>
+#include <sstream>
 
 namespace lambcalc {
 
@@ -46,4 +48,59 @@ TEST(AlphaRename, RestoresBindingOnLamExit) {
   EXPECT_EQ(exp->dump(), expected);
 }
 
+static std::unique_ptr<Exp<>> parse(const std::string &source) {
+  std::istringstream is(source);
+  Lexer lexer(is);
+  std::allocator<Exp<>> allocator;
+  IterativeParser<std::unique_ptr, std::allocator<Exp<>>> parser(allocator,
+                                                                  lexer);
+  return parser.parseExpression();
+}
+
+TEST(Resolve, DeBruijnIndices) {
+  auto exp = parse("fn a => fn b => (fn a => a + b) a");
+  resolve(*exp);
+  auto &outer = std::get<LamExp<std::unique_ptr>>(*exp);
+  auto &inner = std::get<LamExp<std::unique_ptr>>(*outer.body);
+  auto &app = std::get<AppExp<std::unique_ptr>>(*inner.body);
+  auto &shadowing = std::get<LamExp<std::unique_ptr>>(*app.fn);
+  auto &bop = std::get<BopExp<std::unique_ptr>>(*shadowing.body);
+  EXPECT_EQ(std::get<VarExp>(*bop.arg1).index, 0);
+  EXPECT_EQ(std::get<VarExp>(*bop.arg2).index, 1);
+  EXPECT_EQ(std::get<VarExp>(*app.arg).index, 1);
+  // Names are left alone.
+  EXPECT_EQ(exp->dump(), "(fn a => (fn b => ((fn a => (a + b)) a)))");
+}
+
+TEST(Resolve, NotInScope) {
+  auto exp = parse("fn a => (fn b => b) b");
+  EXPECT_THROW(resolve(*exp), NotInScopeException);
+}
+
+TEST(AlphaEquivalent, Simple) {
+  auto a = parse("fn x => fn y => if x then y else (fn x => x) 1");
+  auto b = parse("fn f => fn g => if f then g else (fn h => h) 1");
+  auto c = parse("fn f => fn g => if g then f else (fn h => h) 1");
+  resolve(*a);
+  resolve(*b);
+  resolve(*c);
+  EXPECT_TRUE(alphaEquivalent(*a, *b));
+  EXPECT_FALSE(alphaEquivalent(*a, *c));
+
+  auto d = parse("fn x => x + 1");
+  auto e = parse("fn x => x - 1");
+  resolve(*d);
+  resolve(*e);
+  EXPECT_FALSE(alphaEquivalent(*d, *e));
+}
+
+TEST(AlphaEquivalent, Unresolved) {
+  auto a = parse("fn x => y");
+  auto b = parse("fn z => y");
+  auto c = parse("fn y => y");
+  EXPECT_TRUE(alphaEquivalent(*a, *b));
+  resolve(*c);
+  EXPECT_FALSE(alphaEquivalent(*a, *c));
+}
+
 } // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "runtime.h"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <thread>
+
+namespace lambcalc {
+
+using namespace runtime;
+
+// Shadow stack frame with the given number of roots, pushed for as long as it
+// is in scope.
+template <size_t N> struct Roots {
+  Frame frame;
+  void *roots[N];
+
+  Roots() : frame{lambcalc_heap()->frames, N} {
+    std::fill(std::begin(roots), std::end(roots), tagged(0));
+    lambcalc_heap()->frames = &frame;
+  }
+  ~Roots() { lambcalc_heap()->frames = frame.prev; }
+};
+
+TEST(Runtime, MovesReachableObjects) {
+  reset();
+  configure({.heapSize = 4096});
+  {
+    Roots<2> stack;
+    void **inner = allocate(2);
+    inner[0] = nullptr;
+    inner[1] = tagged(42);
+    stack.roots[0] = inner;
+    void **outer = allocate(3);
+    outer[0] = nullptr;
+    outer[1] = stack.roots[0];
+    outer[2] = stack.roots[0];
+    stack.roots[0] = outer;
+    stack.roots[1] = tagged(7);
+    // Enough garbage to fill the heap a few times over.
+    for (int i = 0; i < 1000; ++i) {
+      allocate(4)[0] = nullptr;
+    }
+    EXPECT_GT(stats().collections, 0u);
+    outer = static_cast<void **>(stack.roots[0]);
+    // Objects are copied once, so sharing is kept.
+    EXPECT_EQ(outer[1], outer[2]);
+    EXPECT_EQ(static_cast<void **>(outer[1])[1], tagged(42));
+    EXPECT_EQ(stack.roots[1], tagged(7));
+    // Only the two reachable objects are left after collecting, starting
+    // with the roots.
+    collect();
+    char *begin = static_cast<char *>(stack.roots[0]) - sizeof(void *);
+    EXPECT_EQ(lambcalc_heap()->next - begin, 7 * sizeof(void *));
+  }
+  reset();
+  configure({});
+}
+
+TEST(Runtime, GrowsForLiveObjects) {
+  reset();
+  configure({.heapSize = 4096});
+  constexpr int length = 10000;
+  {
+    Roots<1> stack;
+    for (int i = 0; i < length; ++i) {
+      void **node = allocate(3);
+      node[0] = nullptr;
+      node[1] = tagged(i);
+      node[2] = stack.roots[0];
+      stack.roots[0] = node;
+    }
+    EXPECT_GT(stats().heapSize, 4096u);
+    int count = 0;
+    for (void *node = stack.roots[0]; node != tagged(0);
+         node = static_cast<void **>(node)[2]) {
+      EXPECT_EQ(static_cast<void **>(node)[1], tagged(length - 1 - count));
+      ++count;
+    }
+    EXPECT_EQ(count, length);
+  }
+  // Resetting gives back the spaces that grew past the heap size.
+  reset();
+  EXPECT_EQ(bytesMapped(), 0u);
+  configure({});
+}
+
+TEST(Runtime, KeepsSpacesAcrossResets) {
+  reset();
+  configure({.heapSize = 1000});
+  reset();
+  allocate(1)[0] = nullptr;
+  char *end = lambcalc_heap()->end;
+  // The space was mapped in whole pages, which is the configured size, so
+  // it's reused instead of mapped again.
+  reset();
+  EXPECT_EQ(lambcalc_heap()->end, end);
+  configure({});
+  reset();
+}
+
+TEST(Runtime, HeapPerThread) {
+  Heap *heap = lambcalc_heap();
+  Heap *other = nullptr;
+  std::thread([&] { other = lambcalc_heap(); }).join();
+  EXPECT_NE(heap, other);
+}
+
+} // namespace lambcalc
\ No newline at end of file
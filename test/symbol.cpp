@@ -0,0 +1,137 @@
+#include "symbol.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace lambcalc {
+
+static_assert(sizeof(Symbol) == sizeof(uint32_t));
+
+TEST(Symbol, Interning) {
+  Symbol a("abc");
+  std::string spelling = "ab";
+  spelling += "c";
+  Symbol b(spelling);
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.id(), b.id());
+  EXPECT_NE(a, Symbol("abd"));
+  EXPECT_EQ(a.str(), "abc");
+  EXPECT_LT(a.id(), Symbol::count());
+  EXPECT_EQ(Symbol().str(), "");
+}
+
+TEST(Symbol, Fresh) {
+  auto symbol = Symbol::fresh("tmp", 12);
+  EXPECT_TRUE(symbol.isFresh());
+  EXPECT_EQ(symbol.str(), "tmp12");
+  std::ostringstream out;
+  out << symbol;
+  EXPECT_EQ(out.str(), "tmp12");
+  // Fresh symbols are distinct from each other and from interned symbols,
+  // even with the same spelling.
+  Symbol interned("tmp12");
+  EXPECT_FALSE(interned.isFresh());
+  EXPECT_NE(symbol, interned);
+  EXPECT_NE(symbol, Symbol::fresh("tmp", 12));
+  EXPECT_NE(symbol <=> interned, std::strong_ordering::equal);
+  // Fresh prefixes are spelled too.
+  EXPECT_EQ(Symbol::fresh(symbol, 3).str(), "tmp123");
+}
+
+TEST(Symbol, ResetFresh) {
+  Symbol::resetFresh();
+  size_t count = Symbol::count();
+  auto first = Symbol::fresh("reset", 0);
+  for (int i = 0; i < 100; ++i) {
+    Symbol::fresh("reset", i);
+  }
+  // Fresh symbols aren't interned, and start over from the same slot.
+  EXPECT_EQ(Symbol::count(), count + 1);
+  Symbol::resetFresh();
+  auto again = Symbol::fresh("reset", 1);
+  EXPECT_EQ(again.slot(), first.slot());
+  EXPECT_EQ(again.str(), "reset1");
+}
+
+TEST(Symbol, OrderedBySpelling) {
+  // Intern the later spelling first so ids and spellings disagree.
+  Symbol z("order_z");
+  Symbol a("order_a");
+  EXPECT_GT(a.id(), z.id());
+  EXPECT_LT(a, z);
+  EXPECT_FALSE(a < a);
+}
+
+TEST(Symbol, ConcurrentInterning) {
+  // Every thread interns the same spellings in a different order, enough of
+  // them to grow the table while the others read it.
+  constexpr int threads = 4, spellings = 5000;
+  std::vector<std::vector<Symbol>> interned(threads);
+  {
+    std::vector<std::jthread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&interned, t] {
+        for (int i = 0; i < spellings; ++i) {
+          int n = t % 2 == 0 ? i : spellings - 1 - i;
+          auto spelling = "concurrent" + std::to_string(n);
+          Symbol symbol(spelling);
+          EXPECT_EQ(symbol.str(), spelling);
+          interned[t].push_back(symbol);
+        }
+      });
+    }
+  }
+  for (int i = 0; i < spellings; ++i) {
+    EXPECT_EQ(interned[0][i], interned[2][i]);
+    EXPECT_EQ(interned[0][i], interned[1][spellings - 1 - i]);
+    EXPECT_EQ(interned[1][i], interned[3][i]);
+  }
+}
+
+TEST(Symbol, ConcurrentFresh) {
+  // Enough fresh symbols to grow the table while the other threads spell
+  // theirs.
+  constexpr int threads = 4, symbols = 5000;
+  std::vector<std::vector<Symbol>> made(threads);
+  {
+    std::vector<std::jthread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&made, t] {
+        for (int i = 0; i < symbols; ++i) {
+          made[t].push_back(Symbol::fresh("concurrent", i));
+          EXPECT_EQ(made[t].back().str(), "concurrent" + std::to_string(i));
+        }
+      });
+    }
+  }
+  SymbolSet all;
+  for (auto &thread : made) {
+    for (auto symbol : thread) {
+      all.insert(symbol);
+    }
+  }
+  EXPECT_EQ(all.take().size(), size_t(threads * symbols));
+}
+
+TEST(SymbolSet, Take) {
+  SymbolSet set;
+  set.insert("set_c");
+  set.insert("set_a");
+  set.insert("set_b");
+  set.insert("set_a");
+  set.erase("set_b");
+  EXPECT_TRUE(set.contains("set_a"));
+  EXPECT_FALSE(set.contains("set_b"));
+  std::vector<Symbol> expected{"set_a", "set_c"};
+  EXPECT_EQ(set.take(), expected);
+  EXPECT_FALSE(set.contains("set_a"));
+  EXPECT_TRUE(set.take().empty());
+
+  set.insert("set_b");
+  expected = {"set_b"};
+  EXPECT_EQ(set.take(), expected);
+}
+
+} // namespace lambcalc
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "threadpool.h"
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+
+namespace lambcalc {
+
+TEST(ThreadPool, RunsEveryTask) {
+  ThreadPool pool(4);
+  std::atomic<int> sum = 0;
+  TaskGroup group(pool);
+  for (int i = 1; i <= 1000; ++i) {
+    group.spawn([&sum, i] { sum += i; });
+  }
+  group.wait();
+  EXPECT_EQ(sum, 500500);
+}
+
+static void countLeaves(TaskGroup &group, std::atomic<int> &leaves,
+                        int depth) {
+  if (depth == 0) {
+    ++leaves;
+    return;
+  }
+  for (int i = 0; i < 2; ++i) {
+    group.spawn(
+        [&group, &leaves, depth] { countLeaves(group, leaves, depth - 1); });
+  }
+}
+
+TEST(ThreadPool, NestedSpawns) {
+  ThreadPool pool(4);
+  std::atomic<int> leaves = 0;
+  TaskGroup group(pool);
+  countLeaves(group, leaves, 12);
+  group.wait();
+  EXPECT_EQ(leaves, 1 << 12);
+}
+
+TEST(ThreadPool, WaitWakesForLateSpawns) {
+  // The waiter finds nothing to run and sleeps before the task spawns more.
+  ThreadPool pool(1);
+  std::atomic<int> ran = 0;
+  TaskGroup group(pool);
+  group.spawn([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (int i = 0; i < 4; ++i) {
+      group.spawn([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        ++ran;
+      });
+    }
+  });
+  group.wait();
+  EXPECT_EQ(ran, 4);
+}
+
+TEST(ThreadPool, WaitRethrows) {
+  ThreadPool pool(2);
+  TaskGroup group(pool);
+  group.spawn([] { throw std::runtime_error("task failed"); });
+  group.spawn([] {});
+  EXPECT_THROW(group.wait(), std::runtime_error);
+  // The exception is only rethrown once.
+  group.wait();
+}
+
+} // namespace lambcalc
\ No newline at end of file
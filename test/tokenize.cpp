@@ -0,0 +1,101 @@
+#include "parser.h"
+#include "tokenize.h"
+#include <gtest/gtest.h>
+
+namespace lambcalc {
+
+struct LexedToken {
+  Token kind;
+  size_t offset;
+  std::string text;
+  int value;
+  bool operator==(const LexedToken &) const = default;
+};
+
+static std::vector<LexedToken> lexBuffer(std::string_view source) {
+  std::vector<LexedToken> tokens;
+  BufferLexer lexer(source);
+  Token token;
+  do {
+    token = lexer.getToken();
+    tokens.push_back({token, lexer.getTokenOffset(),
+                      token == Token::Identifier
+                          ? std::string(lexer.getIdentifier())
+                          : "",
+                      token == Token::Number ? lexer.getNumber() : 0});
+  } while (token != Token::Eof);
+  return tokens;
+}
+
+static std::vector<LexedToken> lexArray(std::string_view source,
+                                        Classifier classifier) {
+  std::vector<LexedToken> tokens;
+  TokenArray array = tokenize(source, classifier);
+  TokenArrayLexer lexer(source, array);
+  Token token;
+  do {
+    token = lexer.getToken();
+    tokens.push_back({token, lexer.getTokenOffset(),
+                      token == Token::Identifier
+                          ? std::string(lexer.getIdentifier())
+                          : "",
+                      token == Token::Number ? lexer.getNumber() : 0});
+  } while (token != Token::Eof);
+  return tokens;
+}
+
+TEST(Tokenize, Lengths) {
+  std::string source("fn x1 => 123 + x1;");
+  TokenArray tokens = tokenize(source);
+  std::vector<Token> kinds{Token::Fn,   Token::Identifier, Token::Arrow,
+                           Token::Number, Token::Plus,   Token::Identifier,
+                           Token::Semicolon, Token::Eof};
+  std::vector<uint32_t> starts{0, 3, 6, 9, 13, 15, 17, 18};
+  std::vector<uint32_t> lengths{2, 2, 2, 3, 1, 2, 1, 0};
+  EXPECT_EQ(std::vector(tokens.kinds().begin(), tokens.kinds().end()), kinds);
+  EXPECT_EQ(std::vector(tokens.starts().begin(), tokens.starts().end()),
+            starts);
+  EXPECT_EQ(std::vector(tokens.lengths().begin(), tokens.lengths().end()),
+            lengths);
+  EXPECT_EQ(tokens.values()[3], 123);
+}
+
+TEST(Tokenize, MatchesBufferLexer) {
+  std::vector<std::string> sources{
+      "",
+      "   \t\n  ",
+      " (fn a => a + 1 ) ( if 1  then  2 else  3)  ",
+      "a=b => =>=> x;y",
+      "if1 then2 else fnx fn 007 42abc",
+      // Runs that cross the 64 byte block boundaries.
+      std::string(63, ' ') + "abcdef" + std::string(130, '\n') + "1234",
+      std::string(200, 'x') + " " + std::string(70, '9') + "+" +
+          std::string(64, 'y'),
+      "tail\x80\xff" + std::string(61, 'z'),
+  };
+  for (Classifier classifier :
+       {Classifier::Avx2, Classifier::Sse2, Classifier::Scalar}) {
+    if (!supports(classifier)) {
+      continue;
+    }
+    for (const auto &source : sources) {
+      EXPECT_EQ(lexArray(source, classifier), lexBuffer(source))
+          << static_cast<int>(classifier) << ": " << source;
+    }
+  }
+}
+
+TEST(Tokenize, Parser) {
+  std::string source("if x then x * f (x - 1) else 1");
+  TokenArray tokens = tokenize(source);
+  std::allocator<ast::Exp<>> allocator;
+  TokenArrayLexer lexer(source, tokens);
+  Parser parser(allocator, lexer,
+                {{ast::Bop::Plus, {{1, 2}}},
+                 {ast::Bop::Minus, {{1, 2}}},
+                 {ast::Bop::Times, {{3, 4}}}});
+  auto exp = parser.parseExpression();
+  EXPECT_EQ(exp->dump(), "(if x then (x * (f (x - 1))) else 1)");
+}
+
+} // namespace lambcalc
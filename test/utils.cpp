@@ -0,0 +1,76 @@
+#include "utils.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+TEST(SmallVector, Inline) {
+  SmallVector<int, 2> vec{1, 2};
+  EXPECT_EQ(vec.size(), 2u);
+  EXPECT_EQ(vec.capacity(), 2u);
+  EXPECT_EQ(reinterpret_cast<const std::byte *>(vec.data()),
+            reinterpret_cast<const std::byte *>(&vec));
+  vec.insert(vec.begin(), 0);
+  EXPECT_GT(vec.capacity(), 2u);
+  EXPECT_EQ(vec, (SmallVector<int, 2>{0, 1, 2}));
+  vec.pop_back();
+  EXPECT_EQ(vec.back(), 1);
+}
+
+TEST(SmallVector, Grows) {
+  SmallVector<std::string, 1> vec;
+  for (int i = 0; i < 100; ++i) {
+    vec.push_back(std::to_string(i));
+  }
+  // Grows when the argument refers to one of its own elements.
+  vec.emplace_back(vec[5]);
+  ASSERT_EQ(vec.size(), 101u);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(vec[i], std::to_string(i));
+  }
+  EXPECT_EQ(vec.back(), "5");
+}
+
+TEST(SmallVector, Move) {
+  SmallVector<std::unique_ptr<int>, 2> small;
+  small.push_back(std::make_unique<int>(1));
+  auto moved = std::move(small);
+  EXPECT_TRUE(small.empty());
+  EXPECT_EQ(*moved[0], 1);
+
+  SmallVector<std::unique_ptr<int>, 2> large;
+  for (int i = 0; i < 3; ++i) {
+    large.push_back(std::make_unique<int>(i));
+  }
+  int *heap = large[0].get();
+  moved = std::move(large);
+  EXPECT_TRUE(large.empty());
+  ASSERT_EQ(moved.size(), 3u);
+  EXPECT_EQ(moved[0].get(), heap);
+
+  // A moved from vector can be reused.
+  large.push_back(std::make_unique<int>(4));
+  EXPECT_EQ(*large[0], 4);
+
+  SmallVector<std::string, 2> copy{"a", "b", "c"};
+  auto copied = copy;
+  EXPECT_EQ(copied, copy);
+}
+
+TEST(ChunkedStack, Lifo) {
+  ChunkedStack<std::string> stack;
+  for (int i = 0; i < 10000; ++i) {
+    stack.push(std::to_string(i));
+  }
+  std::string *bottom = nullptr;
+  for (int i = 9999; i >= 0; --i) {
+    ASSERT_EQ(stack.top(), std::to_string(i));
+    if (i == 0) {
+      bottom = &stack.top();
+    }
+    stack.pop();
+  }
+  EXPECT_TRUE(stack.empty());
+  // Popped chunks are reused.
+  stack.emplace("a");
+  EXPECT_EQ(&stack.top(), bottom);
+}
\ No newline at end of file